@@ -0,0 +1,540 @@
+#include "Bvh.hh"
+#include "Parallel.hh"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+// Number of bins per axis when evaluating SAH splits.
+static const int NumBins = 16;
+
+// Leaves hold at most this many triangles, unless they cannot be split.
+static const int MaxLeafSize = 8;
+
+// Deeper than this, SAH splits give way to median splits, which bounds the
+// depth of the tree (and so the size of the traversal stacks).
+static const int MaxSahDepth = 40;
+static const int MaxStackSize = 128;
+
+// Relative cost of visiting a node, compared to intersecting one triangle.
+static const double TraversalCost = 1.0;
+
+// Each core gets at least this many queries in the batch functions.
+static const long QueriesPerChunk = 256;
+
+// Per-triangle data used while building.
+struct Bvh::buildTriangle {
+  double bounds[6];
+  double centroid[3];
+  int id;
+};
+
+// Grows bounds (min x, y, z, max x, y, z) to contain other.
+static void growBounds(double *bounds, const double *other) {
+  for (int a = 0; a < 3; a++) {
+    bounds[a] = std::min(bounds[a], other[a]);
+    bounds[a + 3] = std::max(bounds[a + 3], other[a + 3]);
+  }
+}
+
+// Sets bounds to the empty box.
+static void emptyBounds(double *bounds) {
+  for (int a = 0; a < 3; a++) {
+    bounds[a] = 1e300;
+    bounds[a + 3] = -1e300;
+  }
+}
+
+// Half the surface area of a box; only ever compared, so the factor of two
+// is left out.
+static double halfArea(const double *bounds) {
+  double dx = bounds[3] - bounds[0];
+  double dy = bounds[4] - bounds[1];
+  double dz = bounds[5] - bounds[2];
+  if (dx < 0) {
+    return 0;   // empty box
+  }
+  return dx * dy + dy * dz + dz * dx;
+}
+
+Bvh::Bvh(const TriangleMesh &mesh) {
+  build(mesh);
+}
+
+// Private helper functions
+
+void Bvh::build(const TriangleMesh &mesh) {
+  int n = mesh.numTriangles;
+  assert(n >= 0);
+
+  std::vector<buildTriangle> tris(n);
+  int chunks = numChunks(n, 65536);
+  parallelFor(n, chunks, [&](int, long begin, long end) {
+    for (long t = begin; t < end; t++) {
+      buildTriangle &bt = tris[t];
+      emptyBounds(bt.bounds);
+      for (int k = 0; k < 3; k++) {
+        const Point &p = (mesh.indices != 0 ? mesh.vertices[mesh.indices[3 * t + k]]
+                                            : mesh.vertices[3 * t + k]);
+        double v[6] = { p.getX(), p.getY(), p.getZ(),
+                        p.getX(), p.getY(), p.getZ() };
+        growBounds(bt.bounds, v);
+      }
+      for (int a = 0; a < 3; a++) {
+        bt.centroid[a] = 0.5 * (bt.bounds[a] + bt.bounds[a + 3]);
+      }
+      bt.id = (int) t;
+    }
+  });
+
+  mNodes.clear();
+  mNodes.reserve(n > 0 ? 2 * (n / 2 + 1) : 1);
+  buildNode(tris.data(), 0, n, 0, mNodes);
+
+  // Copy the corners into leaf order.
+  mCorners.resize(9 * (size_t) n);
+  mIds.resize(n);
+  parallelFor(n, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      int t = tris[i].id;
+      mIds[i] = t;
+      for (int k = 0; k < 3; k++) {
+        const Point &p = (mesh.indices != 0 ? mesh.vertices[mesh.indices[3 * t + k]]
+                                            : mesh.vertices[3 * t + k]);
+        mCorners[9 * i + 3 * k] = p.getX();
+        mCorners[9 * i + 3 * k + 1] = p.getY();
+        mCorners[9 * i + 3 * k + 2] = p.getZ();
+      }
+    }
+  });
+}
+
+// Appends the subtree over tris[begin .. end-1] to nodes, in depth-first
+// order, reordering those triangles into leaf order.  The top few levels
+// build their two children on separate threads, into separate arrays that
+// are then appended.
+void Bvh::buildNode(buildTriangle *tris, int begin, int end, int depth,
+                    std::vector<node> &nodes) {
+  int index = (int) nodes.size();
+  nodes.push_back(node());
+
+  double bounds[6], centroidBounds[6];
+  emptyBounds(bounds);
+  emptyBounds(centroidBounds);
+  for (int i = begin; i < end; i++) {
+    growBounds(bounds, tris[i].bounds);
+    double c[6] = { tris[i].centroid[0], tris[i].centroid[1], tris[i].centroid[2],
+                    tris[i].centroid[0], tris[i].centroid[1], tris[i].centroid[2] };
+    growBounds(centroidBounds, c);
+  }
+  std::copy(bounds, bounds + 6, nodes[index].bounds);
+
+  int n = end - begin;
+  nodes[index].first = begin;
+  nodes[index].count = n;
+  nodes[index].axis = 0;
+  nodes[index].pad = 0;
+  if (n <= 2) {
+    return;   // not worth splitting
+  }
+
+  // Find the best binned SAH split.
+  int bestAxis = -1, bestBin = 0;
+  double bestCost = 1e300;
+  if (depth < MaxSahDepth) {
+    for (int axis = 0; axis < 3; axis++) {
+      double lo = centroidBounds[axis];
+      double extent = centroidBounds[axis + 3] - lo;
+      if (extent <= 0) {
+        continue;
+      }
+
+      int binCount[NumBins] = { 0 };
+      double binBounds[NumBins][6];
+      for (int b = 0; b < NumBins; b++) {
+        emptyBounds(binBounds[b]);
+      }
+      double scale = NumBins / extent;
+      for (int i = begin; i < end; i++) {
+        int b = std::min(NumBins - 1, (int) ((tris[i].centroid[axis] - lo) * scale));
+        binCount[b]++;
+        growBounds(binBounds[b], tris[i].bounds);
+      }
+
+      // Sweep from the right to get the cost of everything right of each
+      // split, then from the left to evaluate each split.
+      double rightArea[NumBins];
+      int rightCount[NumBins];
+      double acc[6];
+      emptyBounds(acc);
+      int count = 0;
+      for (int b = NumBins - 1; b > 0; b--) {
+        growBounds(acc, binBounds[b]);
+        count += binCount[b];
+        rightArea[b] = halfArea(acc);
+        rightCount[b] = count;
+      }
+      emptyBounds(acc);
+      count = 0;
+      for (int b = 0; b < NumBins - 1; b++) {
+        growBounds(acc, binBounds[b]);
+        count += binCount[b];
+        double cost = halfArea(acc) * count + rightArea[b + 1] * rightCount[b + 1];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestBin = b;
+        }
+      }
+    }
+  }
+
+  int mid = begin;
+  int axis = bestAxis;
+  double area = halfArea(bounds);
+  double splitCost = TraversalCost + (area > 0 ? bestCost / area : n);
+  if (bestAxis >= 0 && (n > MaxLeafSize || splitCost < n)) {
+    double lo = centroidBounds[axis];
+    double scale = NumBins / (centroidBounds[axis + 3] - lo);
+    buildTriangle *split = std::partition(tris + begin, tris + end,
+      [axis, lo, scale, bestBin](const buildTriangle &t) {
+        return std::min(NumBins - 1, (int) ((t.centroid[axis] - lo) * scale)) <= bestBin;
+      });
+    mid = (int) (split - tris);
+  } else if (n > MaxLeafSize) {
+    // Too deep, or every centroid is in the same place:  split at the
+    // median of the widest axis.
+    axis = 0;
+    for (int a = 1; a < 3; a++) {
+      if (centroidBounds[a + 3] - centroidBounds[a] >
+          centroidBounds[axis + 3] - centroidBounds[axis]) {
+        axis = a;
+      }
+    }
+    mid = begin + n / 2;
+    std::nth_element(tris + begin, tris + mid, tris + end,
+      [axis](const buildTriangle &a, const buildTriangle &b) {
+        return a.centroid[axis] < b.centroid[axis];
+      });
+  } else {
+    return;   // cheaper as a leaf
+  }
+  if (mid == begin || mid == end) {
+    mid = begin + n / 2;
+  }
+
+  nodes[index].count = 0;
+  nodes[index].axis = axis;
+
+  if ((1 << depth) < numWorkerThreads() && n > 4096) {
+    std::vector<node> leftNodes, rightNodes;
+    std::thread worker(&Bvh::buildNode, this, tris, begin, mid, depth + 1,
+                       std::ref(leftNodes));
+    buildNode(tris, mid, end, depth + 1, rightNodes);
+    worker.join();
+
+    // Append both subtrees, shifting their right-child links.
+    int leftOffset = (int) nodes.size();
+    int rightOffset = leftOffset + (int) leftNodes.size();
+    for (size_t i = 0; i < leftNodes.size(); i++) {
+      if (leftNodes[i].count == 0) {
+        leftNodes[i].first += leftOffset;
+      }
+    }
+    for (size_t i = 0; i < rightNodes.size(); i++) {
+      if (rightNodes[i].count == 0) {
+        rightNodes[i].first += rightOffset;
+      }
+    }
+    nodes.insert(nodes.end(), leftNodes.begin(), leftNodes.end());
+    nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+    nodes[index].first = rightOffset;
+  } else {
+    buildNode(tris, begin, mid, depth + 1, nodes);
+    nodes[index].first = (int) nodes.size();
+    buildNode(tris, mid, end, depth + 1, nodes);
+  }
+}
+
+// Returns true if the ray (with the given origin and inverse direction)
+// passes through the box between tMin and tMax.
+static bool rayHitsBox(const double *bounds, const double *origin,
+                       const double *invDir, double tMin, double tMax) {
+  for (int a = 0; a < 3; a++) {
+    // A ray parallel to the slab is inside it for every t or for none.
+    // (The general case would compute 0 * inf = NaN for an origin on one
+    // of the slab's planes.)
+    if (std::isinf(invDir[a])) {
+      if (origin[a] < bounds[a] || origin[a] > bounds[a + 3]) {
+        return false;
+      }
+      continue;
+    }
+    double t0 = (bounds[a] - origin[a]) * invDir[a];
+    double t1 = (bounds[a + 3] - origin[a]) * invDir[a];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    tMin = (t0 > tMin ? t0 : tMin);
+    tMax = (t1 < tMax ? t1 : tMax);
+    if (tMin > tMax) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Moller-Trumbore ray/triangle intersection.  Updates hit (with the
+// triangle's position in leaf order) if the ray hits the triangle closer
+// than hit.t.
+bool Bvh::intersectTriangle(const Ray &ray, int tri, RayHit &hit) const {
+  const double *c = &mCorners[9 * (size_t) tri];
+  double o[3] = { ray.origin.getX(), ray.origin.getY(), ray.origin.getZ() };
+  double d[3] = { ray.direction.getX(), ray.direction.getY(), ray.direction.getZ() };
+  double e1[3] = { c[3] - c[0], c[4] - c[1], c[5] - c[2] };
+  double e2[3] = { c[6] - c[0], c[7] - c[1], c[8] - c[2] };
+
+  double p[3] = { d[1] * e2[2] - d[2] * e2[1],
+                  d[2] * e2[0] - d[0] * e2[2],
+                  d[0] * e2[1] - d[1] * e2[0] };
+  double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+  if (det == 0) {
+    return false;   // ray is parallel to the triangle
+  }
+  double invDet = 1 / det;
+
+  double s[3] = { o[0] - c[0], o[1] - c[1], o[2] - c[2] };
+  double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+  if (u < 0 || u > 1) {
+    return false;
+  }
+
+  double q[3] = { s[1] * e1[2] - s[2] * e1[1],
+                  s[2] * e1[0] - s[0] * e1[2],
+                  s[0] * e1[1] - s[1] * e1[0] };
+  double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+  if (v < 0 || u + v > 1) {
+    return false;
+  }
+
+  double t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+  if (t < ray.tMin || t >= hit.t) {
+    return false;
+  }
+
+  hit.triangle = tri;
+  hit.t = t;
+  hit.u = u;
+  hit.v = v;
+  return true;
+}
+
+// Stores the point of triangle tri closest to q in closest, following
+// Ericson, "Real-Time Collision Detection", section 5.1.5.
+void Bvh::closestOnTriangle(const double *q, int tri, double *closest) const {
+  const double *a = &mCorners[9 * (size_t) tri];
+  const double *b = a + 3;
+  const double *c = a + 6;
+  double ab[3], ac[3], ap[3], bp[3], cp[3];
+  for (int i = 0; i < 3; i++) {
+    ab[i] = b[i] - a[i];
+    ac[i] = c[i] - a[i];
+    ap[i] = q[i] - a[i];
+    bp[i] = q[i] - b[i];
+    cp[i] = q[i] - c[i];
+  }
+  double d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+  double d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+  double d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+  double d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+  double d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+  double d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+
+  // Work out which vertex, edge or face region q projects into, and the
+  // barycentric weights (v on b, w on c) of the closest point.
+  double v, w;
+  double vc = d1 * d4 - d3 * d2;
+  double vb = d5 * d2 - d1 * d6;
+  double va = d3 * d6 - d5 * d4;
+  if (d1 <= 0 && d2 <= 0) {
+    v = 0; w = 0;                                   // vertex a
+  } else if (d3 >= 0 && d4 <= d3) {
+    v = 1; w = 0;                                   // vertex b
+  } else if (d6 >= 0 && d5 <= d6) {
+    v = 0; w = 1;                                   // vertex c
+  } else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    v = d1 / (d1 - d3); w = 0;                      // edge ab
+  } else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    v = 0; w = d2 / (d2 - d6);                      // edge ac
+  } else if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    w = (d4 - d3) / ((d4 - d3) + (d5 - d6));        // edge bc
+    v = 1 - w;
+  } else {
+    double denom = 1 / (va + vb + vc);              // inside the face
+    v = vb * denom;
+    w = vc * denom;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    closest[i] = a[i] + ab[i] * v + ac[i] * w;
+  }
+}
+
+// Returns the squared distance from q to the box, or 0 if q is inside it.
+static double boxDistanceSquared(const double *bounds, const double *q) {
+  double d2 = 0;
+  for (int a = 0; a < 3; a++) {
+    double d = std::max(bounds[a] - q[a], std::max(0.0, q[a] - bounds[a + 3]));
+    d2 += d * d;
+  }
+  return d2;
+}
+
+// Accessors
+
+int Bvh::getNumTriangles() const {
+  return (int) mIds.size();
+}
+
+int Bvh::getNumNodes() const {
+  return (int) mNodes.size();
+}
+
+// Queries
+
+bool Bvh::intersect(const Ray &ray, RayHit &hit) const {
+  hit.triangle = -1;
+  hit.t = ray.tMax;
+  hit.u = hit.v = 0;
+  if (mIds.empty()) {
+    return false;
+  }
+
+  double origin[3] = { ray.origin.getX(), ray.origin.getY(), ray.origin.getZ() };
+  double dir[3] = { ray.direction.getX(), ray.direction.getY(), ray.direction.getZ() };
+  double invDir[3];
+  for (int a = 0; a < 3; a++) {
+    invDir[a] = 1 / dir[a];   // infinite for axis-parallel rays
+  }
+
+  int stack[MaxStackSize];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const node &nd = mNodes[stack[--top]];
+    if (!rayHitsBox(nd.bounds, origin, invDir, ray.tMin, hit.t)) {
+      continue;
+    }
+
+    if (nd.count > 0) {
+      for (int i = nd.first; i < nd.first + nd.count; i++) {
+        intersectTriangle(ray, i, hit);
+      }
+    } else {
+      // Visit the child nearer along the ray first, so that hits found
+      // there cull the farther one.
+      int left = (int) (&nd - &mNodes[0]) + 1;
+      assert(top + 2 <= MaxStackSize);
+      if (dir[nd.axis] < 0) {
+        stack[top++] = left;
+        stack[top++] = nd.first;
+      } else {
+        stack[top++] = nd.first;
+        stack[top++] = left;
+      }
+    }
+  }
+
+  if (hit.triangle < 0) {
+    return false;
+  }
+  hit.triangle = mIds[hit.triangle];
+  return true;
+}
+
+bool Bvh::closestPoint(const Point &q, ClosestHit &hit,
+                       double maxDistance) const {
+  hit.triangle = -1;
+  hit.distance = maxDistance;
+  if (mIds.empty()) {
+    return false;
+  }
+
+  double qc[3] = { q.getX(), q.getY(), q.getZ() };
+  double best = maxDistance * maxDistance;
+  double bestPoint[3] = { 0, 0, 0 };
+  int bestTri = -1;
+
+  // Stack of nodes to visit, with the squared distance to their boxes.
+  int stack[MaxStackSize];
+  double stackDist[MaxStackSize];
+  int top = 0;
+  stack[top] = 0;
+  stackDist[top] = boxDistanceSquared(mNodes[0].bounds, qc);
+  top++;
+
+  while (top > 0) {
+    top--;
+    if (stackDist[top] > best) {
+      continue;
+    }
+    int n = stack[top];
+    const node &nd = mNodes[n];
+
+    if (nd.count > 0) {
+      for (int i = nd.first; i < nd.first + nd.count; i++) {
+        double p[3];
+        closestOnTriangle(qc, i, p);
+        double dx = p[0] - qc[0], dy = p[1] - qc[1], dz = p[2] - qc[2];
+        double d = dx * dx + dy * dy + dz * dz;
+        if (d <= best) {
+          best = d;
+          bestTri = i;
+          std::copy(p, p + 3, bestPoint);
+        }
+      }
+    } else {
+      // Push the farther child first, so the nearer one is visited first.
+      int left = n + 1;
+      int right = nd.first;
+      double dl = boxDistanceSquared(mNodes[left].bounds, qc);
+      double dr = boxDistanceSquared(mNodes[right].bounds, qc);
+      assert(top + 2 <= MaxStackSize);
+      if (dl <= dr) {
+        stack[top] = right; stackDist[top] = dr; top++;
+        stack[top] = left; stackDist[top] = dl; top++;
+      } else {
+        stack[top] = left; stackDist[top] = dl; top++;
+        stack[top] = right; stackDist[top] = dr; top++;
+      }
+    }
+  }
+
+  if (bestTri < 0) {
+    return false;
+  }
+  hit.triangle = mIds[bestTri];
+  hit.distance = sqrt(best);
+  hit.point = Point(bestPoint[0], bestPoint[1], bestPoint[2]);
+  return true;
+}
+
+void Bvh::intersectBatch(const Ray *rays, int numRays, RayHit *hits) const {
+  int chunks = numChunks(numRays, QueriesPerChunk);
+  parallelFor(numRays, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      intersect(rays[i], hits[i]);
+    }
+  });
+}
+
+void Bvh::closestPointBatch(const Point *queries, int numQueries,
+                            ClosestHit *hits, double maxDistance) const {
+  int chunks = numChunks(numQueries, QueriesPerChunk);
+  parallelFor(numQueries, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      closestPoint(queries[i], hits[i], maxDistance);
+    }
+  });
+}
@@ -0,0 +1,94 @@
+#ifndef BVH_HH
+#define BVH_HH
+
+// A bounding volume hierarchy over the triangles of a TriangleMesh, for ray
+// intersection and closest-point queries.  The tree is built top-down with
+// the binned surface area heuristic (SAH), the top levels in parallel, and
+// is stored as one flat array of nodes in depth-first order:  the left child
+// of an inner node is always the node right after it.
+
+#include "Mesh.hh"
+#include "Point.hh"
+#include <vector>
+
+// A ray origin + t * direction, for tMin <= t <= tMax.  The direction need
+// not be normalised; distances along the ray are then in units of its length.
+struct Ray {
+  Point origin;
+  Point direction;
+  double tMin;
+  double tMax;
+
+  Ray() : tMin(0), tMax(1e300) { }
+  Ray(const Point &origin, const Point &direction,
+      double tMin = 0, double tMax = 1e300)
+    : origin(origin), direction(direction), tMin(tMin), tMax(tMax) { }
+};
+
+// Where a ray hit the mesh.  triangle is -1 if the ray hit nothing.
+struct RayHit {
+  int triangle;    // index of the triangle in the mesh
+  double t;        // ray parameter of the hit
+  double u, v;     // barycentric coordinates of the hit in that triangle
+};
+
+// The point of the mesh closest to a query point.  triangle is -1 if the
+// mesh is empty or nothing was found within the distance limit.
+struct ClosestHit {
+  int triangle;
+  double distance;
+  Point point;
+};
+
+class Bvh {
+
+private:
+  // A node of the hierarchy.  Leaves refer to a run of triangles in the
+  // reordered triangle arrays.
+  struct node {
+    double bounds[6];  // min x, y, z, then max x, y, z
+    int first;         // Inner nodes:  index of the right child.
+                       // Leaves:  first triangle.
+    int count;         // Inner nodes:  0.  Leaves:  number of triangles.
+    int axis;          // Inner nodes:  the axis the children were split on.
+    int pad;
+  };
+
+  struct buildTriangle;
+
+  std::vector<node> mNodes;
+  std::vector<double> mCorners;   // 9 coordinates per triangle, in leaf order
+  std::vector<int> mIds;          // mesh index of each triangle, in leaf order
+
+  void build(const TriangleMesh &mesh);
+  void buildNode(buildTriangle *tris, int begin, int end, int depth,
+                 std::vector<node> &nodes);
+
+  bool intersectTriangle(const Ray &ray, int tri, RayHit &hit) const;
+  void closestOnTriangle(const double *q, int tri, double *closest) const;
+
+public:
+  // Builds the hierarchy over the triangles of the mesh.  The triangle
+  // corners are copied, so the mesh need not outlive the hierarchy.
+  Bvh(const TriangleMesh &mesh);
+
+  // Accessors
+  int getNumTriangles() const;
+  int getNumNodes() const;
+
+  // Finds the nearest hit along the ray.  Returns true (and fills in hit) if
+  // the ray hits any triangle.
+  bool intersect(const Ray &ray, RayHit &hit) const;
+
+  // Finds the point of the mesh closest to q, ignoring anything further away
+  // than maxDistance.  Returns true (and fills in hit) if one was found.
+  bool closestPoint(const Point &q, ClosestHit &hit,
+                    double maxDistance = 1e300) const;
+
+  // Batch versions of the above, which split the queries across all cores.
+  void intersectBatch(const Ray *rays, int numRays, RayHit *hits) const;
+  void closestPointBatch(const Point *queries, int numQueries,
+                         ClosestHit *hits, double maxDistance = 1e300) const;
+};
+
+#endif // BVH_HH
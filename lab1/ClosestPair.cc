@@ -0,0 +1,347 @@
+#include "ClosestPair.hh"
+#include "Parallel.hh"
+#include "SpatialSort.hh"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Each core gets at least this many points (or grid cells).
+static const long PointsPerChunk = 16384;
+
+// Grid cell coordinates are packed into 21 bits each.  Cells further apart
+// than 2^21 cells share keys (as in SpatialHash), which only means some
+// points are compared that needn't be:  the wrapped coordinates are still
+// neighbours exactly when the cells are, so no pair is seen twice.
+static const int CellBits = 21;
+static const long long CellMask = (1LL << CellBits) - 1;
+
+// Cells are never narrower than 2^-52 of the grid's extent, so that the
+// unwrapped cell coordinates fit in a long long.
+static const double MinCellFraction = 1.0 / 4503599627370496.0;
+
+// The closest pair of this many points or fewer is found by comparing them
+// all.
+static const int BrutePairs = 64;
+
+// Pairs are collected per thread and copied to the output this many at a
+// time, so that threads only touch the shared counter once per block.
+static const int PairBlockSize = 256;
+
+// The 13 neighbours of a cell that come after it in (x, y, z) order.  Each
+// pair of neighbouring cells is handled by the first of the two.
+static const int ForwardOffsets[13][3] = {
+  { 0, 0, 1 },
+  { 0, 1, -1 }, { 0, 1, 0 }, { 0, 1, 1 },
+  { 1, -1, -1 }, { 1, -1, 0 }, { 1, -1, 1 },
+  { 1, 0, -1 }, { 1, 0, 0 }, { 1, 0, 1 },
+  { 1, 1, -1 }, { 1, 1, 0 }, { 1, 1, 1 }
+};
+
+// Points sorted into the cells of a uniform grid.
+struct CellGrid {
+  std::vector<unsigned long long> cellKeys;   // distinct keys, in order
+  std::vector<int> cellStart;   // cell c holds sorted points
+                                // [cellStart[c], cellStart[c + 1])
+  std::vector<int> order;       // original index of each sorted point
+  std::vector<double> coords;   // x, y, z of each sorted point
+  bool wraps;                   // true if some cell keys are shared
+};
+
+// Packs grid cell coordinates into one key, wrapping each at 2^21.
+static unsigned long long packCell(long long cx, long long cy, long long cz) {
+  return ((unsigned long long) (cx & CellMask) << (2 * CellBits)) |
+         ((unsigned long long) (cy & CellMask) << CellBits) |
+         (unsigned long long) (cz & CellMask);
+}
+
+// Sorts the points into a grid whose cells are cubes of the given side (or
+// wider, if the points are so far apart that the cell coordinates would not
+// fit in a long long).  Every pass over the points is split across cores.
+static void buildGrid(const Point *points, int numPoints, double cellSize,
+                      CellGrid &grid) {
+  int chunks = numChunks(numPoints, PointsPerChunk);
+
+  // Bounding box, so that cell coordinates start at zero:  each chunk finds
+  // the box of its points, and then the boxes are combined.
+  std::vector<double> boxes(6 * (size_t) chunks);
+  parallelFor(numPoints, chunks, [&](int c, long begin, long end) {
+    double *box = &boxes[6 * (size_t) c];
+    for (int a = 0; a < 3; a++) {
+      box[a] = std::numeric_limits<double>::infinity();
+      box[a + 3] = -box[a];
+    }
+    for (long i = begin; i < end; i++) {
+      double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+      for (int a = 0; a < 3; a++) {
+        box[a] = std::min(box[a], v[a]);
+        box[a + 3] = std::max(box[a + 3], v[a]);
+      }
+    }
+  });
+  double lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = boxes[a];
+    hi[a] = boxes[a + 3];
+    for (int c = 1; c < chunks; c++) {
+      lo[a] = std::min(lo[a], boxes[6 * (size_t) c + a]);
+      hi[a] = std::max(hi[a], boxes[6 * (size_t) c + a + 3]);
+    }
+  }
+
+  double extent = std::max(hi[0] - lo[0],
+                           std::max(hi[1] - lo[1], hi[2] - lo[2]));
+  cellSize = std::max(cellSize, extent * MinCellFraction);
+  if (cellSize <= 0) {
+    cellSize = 1;   // every point is in the same place
+  }
+  // (the last cell's neighbour must fit, too)
+  grid.wraps = (extent / cellSize >= (double) CellMask);
+
+  // Sort the points by cell, and copy their coordinates into that order.
+  std::vector<unsigned long long> keys(numPoints);
+  grid.order.resize(numPoints);
+  parallelFor(numPoints, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      long long cell[3];
+      double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+      for (int a = 0; a < 3; a++) {
+        cell[a] = (long long) ((v[a] - lo[a]) / cellSize);
+      }
+      keys[i] = packCell(cell[0], cell[1], cell[2]);
+      grid.order[i] = (int) i;
+    }
+  });
+  sortByKey(keys, grid.order);
+
+  grid.coords.resize(3 * (size_t) numPoints);
+  parallelFor(numPoints, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      const Point &p = points[grid.order[i]];
+      grid.coords[3 * i] = p.getX();
+      grid.coords[3 * i + 1] = p.getY();
+      grid.coords[3 * i + 2] = p.getZ();
+    }
+  });
+
+  // The distinct cells, and where each one's points start.  Each chunk
+  // counts the cells that start in it, and then lists them in place.
+  std::vector<int> firstCell(chunks + 1, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    parallelFor(numPoints, chunks, [&](int c, long begin, long end) {
+      int k = firstCell[c];
+      for (long i = begin; i < end; i++) {
+        if (i == 0 || keys[i] != keys[i - 1]) {
+          if (pass == 1) {
+            grid.cellKeys[k] = keys[i];
+            grid.cellStart[k] = (int) i;
+          }
+          k++;
+        }
+      }
+      if (pass == 0) {
+        firstCell[c + 1] = k;   // (a count, until the prefix sum)
+      }
+    });
+
+    if (pass == 0) {
+      for (int c = 0; c < chunks; c++) {
+        firstCell[c + 1] += firstCell[c];
+      }
+      grid.cellKeys.resize(firstCell[chunks]);
+      grid.cellStart.resize(firstCell[chunks] + 1);
+      grid.cellStart[firstCell[chunks]] = numPoints;
+    }
+  }
+}
+
+// Calls func(j0, j1) with the range of sorted points in the given cell, and
+// then in each of the cell's forward neighbours that holds any points.
+template <typename Func>
+static void forEachForwardCell(const CellGrid &grid, int cell, Func func) {
+  unsigned long long key = grid.cellKeys[cell];
+  long long cx = (long long) (key >> (2 * CellBits));
+  long long cy = (long long) (key >> CellBits) & CellMask;
+  long long cz = (long long) key & CellMask;
+
+  func(grid.cellStart[cell], grid.cellStart[cell + 1]);
+  for (int k = 0; k < 13; k++) {
+    long long nx = cx + ForwardOffsets[k][0];
+    long long ny = cy + ForwardOffsets[k][1];
+    long long nz = cz + ForwardOffsets[k][2];
+    if (!grid.wraps && (ny < 0 || nz < 0)) {
+      continue;   // (nx is never below cx, and nothing is above CellMask)
+    }
+
+    // (a neighbour across the wrap comes before the cell in key order)
+    unsigned long long neighbour = packCell(nx, ny, nz);
+    const unsigned long long *keys = grid.cellKeys.data();
+    int lo = (neighbour > key ? cell + 1 : 0);
+    int hi = (neighbour > key ? (int) grid.cellKeys.size() : cell);
+    int n = (int) (std::lower_bound(keys + lo, keys + hi, neighbour) - keys);
+    if (n < hi && keys[n] == neighbour) {
+      func(grid.cellStart[n], grid.cellStart[n + 1]);
+    }
+  }
+}
+
+// Calls func(i, j, squared distance) for every pair of sorted points i in
+// [i0, i1) and j in [j0, j1), or for every pair i < j in [i0, i1) if the two
+// ranges are the same.
+template <typename Func>
+static void compareRanges(const CellGrid &grid, int i0, int i1, int j0,
+                          int j1, Func func) {
+  bool same = (i0 == j0);
+  for (int i = i0; i < i1; i++) {
+    const double *p = &grid.coords[3 * (size_t) i];
+    for (int j = (same ? i + 1 : j0); j < j1; j++) {
+      const double *q = &grid.coords[3 * (size_t) j];
+      double dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+      func(i, j, dx * dx + dy * dy + dz * dz);
+    }
+  }
+}
+
+// Returns the squared distance between two points, worked out the same way
+// as compareRanges() does.
+static double squaredDistance(const Point &p, const Point &q) {
+  double dx = p.getX() - q.getX();
+  double dy = p.getY() - q.getY();
+  double dz = p.getZ() - q.getZ();
+  return dx * dx + dy * dy + dz * dz;
+}
+
+bool closestPair(const Point *points, int numPoints, PointPair &pair,
+                 double *distance) {
+  if (numPoints < 2) {
+    return false;
+  }
+
+  double best = std::numeric_limits<double>::infinity();
+  if (numPoints <= BrutePairs) {
+    for (int i = 0; i < numPoints; i++) {
+      for (int j = i + 1; j < numPoints; j++) {
+        double d2 = squaredDistance(points[i], points[j]);
+        if (d2 < best) {
+          best = d2;
+          pair.first = i;
+          pair.second = j;
+        }
+      }
+    }
+  } else {
+    // The closest pair of a sample of the points (one from each of
+    // n^(2/3) runs of the array, found recursively) bounds the distance
+    // between the closest pair of all of them.
+    int numSamples = std::max(2, (int) pow((double) numPoints, 2.0 / 3));
+    std::vector<Point> sample(numSamples);
+    std::vector<int> sampleIndex(numSamples);
+    for (int s = 0; s < numSamples; s++) {
+      long begin = (long) numPoints * s / numSamples;
+      long end = (long) numPoints * (s + 1) / numSamples;
+      unsigned long long h = (unsigned long long) s * 0x9E3779B97F4A7C15ULL;
+      sampleIndex[s] = (int) (begin + (long) ((h >> 32) % (end - begin)));
+      sample[s] = points[sampleIndex[s]];
+    }
+    PointPair samplePair;
+    closestPair(sample.data(), numSamples, samplePair);
+    pair.first = sampleIndex[samplePair.first];
+    pair.second = sampleIndex[samplePair.second];
+    best = squaredDistance(points[pair.first], points[pair.second]);
+
+    if (best > 0) {
+      // So the closest pair is no further apart than a cell of a grid with
+      // cells that size, and the pair is in the same or neighbouring cells.
+      // Each chunk of cells keeps its best pair, and then the chunks' bests
+      // are compared.
+      CellGrid grid;
+      buildGrid(points, numPoints, sqrt(best), grid);
+
+      int numCells = (int) grid.cellKeys.size();
+      int chunks = numChunks(numCells, PointsPerChunk / 16);
+      std::vector<double> bestDist(chunks, best);
+      std::vector<PointPair> bestPair(chunks, pair);
+      parallelFor(numCells, chunks, [&](int c, long begin, long end) {
+        for (long cell = begin; cell < end; cell++) {
+          int i0 = grid.cellStart[cell], i1 = grid.cellStart[cell + 1];
+          forEachForwardCell(grid, (int) cell, [&](int j0, int j1) {
+            compareRanges(grid, i0, i1, j0, j1, [&](int i, int j, double d2) {
+              if (d2 < bestDist[c]) {
+                bestDist[c] = d2;
+                bestPair[c].first = grid.order[i];
+                bestPair[c].second = grid.order[j];
+              }
+            });
+          });
+        }
+      });
+
+      for (int c = 0; c < chunks; c++) {
+        if (bestDist[c] < best) {
+          best = bestDist[c];
+          pair = bestPair[c];
+        }
+      }
+    }
+  }
+
+  if (pair.first > pair.second) {
+    std::swap(pair.first, pair.second);
+  }
+  if (distance != 0) {
+    *distance = sqrt(best);
+  }
+  return true;
+}
+
+long pairsWithinDistance(const Point *points, int numPoints, double epsilon,
+                         PointPair *pairs, long capacity) {
+  assert(epsilon >= 0);
+  if (numPoints < 2) {
+    return 0;
+  }
+
+  // Cells are at least epsilon wide, so every close pair is in the same or
+  // neighbouring cells.
+  CellGrid grid;
+  buildGrid(points, numPoints, epsilon, grid);
+
+  const double eps2 = epsilon * epsilon;
+  std::atomic<long> found(0);
+
+  int numCells = (int) grid.cellKeys.size();
+  int cellChunks = numChunks(numCells, PointsPerChunk / 16);
+  parallelFor(numCells, cellChunks, [&](int, long begin, long end) {
+    PointPair block[PairBlockSize];
+    int blockCount = 0;
+
+    // Copies the block to the output, reserving space with the counter.
+    auto flush = [&]() {
+      long pos = found.fetch_add(blockCount);
+      for (int k = 0; k < blockCount && pos + k < capacity; k++) {
+        pairs[pos + k] = block[k];
+      }
+      blockCount = 0;
+    };
+
+    for (long cell = begin; cell < end; cell++) {
+      int i0 = grid.cellStart[cell], i1 = grid.cellStart[cell + 1];
+      forEachForwardCell(grid, (int) cell, [&](int j0, int j1) {
+        compareRanges(grid, i0, i1, j0, j1, [&](int i, int j, double d2) {
+          if (d2 <= eps2) {
+            block[blockCount].first = std::min(grid.order[i], grid.order[j]);
+            block[blockCount].second = std::max(grid.order[i], grid.order[j]);
+            if (++blockCount == PairBlockSize) {
+              flush();
+            }
+          }
+        });
+      });
+    }
+    flush();
+  });
+
+  return found.load();
+}
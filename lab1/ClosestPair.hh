@@ -0,0 +1,34 @@
+#ifndef CLOSESTPAIR_HH
+#define CLOSESTPAIR_HH
+
+// Proximity queries over whole point sets:  the closest pair of points, and
+// every pair of points within some distance of each other.  Both avoid
+// comparing all O(n^2) pairs, and both run in parallel.
+
+#include "Point.hh"
+
+// A pair of point indices, with first < second.
+struct PointPair {
+  int first;
+  int second;
+};
+
+// Finds the two points closest to each other.  The closest pair of a sample
+// of the points bounds the distance, and then the points are bucketed into
+// a grid of cells that size, as pairsWithinDistance() does, and only points
+// in neighbouring cells are compared.  Returns false if there are fewer
+// than two points.  If distance is not 0 the distance between the pair is
+// stored there.
+bool closestPair(const Point *points, int numPoints, PointPair &pair,
+                 double *distance = 0);
+
+// Finds every pair of points no more than epsilon apart, by bucketing the
+// points into a grid of epsilon-sized cells and only comparing points in
+// neighbouring cells.  Up to capacity pairs are written to pairs, in no
+// particular order.  Returns the total number of pairs found; if that is
+// more than capacity, the extra pairs were dropped and the call can be
+// repeated with a larger buffer.
+long pairsWithinDistance(const Point *points, int numPoints, double epsilon,
+                         PointPair *pairs, long capacity);
+
+#endif // CLOSESTPAIR_HH
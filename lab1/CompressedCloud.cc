@@ -0,0 +1,246 @@
+#include "CompressedCloud.hh"
+#include "SpatialSort.hh"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static_assert(std::is_trivially_copyable<Point>::value &&
+              sizeof(Point) == 3 * sizeof(double),
+              "Point must be three packed doubles");
+
+// Points per block of delta-encoded data.  Decoding a random range starts
+// at the beginning of its block, so smaller blocks mean faster random
+// access but slightly larger encodings.
+static const int BlockSize = 128;
+
+// Points dequantised at a time, through a buffer on the stack.
+static const int DecodeBatch = 256;
+
+// Appends v to bytes as a varint:  7 bits per byte, low bits first, with
+// the top bit set on every byte but the last.
+static void putVarint(std::vector<unsigned char> &bytes, unsigned long long v) {
+  while (v >= 0x80) {
+    bytes.push_back((unsigned char) (v | 0x80));
+    v >>= 7;
+  }
+  bytes.push_back((unsigned char) v);
+}
+
+// Reads a varint starting at p, and returns a pointer past it.
+static const unsigned char * getVarint(const unsigned char *p,
+                                       unsigned long long &v) {
+  v = 0;
+  int shift = 0;
+  while (*p & 0x80) {
+    v |= (unsigned long long) (*p & 0x7f) << shift;
+    shift += 7;
+    p++;
+  }
+  v |= (unsigned long long) *p << shift;
+  return p + 1;
+}
+
+// Zigzag encoding maps small signed differences to small unsigned values:
+// 0, -1, 1, -2, 2, ... become 0, 1, 2, 3, 4, ...
+static unsigned long long zigzag(long long v) {
+  return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63);
+}
+
+static long long unzigzag(unsigned long long v) {
+  return (long long) (v >> 1) ^ -(long long) (v & 1);
+}
+
+// Converts count quantised points (x, y, z per point) to coordinates,
+// origin + q * step, storing 3 * count doubles in out.
+static void dequantise(const unsigned int *q, int count, const double *origin,
+                       const double *step, double *out) {
+  int n = 3 * count;
+  int i = 0;
+
+#ifdef __SSE2__
+  // Two points (six values) per iteration.  The axis pattern repeats every
+  // three registers:  (x, y), (z, x), (y, z).
+  __m128d s0 = _mm_set_pd(step[1], step[0]);
+  __m128d s1 = _mm_set_pd(step[0], step[2]);
+  __m128d s2 = _mm_set_pd(step[2], step[1]);
+  __m128d o0 = _mm_set_pd(origin[1], origin[0]);
+  __m128d o1 = _mm_set_pd(origin[0], origin[2]);
+  __m128d o2 = _mm_set_pd(origin[2], origin[1]);
+
+  // SSE2 only converts signed integers, so flip the top bit first and add
+  // 2^31 back afterwards.
+  const __m128i flip = _mm_set1_epi32((int) 0x80000000u);
+  const __m128d bias = _mm_set1_pd(2147483648.0);
+
+  for (; i + 6 <= n; i += 6) {
+    __m128i a = _mm_xor_si128(_mm_loadl_epi64((const __m128i *) (q + i)), flip);
+    __m128i b = _mm_xor_si128(_mm_loadl_epi64((const __m128i *) (q + i + 2)), flip);
+    __m128i c = _mm_xor_si128(_mm_loadl_epi64((const __m128i *) (q + i + 4)), flip);
+    __m128d da = _mm_add_pd(_mm_cvtepi32_pd(a), bias);
+    __m128d db = _mm_add_pd(_mm_cvtepi32_pd(b), bias);
+    __m128d dc = _mm_add_pd(_mm_cvtepi32_pd(c), bias);
+    _mm_storeu_pd(out + i, _mm_add_pd(o0, _mm_mul_pd(da, s0)));
+    _mm_storeu_pd(out + i + 2, _mm_add_pd(o1, _mm_mul_pd(db, s1)));
+    _mm_storeu_pd(out + i + 4, _mm_add_pd(o2, _mm_mul_pd(dc, s2)));
+  }
+#endif
+
+  for (; i < n; i++) {
+    out[i] = origin[i % 3] + q[i] * step[i % 3];
+  }
+}
+
+CompressedCloud::CompressedCloud(const Point *points, int numPoints,
+                                 CloudPrecision precision, bool deltaEncode) {
+  assert(numPoints >= 0);
+  mPrecision = precision;
+  mDelta = deltaEncode;
+  mNumPoints = numPoints;
+
+  // Grid over the bounding box.
+  double lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+  for (int i = 0; i < numPoints; i++) {
+    double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+    for (int a = 0; a < 3; a++) {
+      lo[a] = (i == 0 ? v[a] : std::min(lo[a], v[a]));
+      hi[a] = (i == 0 ? v[a] : std::max(hi[a], v[a]));
+    }
+  }
+  double maxLevel = (precision == Quantise16 ? 65535.0 : 4294967295.0);
+  for (int a = 0; a < 3; a++) {
+    mOrigin[a] = lo[a];
+    mStep[a] = (hi[a] > lo[a] ? (hi[a] - lo[a]) / maxLevel : 1);
+  }
+
+  if (!deltaEncode) {
+    if (precision == Quantise16) {
+      mCoords16.resize(3 * (size_t) numPoints);
+    } else {
+      mCoords32.resize(3 * (size_t) numPoints);
+    }
+    for (int i = 0; i < numPoints; i++) {
+      unsigned int q[3];
+      quantise(points[i], q);
+      for (int a = 0; a < 3; a++) {
+        if (precision == Quantise16) {
+          mCoords16[3 * (size_t) i + a] = (unsigned short) q[a];
+        } else {
+          mCoords32[3 * (size_t) i + a] = q[a];
+        }
+      }
+    }
+    return;
+  }
+
+  // Delta encoding:  Morton order puts nearby points next to each other,
+  // so the differences are small and their varints short.
+  spatialSortOrder(points, numPoints, MortonCurve, mOrder);
+  unsigned int prev[3] = { 0, 0, 0 };
+  for (int i = 0; i < numPoints; i++) {
+    unsigned int q[3];
+    quantise(points[mOrder[i]], q);
+    if (i % BlockSize == 0) {
+      mBlockStart.push_back((long) mBytes.size());
+      for (int a = 0; a < 3; a++) {
+        putVarint(mBytes, q[a]);
+      }
+    } else {
+      for (int a = 0; a < 3; a++) {
+        putVarint(mBytes, zigzag((long long) q[a] - (long long) prev[a]));
+      }
+    }
+    std::copy(q, q + 3, prev);
+  }
+  std::vector<unsigned char>(mBytes).swap(mBytes);   // trim spare capacity
+}
+
+// Private helper functions
+
+// Stores the grid coordinates of p in q[0 .. 2].
+void CompressedCloud::quantise(const Point &p, unsigned int *q) const {
+  double v[3] = { p.getX(), p.getY(), p.getZ() };
+  double maxLevel = (mPrecision == Quantise16 ? 65535.0 : 4294967295.0);
+  for (int a = 0; a < 3; a++) {
+    double level = floor((v[a] - mOrigin[a]) / mStep[a] + 0.5);
+    q[a] = (unsigned int) std::max(0.0, std::min(maxLevel, level));
+  }
+}
+
+// Stores the grid coordinates of stored points [first, first + count) in
+// q, three per point.
+void CompressedCloud::decodeQuantised(int first, int count,
+                                      unsigned int *q) const {
+  if (!mDelta) {
+    for (int i = 0; i < 3 * count; i++) {
+      q[i] = (mPrecision == Quantise16 ? mCoords16[3 * (size_t) first + i]
+                                       : mCoords32[3 * (size_t) first + i]);
+    }
+    return;
+  }
+
+  // Decode from the start of first's block, keeping only the points asked
+  // for.
+  int block = first / BlockSize;
+  const unsigned char *p = &mBytes[mBlockStart[block]];
+  int i = block * BlockSize;
+  unsigned long long cur[3] = { 0, 0, 0 };
+  for (; i < first + count; i++) {
+    for (int a = 0; a < 3; a++) {
+      unsigned long long v;
+      p = getVarint(p, v);
+      cur[a] = (i % BlockSize == 0 ? v : cur[a] + unzigzag(v));
+    }
+    if (i >= first) {
+      for (int a = 0; a < 3; a++) {
+        q[3 * (i - first) + a] = (unsigned int) cur[a];
+      }
+    }
+  }
+}
+
+// Accessors
+
+int CompressedCloud::getNumPoints() const {
+  return mNumPoints;
+}
+
+CloudPrecision CompressedCloud::getPrecision() const {
+  return mPrecision;
+}
+
+bool CompressedCloud::isDeltaEncoded() const {
+  return mDelta;
+}
+
+long CompressedCloud::getEncodedSize() const {
+  if (mDelta) {
+    return (long) (mBytes.size() + mBlockStart.size() * sizeof(long));
+  }
+  return (long) (mCoords16.size() * sizeof(unsigned short) +
+                 mCoords32.size() * sizeof(unsigned int));
+}
+
+const std::vector<int> & CompressedCloud::getOrder() const {
+  return mOrder;
+}
+
+// Member functions
+
+void CompressedCloud::decode(int first, int count, Point *out) const {
+  assert(first >= 0 && count >= 0 && first + count <= mNumPoints);
+
+  unsigned int q[3 * DecodeBatch];
+  double coords[3 * DecodeBatch];
+  for (int done = 0; done < count; done += DecodeBatch) {
+    int n = std::min(DecodeBatch, count - done);
+    decodeQuantised(first + done, n, q);
+    dequantise(q, n, mOrigin, mStep, coords);
+    memcpy((void *) (out + done), coords, n * sizeof(Point));
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef COMPRESSEDCLOUD_HH
+#define COMPRESSEDCLOUD_HH
+
+// A compressed store for large point clouds.  Each coordinate is quantised
+// to a 16- or 32-bit integer relative to the bounding box of the cloud (so a
+// point takes 6 or 12 bytes instead of 24), and the points can optionally be
+// sorted into Morton order and delta-encoded, which shrinks them further.
+// Points are decoded back to Point batches on demand.  Delta encoding pays
+// off for dense clouds such as scans, where neighbouring points are only a
+// few grid steps apart; for sparse random points it may save little.
+//
+// Quantisation error is at most half a grid step per coordinate:  the
+// extent of the bounding box divided by 2^16 - 1 (or 2^32 - 1).
+
+#include "Point.hh"
+#include <vector>
+
+enum CloudPrecision {
+  Quantise16,
+  Quantise32
+};
+
+class CompressedCloud {
+
+private:
+  CloudPrecision mPrecision;
+  bool mDelta;
+  int mNumPoints;
+  double mOrigin[3];     // the bounding box minimum
+  double mStep[3];       // size of one grid step along each axis
+
+  // Fixed-width storage (no delta encoding):  x, y, z per point.
+  std::vector<unsigned short> mCoords16;
+  std::vector<unsigned int> mCoords32;
+
+  // Delta storage:  points come in blocks; each block starts at byte
+  // mBlockStart[b] with its first point in full, followed by the zigzag
+  // varint differences of each later point from the one before it.
+  std::vector<unsigned char> mBytes;
+  std::vector<long> mBlockStart;
+
+  std::vector<int> mOrder;   // input index of each stored point
+
+  void quantise(const Point &p, unsigned int *q) const;
+  void decodeQuantised(int first, int count, unsigned int *q) const;
+
+public:
+  // Compresses the points.  With delta encoding the points are stored in
+  // Morton order; getOrder() gives the input index of each stored point.
+  CompressedCloud(const Point *points, int numPoints,
+                  CloudPrecision precision, bool deltaEncode = false);
+
+  // Accessors
+  int getNumPoints() const;
+  CloudPrecision getPrecision() const;
+  bool isDeltaEncoded() const;
+
+  // Bytes used by the encoded coordinates (not counting getOrder()).
+  long getEncodedSize() const;
+
+  // Input index of each stored point, in storage order.  Empty without
+  // delta encoding, since the points are then stored in input order.
+  const std::vector<int> & getOrder() const;
+
+  // Decodes stored points [first, first + count) into out.
+  void decode(int first, int count, Point *out) const;
+
+  // Decodes the whole cloud in batches of batchSize points, calling
+  // func(points, count, first) for each batch.
+  template <typename Func>
+  void forEachBatch(int batchSize, Func func) const {
+    std::vector<Point> batch(batchSize);
+    for (int first = 0; first < mNumPoints; first += batchSize) {
+      int count = (mNumPoints - first < batchSize ? mNumPoints - first : batchSize);
+      decode(first, count, batch.data());
+      func((const Point *) batch.data(), count, first);
+    }
+  }
+};
+
+#endif // COMPRESSEDCLOUD_HH
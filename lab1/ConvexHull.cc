@@ -0,0 +1,557 @@
+#include "ConvexHull.hh"
+#include "Parallel.hh"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Each core gets at least this many points when culling and partitioning.
+static const long PointsPerChunk = 16384;
+
+// A face of the hull while it is being built.  Edge k runs from v[k] to
+// v[(k + 1) % 3], and neighbor[k] is the face on the other side of it.
+struct hullFace {
+  int v[3];
+  int neighbor[3];
+  double normal[3];   // unit normal, pointing out of the hull
+  double offset;      // dot(normal, p) == offset for points on the plane
+  std::vector<int> outside;   // points above this face, not yet on the hull
+  bool alive;
+  bool visible;       // scratch flag used while adding a point
+};
+
+// Builds the hull of a subset of the points with Quickhull.
+class hullBuilder {
+
+private:
+  const Point *mPoints;
+  double mEpsilon;
+  std::vector<hullFace> mFaces;
+
+  double coord(int p, int axis) const {
+    const Point &pt = mPoints[p];
+    return (axis == 0 ? pt.getX() : (axis == 1 ? pt.getY() : pt.getZ()));
+  }
+
+  // Signed distance of point p above face f.
+  double distance(const hullFace &f, int p) const {
+    const Point &pt = mPoints[p];
+    return f.normal[0] * pt.getX() + f.normal[1] * pt.getY() +
+           f.normal[2] * pt.getZ() - f.offset;
+  }
+
+  int addFace(int a, int b, int c);
+  bool buildSimplex(const std::vector<int> &candidates, int simplex[4]);
+  void assignPoints(const std::vector<int> &points, int firstFace, int lastFace);
+  void addPoint(int faceIndex, int eye);
+
+public:
+  hullBuilder(const Point *points, double epsilon)
+    : mPoints(points), mEpsilon(epsilon) { }
+
+  // Computes the hull of the candidate points.  Returns false if they are
+  // degenerate (fewer than four points that are not coplanar).
+  bool build(const std::vector<int> &candidates);
+
+  // Appends three point indices per hull triangle to triangles.
+  void getTriangles(std::vector<int> &triangles) const;
+
+  // Returns true if point p is strictly inside every face of the hull.
+  bool isInside(int p) const;
+};
+
+// Adds the face (a, b, c), with its plane, and returns its index.  The
+// neighbours are filled in by the caller.
+int hullBuilder::addFace(int a, int b, int c) {
+  hullFace f;
+  f.v[0] = a;
+  f.v[1] = b;
+  f.v[2] = c;
+  f.neighbor[0] = f.neighbor[1] = f.neighbor[2] = -1;
+  f.alive = true;
+  f.visible = false;
+
+  const Point &pa = mPoints[a], &pb = mPoints[b], &pc = mPoints[c];
+  double u[3] = { pb.getX() - pa.getX(), pb.getY() - pa.getY(), pb.getZ() - pa.getZ() };
+  double w[3] = { pc.getX() - pa.getX(), pc.getY() - pa.getY(), pc.getZ() - pa.getZ() };
+  double n[3] = { u[1] * w[2] - u[2] * w[1],
+                  u[2] * w[0] - u[0] * w[2],
+                  u[0] * w[1] - u[1] * w[0] };
+  double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  for (int i = 0; i < 3; i++) {
+    f.normal[i] = (len > 0 ? n[i] / len : 0);
+  }
+
+  // Measure the offset from the centroid, which is a little more accurate
+  // than from any one corner.
+  f.offset = 0;
+  for (int i = 0; i < 3; i++) {
+    f.offset += f.normal[i] * (coord(a, i) + coord(b, i) + coord(c, i)) / 3;
+  }
+
+  mFaces.push_back(f);
+  return (int) mFaces.size() - 1;
+}
+
+// Finds four points that span a tetrahedron of reasonable volume, starting
+// from the two extreme points that are furthest apart.
+bool hullBuilder::buildSimplex(const std::vector<int> &candidates,
+                               int simplex[4]) {
+  // Extreme points along each axis.
+  int extreme[6];
+  for (int a = 0; a < 3; a++) {
+    extreme[a] = extreme[a + 3] = candidates[0];
+  }
+  for (size_t i = 1; i < candidates.size(); i++) {
+    int p = candidates[i];
+    for (int a = 0; a < 3; a++) {
+      if (coord(p, a) < coord(extreme[a], a)) {
+        extreme[a] = p;
+      }
+      if (coord(p, a) > coord(extreme[a + 3], a)) {
+        extreme[a + 3] = p;
+      }
+    }
+  }
+
+  double best = -1;
+  for (int a = 0; a < 3; a++) {
+    double d = coord(extreme[a + 3], a) - coord(extreme[a], a);
+    if (d > best) {
+      best = d;
+      simplex[0] = extreme[a];
+      simplex[1] = extreme[a + 3];
+    }
+  }
+  if (best <= mEpsilon) {
+    return false;   // all the points are in the same place
+  }
+
+  // The point furthest from the line through the first two.
+  double dir[3], len = 0;
+  for (int i = 0; i < 3; i++) {
+    dir[i] = coord(simplex[1], i) - coord(simplex[0], i);
+    len += dir[i] * dir[i];
+  }
+  len = sqrt(len);
+  best = -1;
+  for (size_t k = 0; k < candidates.size(); k++) {
+    int p = candidates[k];
+    double v[3];
+    for (int i = 0; i < 3; i++) {
+      v[i] = coord(p, i) - coord(simplex[0], i);
+    }
+    double c[3] = { v[1] * dir[2] - v[2] * dir[1],
+                    v[2] * dir[0] - v[0] * dir[2],
+                    v[0] * dir[1] - v[1] * dir[0] };
+    double d = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]) / len;
+    if (d > best) {
+      best = d;
+      simplex[2] = p;
+    }
+  }
+  if (best <= mEpsilon) {
+    return false;   // all the points are on a line
+  }
+
+  // The point furthest from the plane through the first three.
+  int f = addFace(simplex[0], simplex[1], simplex[2]);
+  best = 0;
+  for (size_t k = 0; k < candidates.size(); k++) {
+    double d = distance(mFaces[f], candidates[k]);
+    if (fabs(d) > fabs(best)) {
+      best = d;
+      simplex[3] = candidates[k];
+    }
+  }
+  mFaces.clear();
+  if (fabs(best) <= mEpsilon) {
+    return false;   // all the points are on a plane
+  }
+
+  // Make (0, 1, 2) wind counter-clockwise seen from outside, so that the
+  // fourth point is below it.
+  if (best > 0) {
+    std::swap(simplex[0], simplex[1]);
+  }
+  return true;
+}
+
+// Moves each of the given points to the outside list of the face in
+// [firstFace, lastFace) that it is furthest above.  Points below all of
+// them are inside the hull and are dropped.  Large inputs are split across
+// cores, each chunk gathering its own lists before they are joined.
+void hullBuilder::assignPoints(const std::vector<int> &points,
+                               int firstFace, int lastFace) {
+  int numFaces = lastFace - firstFace;
+  int chunks = numChunks((long) points.size(), PointsPerChunk);
+  std::vector<std::vector<int> > lists((size_t) chunks * numFaces);
+
+  parallelFor((long) points.size(), chunks, [&](int c, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      int p = points[i];
+      int bestFace = -1;
+      double bestDist = mEpsilon;
+      for (int f = firstFace; f < lastFace; f++) {
+        double d = distance(mFaces[f], p);
+        if (d > bestDist) {
+          bestDist = d;
+          bestFace = f;
+        }
+      }
+      if (bestFace >= 0) {
+        lists[(size_t) c * numFaces + (bestFace - firstFace)].push_back(p);
+      }
+    }
+  });
+
+  for (int f = 0; f < numFaces; f++) {
+    std::vector<int> &outside = mFaces[firstFace + f].outside;
+    for (int c = 0; c < chunks; c++) {
+      const std::vector<int> &list = lists[(size_t) c * numFaces + f];
+      outside.insert(outside.end(), list.begin(), list.end());
+    }
+  }
+}
+
+bool hullBuilder::build(const std::vector<int> &candidates) {
+  mFaces.clear();
+  int s[4];
+  if (candidates.size() < 4 || !buildSimplex(candidates, s)) {
+    return false;
+  }
+
+  // The four faces of the tetrahedron, each wound so that the remaining
+  // corner is below it.
+  addFace(s[0], s[1], s[2]);
+  addFace(s[0], s[3], s[1]);
+  addFace(s[1], s[3], s[2]);
+  addFace(s[2], s[3], s[0]);
+
+  // Link the faces up through their shared edges.
+  for (int f = 0; f < 4; f++) {
+    for (int k = 0; k < 3; k++) {
+      int a = mFaces[f].v[k], b = mFaces[f].v[(k + 1) % 3];
+      for (int g = 0; g < 4; g++) {
+        for (int j = 0; j < 3; j++) {
+          if (mFaces[g].v[j] == b && mFaces[g].v[(j + 1) % 3] == a) {
+            mFaces[f].neighbor[k] = g;
+          }
+        }
+      }
+    }
+  }
+
+  assignPoints(candidates, 0, 4);
+
+  // Repeatedly take a face with points above it, and add its furthest
+  // point to the hull.
+  std::vector<int> pending;
+  for (int f = 0; f < 4; f++) {
+    pending.push_back(f);
+  }
+  while (!pending.empty()) {
+    int f = pending.back();
+    pending.pop_back();
+    if (!mFaces[f].alive || mFaces[f].outside.empty()) {
+      continue;
+    }
+
+    int eye = -1;
+    double best = -1;
+    const std::vector<int> &outside = mFaces[f].outside;
+    for (size_t i = 0; i < outside.size(); i++) {
+      double d = distance(mFaces[f], outside[i]);
+      if (d > best) {
+        best = d;
+        eye = outside[i];
+      }
+    }
+
+    int firstNew = (int) mFaces.size();
+    addPoint(f, eye);
+    for (int g = firstNew; g < (int) mFaces.size(); g++) {
+      pending.push_back(g);
+    }
+    if (!mFaces[f].alive) {
+      continue;
+    }
+
+    // addPoint() could not add the point (the faces it can see do not form
+    // a disc, which only happens through rounding), so give up on it.
+    std::vector<int> &list = mFaces[f].outside;
+    list.erase(std::remove(list.begin(), list.end(), eye), list.end());
+    pending.push_back(f);
+  }
+
+  return true;
+}
+
+// Adds point eye, which is above face faceIndex, to the hull:  removes every
+// face the point can see, and connects the edge of that region (the
+// horizon) to the point with new faces.
+void hullBuilder::addPoint(int faceIndex, int eye) {
+  // Find the faces the point can see, spreading out from faceIndex.  Faces
+  // the point is (within epsilon) coplanar with are replaced too, so that
+  // a point added earlier in the middle of what turns out to be a flat
+  // face or a straight edge of the hull is dropped again.  (Otherwise, on
+  // a lattice say, it stays a vertex, splitting the face it is on.)
+  std::vector<int> visible;
+  visible.push_back(faceIndex);
+  mFaces[faceIndex].visible = true;
+  for (size_t i = 0; i < visible.size(); i++) {
+    const hullFace &f = mFaces[visible[i]];
+    for (int k = 0; k < 3; k++) {
+      int g = f.neighbor[k];
+      if (!mFaces[g].visible && distance(mFaces[g], eye) > -mEpsilon) {
+        mFaces[g].visible = true;
+        visible.push_back(g);
+      }
+    }
+  }
+
+  // The horizon is every edge between a visible face and a hidden one.
+  // Chain the edges into a loop, each starting where the last one ended.
+  std::vector<int> horizonFace, horizonEdge;
+  for (size_t i = 0; i < visible.size(); i++) {
+    const hullFace &f = mFaces[visible[i]];
+    for (int k = 0; k < 3; k++) {
+      if (!mFaces[f.neighbor[k]].visible) {
+        horizonFace.push_back(visible[i]);
+        horizonEdge.push_back(k);
+      }
+    }
+  }
+
+  int m = (int) horizonFace.size();
+  bool disc = (m >= 3);
+  for (int i = 0; i + 1 < m && disc; i++) {
+    int end = mFaces[horizonFace[i]].v[(horizonEdge[i] + 1) % 3];
+    int j = i + 1;
+    while (j < m && mFaces[horizonFace[j]].v[horizonEdge[j]] != end) {
+      j++;
+    }
+    if (j == m) {
+      disc = false;
+    } else {
+      std::swap(horizonFace[i + 1], horizonFace[j]);
+      std::swap(horizonEdge[i + 1], horizonEdge[j]);
+    }
+  }
+  if (disc) {
+    int start = mFaces[horizonFace[0]].v[horizonEdge[0]];
+    disc = (mFaces[horizonFace[m - 1]].v[(horizonEdge[m - 1] + 1) % 3] == start);
+  }
+  if (!disc) {
+    for (size_t i = 0; i < visible.size(); i++) {
+      mFaces[visible[i]].visible = false;
+    }
+    return;
+  }
+
+  // Make one new face per horizon edge, keeping the winding of the face
+  // being replaced.  Face i borders face i - 1 and face i + 1.
+  int firstNew = (int) mFaces.size();
+  for (int i = 0; i < m; i++) {
+    const hullFace &old = mFaces[horizonFace[i]];
+    int a = old.v[horizonEdge[i]];
+    int b = old.v[(horizonEdge[i] + 1) % 3];
+    int hidden = old.neighbor[horizonEdge[i]];
+    int f = addFace(a, b, eye);
+
+    mFaces[f].neighbor[0] = hidden;
+    mFaces[f].neighbor[1] = firstNew + (i + 1) % m;
+    mFaces[f].neighbor[2] = firstNew + (i + m - 1) % m;
+    for (int j = 0; j < 3; j++) {
+      if (mFaces[hidden].v[j] == b && mFaces[hidden].v[(j + 1) % 3] == a) {
+        mFaces[hidden].neighbor[j] = f;
+      }
+    }
+  }
+
+  // Hand the visible faces' points over to the new faces.
+  std::vector<int> orphans;
+  for (size_t i = 0; i < visible.size(); i++) {
+    hullFace &f = mFaces[visible[i]];
+    for (size_t j = 0; j < f.outside.size(); j++) {
+      if (f.outside[j] != eye) {
+        orphans.push_back(f.outside[j]);
+      }
+    }
+    std::vector<int>().swap(f.outside);
+    f.alive = false;
+    f.visible = false;
+  }
+  assignPoints(orphans, firstNew, (int) mFaces.size());
+}
+
+void hullBuilder::getTriangles(std::vector<int> &triangles) const {
+  for (size_t f = 0; f < mFaces.size(); f++) {
+    if (mFaces[f].alive) {
+      triangles.insert(triangles.end(), mFaces[f].v, mFaces[f].v + 3);
+    }
+  }
+}
+
+bool hullBuilder::isInside(int p) const {
+  for (size_t f = 0; f < mFaces.size(); f++) {
+    if (mFaces[f].alive && distance(mFaces[f], p) >= -mEpsilon) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Constructors
+
+ConvexHull::ConvexHull(const Point *points, int numPoints) {
+  if (numPoints < 4) {
+    return;
+  }
+
+  // Tolerance for deciding which side of a plane a point is on, scaled to
+  // the size of the coordinates (as Qhull does).
+  double maxAbs[3] = { 0, 0, 0 };
+  for (int i = 0; i < numPoints; i++) {
+    maxAbs[0] = std::max(maxAbs[0], fabs(points[i].getX()));
+    maxAbs[1] = std::max(maxAbs[1], fabs(points[i].getY()));
+    maxAbs[2] = std::max(maxAbs[2], fabs(points[i].getZ()));
+  }
+  double epsilon = 3 * DBL_EPSILON * (maxAbs[0] + maxAbs[1] + maxAbs[2]);
+
+  // The hull of the six extreme points is inside the full hull, so any
+  // point strictly inside it can be dropped straight away.
+  std::vector<int> extremes;
+  {
+    int ext[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 1; i < numPoints; i++) {
+      double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+      for (int a = 0; a < 3; a++) {
+        const Point &lo = points[ext[a]];
+        const Point &hi = points[ext[a + 3]];
+        double loV = (a == 0 ? lo.getX() : (a == 1 ? lo.getY() : lo.getZ()));
+        double hiV = (a == 0 ? hi.getX() : (a == 1 ? hi.getY() : hi.getZ()));
+        if (v[a] < loV) {
+          ext[a] = i;
+        }
+        if (v[a] > hiV) {
+          ext[a + 3] = i;
+        }
+      }
+    }
+    extremes.assign(ext, ext + 6);
+    std::sort(extremes.begin(), extremes.end());
+    extremes.erase(std::unique(extremes.begin(), extremes.end()), extremes.end());
+  }
+
+  hullBuilder octahedron(points, epsilon);
+  bool cull = octahedron.build(extremes);
+
+  int chunks = numChunks(numPoints, PointsPerChunk);
+  std::vector<std::vector<int> > kept(chunks);
+  parallelFor(numPoints, chunks, [&](int c, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      if (!cull || !octahedron.isInside((int) i)) {
+        kept[c].push_back((int) i);
+      }
+    }
+  });
+  std::vector<int> candidates;
+  for (int c = 0; c < chunks; c++) {
+    candidates.insert(candidates.end(), kept[c].begin(), kept[c].end());
+  }
+
+  hullBuilder builder(points, epsilon);
+  if (!builder.build(candidates)) {
+    return;   // degenerate:  the hull is empty
+  }
+
+  // Number the hull's vertices in the order they first appear.
+  std::vector<int> triangles;
+  builder.getTriangles(triangles);
+  std::vector<int> vertexIndex(numPoints, -1);
+  mIndices.resize(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    int p = triangles[i];
+    if (vertexIndex[p] < 0) {
+      vertexIndex[p] = (int) mVertices.size();
+      mVertices.push_back(points[p]);
+      mVertexIds.push_back(p);
+    }
+    mIndices[i] = vertexIndex[p];
+  }
+}
+
+ConvexHull::ConvexHull(const std::vector<Point> &points) {
+  *this = ConvexHull(points.data(), (int) points.size());
+}
+
+// Accessors
+
+int ConvexHull::getNumVertices() const {
+  return (int) mVertices.size();
+}
+
+int ConvexHull::getNumTriangles() const {
+  return (int) mIndices.size() / 3;
+}
+
+bool ConvexHull::isEmpty() const {
+  return mIndices.empty();
+}
+
+const std::vector<Point> & ConvexHull::getVertices() const {
+  return mVertices;
+}
+
+const std::vector<int> & ConvexHull::getVertexIds() const {
+  return mVertexIds;
+}
+
+const std::vector<int> & ConvexHull::getIndices() const {
+  return mIndices;
+}
+
+TriangleMesh ConvexHull::getMesh() const {
+  return TriangleMesh(mVertices.data(), getNumVertices(),
+                      mIndices.data(), getNumTriangles());
+}
+
+// Member functions
+
+double ConvexHull::getSurfaceArea() const {
+  return computeSurfaceArea(getMesh());
+}
+
+// Sums the signed volumes of the tetrahedra joining each triangle to a point
+// inside the hull (the average of its vertices).
+double ConvexHull::getVolume() const {
+  if (isEmpty()) {
+    return 0;
+  }
+
+  double c[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < mVertices.size(); i++) {
+    c[0] += mVertices[i].getX();
+    c[1] += mVertices[i].getY();
+    c[2] += mVertices[i].getZ();
+  }
+  for (int a = 0; a < 3; a++) {
+    c[a] /= mVertices.size();
+  }
+
+  std::vector<double> volumes(getNumTriangles());
+  for (int t = 0; t < getNumTriangles(); t++) {
+    const Point &p = mVertices[mIndices[3 * t]];
+    const Point &q = mVertices[mIndices[3 * t + 1]];
+    const Point &r = mVertices[mIndices[3 * t + 2]];
+    double a[3] = { p.getX() - c[0], p.getY() - c[1], p.getZ() - c[2] };
+    double b[3] = { q.getX() - c[0], q.getY() - c[1], q.getZ() - c[2] };
+    double d[3] = { r.getX() - c[0], r.getY() - c[1], r.getZ() - c[2] };
+    volumes[t] = (a[0] * (b[1] * d[2] - b[2] * d[1]) +
+                  a[1] * (b[2] * d[0] - b[0] * d[2]) +
+                  a[2] * (b[0] * d[1] - b[1] * d[0])) / 6;
+  }
+  return pairwiseSum(volumes.data(), (long) volumes.size());
+}
@@ -0,0 +1,45 @@
+#ifndef CONVEXHULL_HH
+#define CONVEXHULL_HH
+
+// The convex hull of a 3D point set, computed with Quickhull.  Before the
+// main loop, points inside the hull of the six extreme points (min and max
+// x, y and z) are discarded, since they cannot be on the hull; that cull
+// and the initial assignment of points to faces run in parallel.
+//
+// The hull is stored as an indexed triangle mesh whose triangles are wound
+// counter-clockwise when seen from outside.  Inputs with fewer than four
+// points, or whose points are all (nearly) coplanar, have an empty hull.
+
+#include "Mesh.hh"
+#include "Point.hh"
+#include <vector>
+
+class ConvexHull {
+
+private:
+  std::vector<Point> mVertices;   // the hull's vertices
+  std::vector<int> mVertexIds;    // index of each vertex among the input points
+  std::vector<int> mIndices;      // three vertex indices per triangle
+
+public:
+  // Constructors
+  ConvexHull(const Point *points, int numPoints);
+  ConvexHull(const std::vector<Point> &points);
+
+  // Accessors
+  int getNumVertices() const;
+  int getNumTriangles() const;
+  bool isEmpty() const;
+  const std::vector<Point> & getVertices() const;
+  const std::vector<int> & getVertexIds() const;
+  const std::vector<int> & getIndices() const;
+
+  // Returns the hull as a mesh, which refers to this hull's arrays.
+  TriangleMesh getMesh() const;
+
+  // Member functions
+  double getSurfaceArea() const;
+  double getVolume() const;
+};
+
+#endif // CONVEXHULL_HH
@@ -0,0 +1,185 @@
+#ifndef GEOMPOINT_HH
+#define GEOMPOINT_HH
+
+// A templated point class, geom::Point<T, N>, for N = 2, 3 or 4 coordinates
+// of type float or double.  Unlike the original ::Point it is a plain value
+// type:  trivially copyable (so arrays of points can be memcpy'd or mapped
+// straight from a file), usable in constant expressions, and with all of its
+// arithmetic defined here so it inlines into tight loops.
+//
+// Points whose coordinates fill a multiple of 16 bytes (Point<float, 4>,
+// Point<double, 2>, Point<double, 4>) are 16-byte aligned, so SIMD loads of
+// them never straddle a boundary.  The others keep their natural alignment,
+// since aligning them would add padding to every element of an array.
+
+#include "Point.hh"
+#include <cmath>
+#include <type_traits>
+
+namespace geom {
+
+// Alignment used for Point<T, N>; see above.
+template <typename T, int N>
+struct PointAlignment {
+  static const int value = ((N * sizeof(T)) % 16 == 0 ? 16 : alignof(T));
+};
+
+template <typename T, int N>
+class alignas(PointAlignment<T, N>::value) Point {
+
+  static_assert(std::is_floating_point<T>::value,
+                "Point coordinates must be float or double");
+  static_assert(N >= 2 && N <= 4, "Point must have 2, 3 or 4 coordinates");
+
+private:
+  T mCoords[N];
+
+public:
+  // Constructors
+
+  // Like a built-in type, a default-constructed point is uninitialized;
+  // use Point<T, N>() or Point<T, N>{} to get the origin.
+  Point() = default;
+
+  // Initializes each coordinate in turn; there must be exactly N of them.
+  template <typename... Ts>
+  constexpr Point(T first, Ts... rest) : mCoords{first, static_cast<T>(rest)...} {
+    static_assert(sizeof...(Ts) + 1 == N, "wrong number of coordinates");
+  }
+
+  // Converts between float and double points.
+  template <typename U>
+  constexpr explicit Point(const Point<U, N> &p) : mCoords() {
+    for (int i = 0; i < N; i++) {
+      mCoords[i] = static_cast<T>(p[i]);
+    }
+  }
+
+  // Accessors
+  constexpr T operator[](int i) const { return mCoords[i]; }
+  constexpr T & operator[](int i) { return mCoords[i]; }
+  constexpr T getX() const { return mCoords[0]; }
+  constexpr T getY() const { return mCoords[1]; }
+  constexpr T getZ() const { static_assert(N >= 3, "no z coordinate"); return mCoords[2]; }
+  constexpr T getW() const { static_assert(N >= 4, "no w coordinate"); return mCoords[3]; }
+  constexpr const T * data() const { return mCoords; }
+  constexpr T * data() { return mCoords; }
+
+  // Operators
+
+  constexpr Point & operator+=(const Point &p) {
+    for (int i = 0; i < N; i++) {
+      mCoords[i] += p.mCoords[i];
+    }
+    return *this;
+  }
+
+  constexpr Point & operator-=(const Point &p) {
+    for (int i = 0; i < N; i++) {
+      mCoords[i] -= p.mCoords[i];
+    }
+    return *this;
+  }
+
+  constexpr Point & operator*=(T s) {
+    for (int i = 0; i < N; i++) {
+      mCoords[i] *= s;
+    }
+    return *this;
+  }
+
+  constexpr Point & operator/=(T s) {
+    for (int i = 0; i < N; i++) {
+      mCoords[i] /= s;
+    }
+    return *this;
+  }
+
+  constexpr Point operator+(const Point &p) const { Point r(*this); return r += p; }
+  constexpr Point operator-(const Point &p) const { Point r(*this); return r -= p; }
+  constexpr Point operator*(T s) const { Point r(*this); return r *= s; }
+  constexpr Point operator/(T s) const { Point r(*this); return r /= s; }
+  constexpr Point operator-() const { Point r(*this); return r *= T(-1); }
+
+  constexpr bool operator==(const Point &p) const {
+    for (int i = 0; i < N; i++) {
+      if (mCoords[i] != p.mCoords[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  constexpr bool operator!=(const Point &p) const {
+    return !(*this == p);
+  }
+
+  // Member functions
+
+  // Returns the dot product with p (treating both points as vectors).
+  constexpr T dot(const Point &p) const {
+    T sum = 0;
+    for (int i = 0; i < N; i++) {
+      sum += mCoords[i] * p.mCoords[i];
+    }
+    return sum;
+  }
+
+  constexpr T squaredLength() const {
+    return dot(*this);
+  }
+
+  constexpr T squaredDistanceTo(const Point &p) const {
+    return (*this - p).squaredLength();
+  }
+
+  // Not constexpr, since sqrt isn't.
+  T length() const {
+    return std::sqrt(squaredLength());
+  }
+
+  T distanceTo(const Point &p) const {
+    return std::sqrt(squaredDistanceTo(p));
+  }
+};
+
+template <typename T, int N>
+constexpr Point<T, N> operator*(T s, const Point<T, N> &p) {
+  return p * s;
+}
+
+// Returns the cross product of two 3D vectors.
+template <typename T>
+constexpr Point<T, 3> cross(const Point<T, 3> &a, const Point<T, 3> &b) {
+  return Point<T, 3>(a[1] * b[2] - a[2] * b[1],
+                     a[2] * b[0] - a[0] * b[2],
+                     a[0] * b[1] - a[1] * b[0]);
+}
+
+typedef Point<float, 2> Point2f;
+typedef Point<float, 3> Point3f;
+typedef Point<float, 4> Point4f;
+typedef Point<double, 2> Point2d;
+typedef Point<double, 3> Point3d;
+typedef Point<double, 4> Point4d;
+
+static_assert(std::is_trivially_copyable<Point3f>::value &&
+              std::is_trivially_copyable<Point3d>::value &&
+              std::is_trivially_copyable<Point4f>::value,
+              "geom::Point must be trivially copyable");
+static_assert(sizeof(Point3f) == 12 && sizeof(Point3d) == 24 &&
+              sizeof(Point4f) == 16 && alignof(Point4f) == 16,
+              "geom::Point must not be padded");
+
+// Conversions to and from the original Point class.
+inline Point3d fromPoint(const ::Point &p) {
+  return Point3d(p.getX(), p.getY(), p.getZ());
+}
+
+inline ::Point toPoint(const Point3d &p) {
+  return ::Point(p[0], p[1], p[2]);
+}
+
+}  // namespace geom
+
+#endif // GEOMPOINT_HH
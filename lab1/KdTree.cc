@@ -0,0 +1,331 @@
+#include "KdTree.hh"
+#include "Parallel.hh"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+// Leaves hold at most this many points.
+static const int LeafSize = 16;
+
+// Queries for up to this many neighbours keep their results on the stack.
+static const int SmallK = 32;
+
+// Deep enough for any tree that fits in an int-indexed array.
+static const int MaxDepth = 64;
+
+// Each core gets at least this many queries in the batch functions.
+static const long QueriesPerChunk = 1024;
+
+// Stores the number of nodes in a tree over n points in count, and over
+// n + 1 points in countNext.  Both subtrees of a node over n points have
+// n / 2 or n / 2 + 1 points, so the pair for n follows from the pair for
+// n / 2.
+static void countNodePair(int n, int &count, int &countNext) {
+  if (n + 1 <= LeafSize) {
+    count = countNext = 1;
+    return;
+  }
+
+  int half = n / 2;
+  int a, b;   // node counts for half and half + 1 points
+  countNodePair(half, a, b);
+
+  if (n % 2 == 0) {
+    count = 1 + 2 * a;
+    countNext = 1 + a + b;
+  } else {
+    count = 1 + a + b;
+    countNext = 1 + 2 * b;
+  }
+  if (n <= LeafSize) {
+    count = 1;
+  }
+}
+
+// Returns the number of nodes in a tree over numPoints points.
+int KdTree::countNodes(int numPoints) {
+  int count, countNext;
+  countNodePair(numPoints, count, countNext);
+  return count;
+}
+
+// Constructors
+
+KdTree::KdTree(const Point *points, int numPoints) {
+  build(points, numPoints);
+}
+
+KdTree::KdTree(const std::vector<Point> &points) {
+  build(points.data(), (int) points.size());
+}
+
+// Private helper functions
+
+// Copies the points, builds the nodes over a permutation of them, and then
+// puts the coordinates into tree order.
+void KdTree::build(const Point *points, int numPoints) {
+  assert(numPoints >= 0);
+
+  std::vector<int> perm(numPoints);
+  for (int i = 0; i < numPoints; i++) {
+    perm[i] = i;
+  }
+
+  mNodes.resize(countNodes(numPoints));
+  buildNode(points, perm.data(), 0, 0, numPoints, 0);
+
+  mCoords.resize(3 * (size_t) numPoints);
+  for (int i = 0; i < numPoints; i++) {
+    const Point &p = points[perm[i]];
+    mCoords[3 * (size_t) i] = p.getX();
+    mCoords[3 * (size_t) i + 1] = p.getY();
+    mCoords[3 * (size_t) i + 2] = p.getZ();
+  }
+  mIds.swap(perm);
+}
+
+// Returns coordinate "axis" (0, 1 or 2) of a point.
+static double coord(const Point &p, int axis) {
+  return (axis == 0 ? p.getX() : (axis == 1 ? p.getY() : p.getZ()));
+}
+
+// Fills in node nodeIndex, over the points perm[begin .. end-1].  The top
+// few levels build their left subtree on a separate thread, so that there
+// are roughly as many subtrees being built as there are cores.
+void KdTree::buildNode(const Point *points, int *perm, int nodeIndex,
+                       int begin, int end, int depth) {
+  node &nd = mNodes[nodeIndex];
+  if (end - begin <= LeafSize) {
+    nd.split = 0;
+    nd.axis = -1;
+    nd.first = begin;
+    nd.last = end;
+    return;
+  }
+
+  // Split the longest side of the bounding box, at the median.
+  double lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = hi[a] = coord(points[perm[begin]], a);
+  }
+  for (int i = begin + 1; i < end; i++) {
+    const Point &p = points[perm[i]];
+    for (int a = 0; a < 3; a++) {
+      double v = coord(p, a);
+      lo[a] = std::min(lo[a], v);
+      hi[a] = std::max(hi[a], v);
+    }
+  }
+  int axis = 0;
+  for (int a = 1; a < 3; a++) {
+    if (hi[a] - lo[a] > hi[axis] - lo[axis]) {
+      axis = a;
+    }
+  }
+
+  int mid = begin + (end - begin) / 2;
+  std::nth_element(perm + begin, perm + mid, perm + end,
+    [points, axis](int i, int j) {
+      return coord(points[i], axis) < coord(points[j], axis);
+    });
+
+  int left = nodeIndex + 1;
+  int right = left + countNodes(mid - begin);
+  nd.split = coord(points[perm[mid]], axis);
+  nd.axis = axis;
+  nd.first = right;
+  nd.last = 0;
+
+  if ((1 << depth) < numWorkerThreads()) {
+    std::thread worker(&KdTree::buildNode, this, points, perm, left,
+                       begin, mid, depth + 1);
+    buildNode(points, perm, right, mid, end, depth + 1);
+    worker.join();
+  } else {
+    buildNode(points, perm, left, begin, mid, depth + 1);
+    buildNode(points, perm, right, mid, end, depth + 1);
+  }
+}
+
+// Accessors
+
+int KdTree::getSize() const {
+  return (int) mIds.size();
+}
+
+// Queries
+
+int KdTree::nearest(const Point &q, double *distance) const {
+  int index = -1;
+  double dist = std::numeric_limits<double>::infinity();
+  nearestK(q, 1, &index, &dist);
+  if (distance != 0) {
+    *distance = dist;
+  }
+  return index;
+}
+
+int KdTree::nearestK(const Point &q, int k, int *indices,
+                     double *distances) const {
+  assert(k >= 0);
+  if (k == 0 || mIds.empty()) {
+    return 0;
+  }
+
+  double qc[3] = { q.getX(), q.getY(), q.getZ() };
+
+  // The best points found so far, sorted by increasing squared distance.
+  // Until k points have been found, the search radius is unbounded.  Small
+  // k (the common case) uses buffers on the stack.
+  double smallDist[SmallK + 1];
+  int smallPoint[SmallK + 1];
+  std::vector<double> largeDist;
+  std::vector<int> largePoint;
+  double *bestDist = smallDist;
+  int *bestPoint = smallPoint;
+  if (k > SmallK) {
+    largeDist.resize(k + 1);
+    largePoint.resize(k + 1);
+    bestDist = largeDist.data();
+    bestPoint = largePoint.data();
+  }
+  int found = 0;
+  double bound = std::numeric_limits<double>::infinity();
+
+  // Stack of nodes still to visit, with a lower bound on the squared
+  // distance from q to any point under them.
+  int stackNode[MaxDepth];
+  double stackDist[MaxDepth];
+  int top = 0;
+  stackNode[top] = 0;
+  stackDist[top] = 0;
+  top++;
+
+  while (top > 0) {
+    top--;
+    if (stackDist[top] >= bound) {
+      continue;   // everything under this node is too far away
+    }
+    int n = stackNode[top];
+
+    // Walk down to a leaf, pushing the far side of each split.
+    while (mNodes[n].axis >= 0) {
+      const node &nd = mNodes[n];
+      double diff = qc[nd.axis] - nd.split;
+      int nearChild = (diff < 0 ? n + 1 : nd.first);
+      int farChild = (diff < 0 ? nd.first : n + 1);
+      if (diff * diff < bound) {
+        assert(top < MaxDepth);
+        stackNode[top] = farChild;
+        stackDist[top] = diff * diff;
+        top++;
+      }
+      n = nearChild;
+    }
+
+    // Check every point in the leaf.
+    for (int i = mNodes[n].first; i < mNodes[n].last; i++) {
+      const double *p = &mCoords[3 * (size_t) i];
+      double dx = p[0] - qc[0], dy = p[1] - qc[1], dz = p[2] - qc[2];
+      double d = dx * dx + dy * dy + dz * dz;
+      if (d >= bound) {
+        continue;
+      }
+
+      // Insert into the sorted list of best points, dropping the worst
+      // once there are more than k.
+      int pos = found;
+      while (pos > 0 && bestDist[pos - 1] > d) {
+        bestDist[pos] = bestDist[pos - 1];
+        bestPoint[pos] = bestPoint[pos - 1];
+        pos--;
+      }
+      bestDist[pos] = d;
+      bestPoint[pos] = i;
+      if (found < k) {
+        found++;
+      }
+      if (found == k) {
+        bound = bestDist[k - 1];
+      }
+    }
+  }
+
+  for (int i = 0; i < found; i++) {
+    indices[i] = mIds[bestPoint[i]];
+    if (distances != 0) {
+      distances[i] = sqrt(bestDist[i]);
+    }
+  }
+  return found;
+}
+
+int KdTree::withinRadius(const Point &q, double radius,
+                         std::vector<int> &result) const {
+  if (mIds.empty() || radius < 0) {
+    return 0;
+  }
+
+  double qc[3] = { q.getX(), q.getY(), q.getZ() };
+  double r2 = radius * radius;
+  size_t initialSize = result.size();
+
+  int stack[MaxDepth];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int n = stack[--top];
+    while (mNodes[n].axis >= 0) {
+      const node &nd = mNodes[n];
+      double diff = qc[nd.axis] - nd.split;
+      int nearChild = (diff < 0 ? n + 1 : nd.first);
+      int farChild = (diff < 0 ? nd.first : n + 1);
+      if (diff * diff <= r2) {
+        assert(top < MaxDepth);
+        stack[top++] = farChild;
+      }
+      n = nearChild;
+    }
+
+    for (int i = mNodes[n].first; i < mNodes[n].last; i++) {
+      const double *p = &mCoords[3 * (size_t) i];
+      double dx = p[0] - qc[0], dy = p[1] - qc[1], dz = p[2] - qc[2];
+      if (dx * dx + dy * dy + dz * dz <= r2) {
+        result.push_back(mIds[i]);
+      }
+    }
+  }
+
+  return (int) (result.size() - initialSize);
+}
+
+void KdTree::nearestBatch(const Point *queries, int numQueries,
+                          int *indices, double *distances) const {
+  int chunks = numChunks(numQueries, QueriesPerChunk);
+  parallelFor(numQueries, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      indices[i] = nearest(queries[i], (distances != 0 ? distances + i : 0));
+    }
+  });
+}
+
+void KdTree::nearestKBatch(const Point *queries, int numQueries, int k,
+                           int *indices, double *distances) const {
+  int chunks = numChunks(numQueries, QueriesPerChunk);
+  parallelFor(numQueries, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      int *idx = indices + i * k;
+      double *dist = (distances != 0 ? distances + i * k : 0);
+      int found = nearestK(queries[i], k, idx, dist);
+      for (int j = found; j < k; j++) {
+        idx[j] = -1;
+        if (dist != 0) {
+          dist[j] = std::numeric_limits<double>::infinity();
+        }
+      }
+    }
+  });
+}
@@ -0,0 +1,67 @@
+#ifndef KDTREE_HH
+#define KDTREE_HH
+
+// A k-d tree over a set of 3D points, for nearest-neighbour and radius
+// queries.  The tree is balanced (every split is at the median) and its
+// nodes are stored in one flat array in depth-first order, so that the left
+// child of a node is always the node right after it.  The point coordinates
+// are copied into tree order, so that each leaf's points are contiguous.
+
+#include "Point.hh"
+#include <vector>
+
+class KdTree {
+
+private:
+  // A node of the tree.  Inner nodes split space on one axis; leaves hold a
+  // contiguous run of points.
+  struct node {
+    double split;  // Inner nodes:  the splitting coordinate.
+    int axis;      // Inner nodes:  0, 1 or 2 for x, y, z.  Leaves:  -1.
+    int first;     // Inner nodes:  index of the right child.  Leaves:  first point.
+    int last;      // Leaves:  one past the last point.
+  };
+
+  std::vector<node> mNodes;
+  std::vector<double> mCoords;   // x, y, z of each point, in tree order
+  std::vector<int> mIds;         // original index of each point, in tree order
+
+  static int countNodes(int numPoints);
+  void build(const Point *points, int numPoints);
+  void buildNode(const Point *points, int *perm, int nodeIndex,
+                 int begin, int end, int depth);
+
+public:
+  // Builds the tree over points[0 .. numPoints-1].  The points are copied,
+  // so the array need not outlive the tree.  The build is done in parallel.
+  KdTree(const Point *points, int numPoints);
+  KdTree(const std::vector<Point> &points);
+
+  // Accessors
+  int getSize() const;
+
+  // Returns the index of the point nearest to q, or -1 if the tree is empty.
+  // If distance is not 0, the distance to that point is stored there.
+  int nearest(const Point &q, double *distance = 0) const;
+
+  // Finds the k points nearest to q, storing their indices (and distances,
+  // if distances is not 0) in order of increasing distance.  Returns the
+  // number of points found, which is less than k only if the tree has fewer
+  // than k points.
+  int nearestK(const Point &q, int k, int *indices, double *distances = 0) const;
+
+  // Appends the indices of all points within the given distance of q to
+  // result, in no particular order.  Returns the number of points appended.
+  int withinRadius(const Point &q, double radius, std::vector<int> &result) const;
+
+  // Batch versions of the above, which split the queries across all cores.
+  // nearestBatch stores one index (and distance) per query.  nearestKBatch
+  // stores k per query, padding with -1 (and infinity) when the tree has
+  // fewer than k points.
+  void nearestBatch(const Point *queries, int numQueries,
+                    int *indices, double *distances = 0) const;
+  void nearestKBatch(const Point *queries, int numQueries, int k,
+                     int *indices, double *distances = 0) const;
+};
+
+#endif // KDTREE_HH
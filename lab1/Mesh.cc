@@ -0,0 +1,112 @@
+#include "Mesh.hh"
+#include "Parallel.hh"
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+// Triangles are processed in fixed-size blocks: the corners of a block are
+// gathered into separate x/y/z arrays so that the cross products can be
+// computed by a simple loop that the compiler vectorises.
+static const int BlockSize = 256;
+
+// Each core gets at least this many triangles.
+static const long TrianglesPerChunk = 16384;
+
+// Sums small runs of values with several independent accumulators, so that
+// the additions can be pipelined (and vectorised).
+static double blockSum(const double *values, long n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += values[i];
+    s1 += values[i + 1];
+    s2 += values[i + 2];
+    s3 += values[i + 3];
+  }
+  for (; i < n; i++) {
+    s0 += values[i];
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+double pairwiseSum(const double *values, long n) {
+  if (n <= 64) {
+    return blockSum(values, n);
+  }
+
+  // Split in half, sum each half, then combine.
+  long half = n / 2;
+  return pairwiseSum(values, half) + pairwiseSum(values + half, n - half);
+}
+
+// Computes the areas of triangles [begin, end) of the mesh into out[], which
+// must have room for end - begin values.
+static void computeBlockAreas(const TriangleMesh &mesh, int begin, int end,
+                              double *out) {
+  double ux[BlockSize], uy[BlockSize], uz[BlockSize];
+  double vx[BlockSize], vy[BlockSize], vz[BlockSize];
+  int n = end - begin;
+  assert(n <= BlockSize);
+
+  // Gather the two edge vectors leaving the first corner of each triangle.
+  const int *idx = (mesh.indices != 0 ? mesh.indices + 3 * (long) begin : 0);
+  const Point *corners = mesh.vertices + 3 * (long) begin;
+  for (int i = 0; i < n; i++) {
+    const Point &a = (idx != 0 ? mesh.vertices[idx[3 * i]] : corners[3 * i]);
+    const Point &b = (idx != 0 ? mesh.vertices[idx[3 * i + 1]] : corners[3 * i + 1]);
+    const Point &c = (idx != 0 ? mesh.vertices[idx[3 * i + 2]] : corners[3 * i + 2]);
+    double ax = a.getX(), ay = a.getY(), az = a.getZ();
+    ux[i] = b.getX() - ax;
+    uy[i] = b.getY() - ay;
+    uz[i] = b.getZ() - az;
+    vx[i] = c.getX() - ax;
+    vy[i] = c.getY() - ay;
+    vz[i] = c.getZ() - az;
+  }
+
+  // Half the length of the cross product of the two edges.
+  for (int i = 0; i < n; i++) {
+    double cx = uy[i] * vz[i] - uz[i] * vy[i];
+    double cy = uz[i] * vx[i] - ux[i] * vz[i];
+    double cz = ux[i] * vy[i] - uy[i] * vx[i];
+    out[i] = 0.5 * sqrt(cx * cx + cy * cy + cz * cz);
+  }
+}
+
+// Computes the areas of triangles [begin, end), storing them in areas (if it
+// is not 0), and returns their pairwise sum.
+static double computeRangeAreas(const TriangleMesh &mesh, long begin,
+                                long end, double *areas) {
+  std::vector<double> blockTotals;
+  blockTotals.reserve((end - begin) / BlockSize + 1);
+
+  double scratch[BlockSize];
+  for (long b = begin; b < end; b += BlockSize) {
+    long e = (b + BlockSize < end ? b + BlockSize : end);
+    double *out = (areas != 0 ? areas + b : scratch);
+    computeBlockAreas(mesh, (int) b, (int) e, out);
+    blockTotals.push_back(pairwiseSum(out, e - b));
+  }
+
+  return pairwiseSum(blockTotals.data(), (long) blockTotals.size());
+}
+
+double computeAreas(const TriangleMesh &mesh, double *areas) {
+  assert(mesh.numTriangles >= 0);
+  if (mesh.numTriangles == 0) {
+    return 0;
+  }
+
+  int chunks = numChunks(mesh.numTriangles, TrianglesPerChunk);
+  std::vector<double> chunkTotals(chunks);
+
+  parallelFor(mesh.numTriangles, chunks, [&](int c, long begin, long end) {
+    chunkTotals[c] = computeRangeAreas(mesh, begin, end, areas);
+  });
+
+  return pairwiseSum(chunkTotals.data(), chunks);
+}
+
+double computeSurfaceArea(const TriangleMesh &mesh) {
+  return computeAreas(mesh, 0);
+}
@@ -0,0 +1,45 @@
+#ifndef MESH_HH
+#define MESH_HH
+
+// Batched triangle-area computations over indexed triangle meshes.
+
+#include "Point.hh"
+
+// An indexed triangle mesh.  Triangle t has the corners
+// vertices[indices[3*t]], vertices[indices[3*t + 1]] and
+// vertices[indices[3*t + 2]].  If indices is 0 the mesh is a "triangle
+// soup", where triangle t is simply vertices[3*t .. 3*t + 2].  The mesh does
+// not own either array.
+struct TriangleMesh {
+  const Point *vertices;
+  int numVertices;
+  const int *indices;
+  int numTriangles;
+
+  TriangleMesh(const Point *vertices, int numVertices,
+               const int *indices, int numTriangles)
+    : vertices(vertices), numVertices(numVertices),
+      indices(indices), numTriangles(numTriangles) { }
+
+  // A triangle soup over corners[0 .. 3*numTriangles - 1].
+  TriangleMesh(const Point *corners, int numTriangles)
+    : vertices(corners), numVertices(3 * numTriangles),
+      indices(0), numTriangles(numTriangles) { }
+};
+
+// Computes the area of every triangle in the mesh using the cross-product
+// formulation, area = |(b - a) x (c - a)| / 2, which stays accurate for
+// sliver triangles where Heron's formula cancels badly.  If areas is not 0
+// it must have room for mesh.numTriangles values.  Returns the total surface
+// area.  Triangles are split across all cores.
+double computeAreas(const TriangleMesh &mesh, double *areas);
+
+// Returns the total surface area of the mesh, without storing the area of
+// each triangle.
+double computeSurfaceArea(const TriangleMesh &mesh);
+
+// Returns the sum of n values using pairwise summation, whose rounding error
+// grows with log(n) rather than n, but which is still as fast as a plain loop.
+double pairwiseSum(const double *values, long n);
+
+#endif // MESH_HH
@@ -0,0 +1,60 @@
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+// Small helpers for splitting the batch geometry routines across cores.
+// Work is divided into contiguous chunks; chunk c of n items covers
+// [n * c / chunks, n * (c + 1) / chunks).
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Returns the number of hardware threads, or 1 if it cannot be determined.
+inline int numWorkerThreads() {
+  unsigned int n = std::thread::hardware_concurrency();
+  return (n == 0 ? 1 : (int) n);
+}
+
+// Returns how many chunks to split n items into, so that every chunk has at
+// least "grain" items and there is no more than one chunk per core.
+inline int numChunks(long n, long grain) {
+  if (grain < 1) {
+    grain = 1;
+  }
+  long chunks = n / grain;
+  if (chunks > numWorkerThreads()) {
+    chunks = numWorkerThreads();
+  }
+  return (chunks < 1 ? 1 : (int) chunks);
+}
+
+// First item of chunk c, when n items are split into the given number of
+// chunks.  (The end of chunk c is the beginning of chunk c + 1.)
+inline long chunkBegin(long n, int chunks, int c) {
+  return (n / chunks) * c + (n % chunks) * c / chunks;
+}
+
+// Calls func(c, begin, end) once for each chunk.  Chunk 0 runs on the calling
+// thread and the others run on their own threads; all chunks have finished
+// when this returns.
+template <typename Func>
+void parallelFor(long n, int chunks, Func func) {
+  if (chunks <= 1) {
+    func(0, 0L, n);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  workers.reserve(chunks - 1);
+  for (int c = 1; c < chunks; c++) {
+    workers.push_back(std::thread(func, c, chunkBegin(n, chunks, c),
+                                  chunkBegin(n, chunks, c + 1)));
+  }
+  func(0, 0L, chunkBegin(n, chunks, 1));
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+#endif // PARALLEL_HH
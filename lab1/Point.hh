@@ -1,3 +1,6 @@
+#ifndef POINT_HH
+#define POINT_HH
+
 // A 3-dimensional point class!
 // Coordinates are double-precision floating point.
 
@@ -9,12 +12,13 @@ private:
   double z_coord;
 
 public:
-  // Constructors
-  Point();                      // default constructor
-  Point(double x, double y, double z);    // three-argument constructor
-
-  // Destructor
-  ~Point();
+  // Constructors.  These and the accessors are defined here so that they
+  // can be inlined into the batch geometry loops.  Point has no destructor
+  // (and no copy operations of its own), so it is trivially copyable and
+  // arrays of points can be copied with memcpy.
+  constexpr Point() : x_coord(0), y_coord(0), z_coord(0) { }
+  constexpr Point(double x, double y, double z)
+    : x_coord(x), y_coord(y), z_coord(z) { }
 
   // Mutator methods
   void setX(double val);
@@ -22,10 +26,12 @@ public:
   void setZ(double val);
 
   // Accessor methods
-  double getX();
-  double getY();
-  double getZ();
+  constexpr double getX() const { return x_coord; }
+  constexpr double getY() const { return y_coord; }
+  constexpr double getZ() const { return z_coord; }
 
   // Member functions
-  double distanceTo(Point &p);
+  double distanceTo(const Point &p) const;
 };
+
+#endif // POINT_HH
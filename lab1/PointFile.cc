@@ -0,0 +1,168 @@
+#include "PointFile.hh"
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// RawDoubleXYZ batches are handed out by pointing straight into the mapped
+// file, which relies on a Point being a trivially copyable type laid out as
+// exactly three doubles.
+static_assert(sizeof(Point) == 3 * sizeof(double),
+              "Point must be three packed doubles");
+static_assert(std::is_trivially_copyable<Point>::value,
+              "Point must be trivially copyable");
+
+// Sizes of the parts of a binary STL file.
+static const size_t StlHeaderSize = 80;
+static const size_t StlRecordSize = 50;
+static const size_t StlCornerOffset = 12;   // corners follow the normal
+
+PointFile::PointFile(const char *filename, PointFileFormat format,
+                     long batchPoints) {
+  assert(batchPoints > 0);
+  mFormat = format;
+  mMap = 0;
+  mMapLength = 0;
+  mNextRecord = 0;
+
+  mFd = open(filename, O_RDONLY);
+  if (mFd < 0) {
+    throw std::runtime_error(std::string("Cannot open ") + filename);
+  }
+
+  struct stat st;
+  if (fstat(mFd, &st) != 0) {
+    close(mFd);
+    throw std::runtime_error(std::string("Cannot stat ") + filename);
+  }
+  off_t fileSize = st.st_size;
+
+  if (format == BinarySTL) {
+    // Read the triangle count that follows the header.
+    unsigned char header[StlHeaderSize + 4];
+    if (pread(mFd, header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+      close(mFd);
+      throw std::runtime_error(std::string("Not a binary STL file: ") +
+                               filename);
+    }
+    unsigned int count;
+    memcpy(&count, header + StlHeaderSize, 4);
+
+    mDataOffset = sizeof(header);
+    mRecordSize = StlRecordSize;
+    mPointsPerRecord = 3;
+
+    // Believe the file size over the count, if the file was truncated.
+    mNumRecords = (long) ((fileSize - mDataOffset) / mRecordSize);
+    if ((long) count < mNumRecords) {
+      mNumRecords = (long) count;
+    }
+  } else {
+    mDataOffset = 0;
+    mRecordSize = 3 * (format == RawDoubleXYZ ? sizeof(double) : sizeof(float));
+    mPointsPerRecord = 1;
+    mNumRecords = (long) (fileSize / mRecordSize);
+  }
+
+  mBatchRecords = batchPoints / mPointsPerRecord;
+  if (mBatchRecords < 1) {
+    mBatchRecords = 1;
+  }
+}
+
+// Destructor - unmap the current window and close the file.
+PointFile::~PointFile() {
+  unmap();
+  close(mFd);
+}
+
+// Private helper functions
+
+void PointFile::unmap() {
+  if (mMap != 0) {
+    munmap(mMap, mMapLength);
+    mMap = 0;
+    mMapLength = 0;
+  }
+}
+
+// Accessors
+
+long PointFile::getNumPoints() const {
+  return mNumRecords * mPointsPerRecord;
+}
+
+PointFileFormat PointFile::getFormat() const {
+  return mFormat;
+}
+
+// Member functions
+
+bool PointFile::next(PointBatch &batch) {
+  if (mNextRecord >= mNumRecords) {
+    return false;
+  }
+
+  // Done with the previous window; map the next one.  The mapping has to
+  // start on a page boundary, so it may begin a little before the data.
+  unmap();
+  long begin = mNextRecord;
+  long n = mNumRecords - begin;
+  if (n > mBatchRecords) {
+    n = mBatchRecords;
+  }
+
+  off_t pageSize = (off_t) sysconf(_SC_PAGESIZE);
+  off_t byteStart = mDataOffset + (off_t) begin * mRecordSize;
+  off_t mapStart = byteStart - byteStart % pageSize;
+  mMapLength = (size_t) (byteStart - mapStart) + (size_t) n * mRecordSize;
+
+  void *map = mmap(0, mMapLength, PROT_READ, MAP_PRIVATE, mFd, mapStart);
+  if (map == MAP_FAILED) {
+    mMapLength = 0;
+    throw std::runtime_error("Cannot map point file");
+  }
+  mMap = map;
+  madvise(mMap, mMapLength, MADV_SEQUENTIAL);
+  const unsigned char *data = (const unsigned char *) mMap +
+                              (byteStart - mapStart);
+
+  if (mFormat == RawDoubleXYZ) {
+    batch.points = reinterpret_cast<const Point *>(data);
+  } else if (mFormat == RawFloatXYZ) {
+    mBuffer.resize(n);
+    for (long i = 0; i < n; i++) {
+      float xyz[3];
+      memcpy(xyz, data + i * mRecordSize, sizeof(xyz));
+      mBuffer[i] = Point(xyz[0], xyz[1], xyz[2]);
+    }
+    batch.points = mBuffer.data();
+  } else {
+    mBuffer.resize(3 * n);
+    for (long i = 0; i < n; i++) {
+      float corners[9];
+      memcpy(corners, data + i * mRecordSize + StlCornerOffset,
+             sizeof(corners));
+      for (int c = 0; c < 3; c++) {
+        mBuffer[3 * i + c] = Point(corners[3 * c], corners[3 * c + 1],
+                                   corners[3 * c + 2]);
+      }
+    }
+    batch.points = mBuffer.data();
+  }
+
+  batch.count = n * mPointsPerRecord;
+  batch.first = begin * mPointsPerRecord;
+  mNextRecord = begin + n;
+  return true;
+}
+
+void PointFile::rewind() {
+  unmap();
+  mNextRecord = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef POINTFILE_HH
+#define POINTFILE_HH
+
+// Streams the points of a binary point or mesh file in batches, reading the
+// file through mmap rather than iostreams.  Only one window of the file is
+// mapped at a time, so files larger than memory can be processed.
+//
+// Supported formats (all little-endian):
+//   RawDoubleXYZ - x, y, z as consecutive doubles, one point after another.
+//                  Batches point straight into the mapped file; no copying.
+//   RawFloatXYZ  - the same with floats, widened into a reused buffer.
+//   BinarySTL    - an 80-byte header, a 32-bit triangle count, and then 50
+//                  bytes per triangle (normal, 3 corners, attribute count).
+//                  Each triangle yields its 3 corners, so a batch is a
+//                  triangle soup that can be passed to computeAreas().
+
+#include "Point.hh"
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+enum PointFileFormat {
+  RawDoubleXYZ,
+  RawFloatXYZ,
+  BinarySTL
+};
+
+// A batch of points handed out by PointFile::next().  The points stay valid
+// until the next call to next() or rewind(), or until the file is closed.
+struct PointBatch {
+  const Point *points;
+  long count;    // number of points in this batch
+  long first;    // index of points[0] among all points in the file
+};
+
+class PointFile {
+
+private:
+  int mFd;
+  PointFileFormat mFormat;
+  off_t mDataOffset;      // where the first record starts
+  size_t mRecordSize;     // bytes per record (point or triangle)
+  int mPointsPerRecord;
+  long mNumRecords;
+  long mBatchRecords;     // records per batch
+  long mNextRecord;       // first record of the next batch
+
+  void *mMap;             // the currently mapped window, or 0
+  size_t mMapLength;
+  std::vector<Point> mBuffer;   // decoded points, for formats that need it
+
+  void unmap();
+
+  // Not copyable, since it owns a file descriptor and a mapping.
+  PointFile(const PointFile &other);
+  PointFile & operator=(const PointFile &other);
+
+public:
+  // Opens the named file.  Batches hold about batchPoints points (always
+  // whole triangles for STL).  Throws std::runtime_error if the file cannot
+  // be opened or is not a valid file of the given format.
+  PointFile(const char *filename, PointFileFormat format,
+            long batchPoints = 1 << 20);
+
+  // Destructor - unmaps and closes the file.
+  ~PointFile();
+
+  // Accessors
+  long getNumPoints() const;
+  PointFileFormat getFormat() const;
+
+  // Fetches the next batch of points.  Returns false (and leaves batch
+  // alone) once every point has been handed out.
+  bool next(PointBatch &batch);
+
+  // Starts again from the first point.
+  void rewind();
+};
+
+#endif // POINTFILE_HH
@@ -0,0 +1,209 @@
+#include "SpatialHash.hh"
+#include <cassert>
+#include <cmath>
+
+// Each cell coordinate is packed into this many bits of the cell key.  Cells
+// further apart than 2^21 cells share keys, which is harmless:  the points
+// found in a cell are always checked against the query distance.
+static const int CellBits = 21;
+static const long long CellMask = (1LL << CellBits) - 1;
+
+// Initializes an empty grid whose cells are cubes with the given side.
+SpatialHash::SpatialHash(double cellSize) {
+  assert(cellSize > 0);
+  mCellSize = cellSize;
+  mCount = 0;
+}
+
+// Private helper functions
+
+// Returns the grid coordinate of the cell containing coordinate v.
+long long SpatialHash::cellCoord(double v) const {
+  return (long long) floor(v / mCellSize);
+}
+
+// Packs three grid coordinates into one cell key.
+long long SpatialHash::packCell(long long cx, long long cy, long long cz) {
+  return ((cx & CellMask) << (2 * CellBits)) | ((cy & CellMask) << CellBits) |
+         (cz & CellMask);
+}
+
+// Returns the key of the cell containing p.
+long long SpatialHash::cellKey(const Point &p) const {
+  return packCell(cellCoord(p.getX()), cellCoord(p.getY()),
+                  cellCoord(p.getZ()));
+}
+
+// Appends id to the list of the given cell.
+void SpatialHash::addToCell(int id, long long key) {
+  std::vector<int> &cell = mCells[key];
+  mCellOf[id] = key;
+  mSlot[id] = (int) cell.size();
+  cell.push_back(id);
+}
+
+// Takes id out of its cell's list, by moving the last id of that list into
+// its place.
+void SpatialHash::removeFromCell(int id) {
+  std::vector<int> &cell = mCells[mCellOf[id]];
+  int slot = mSlot[id];
+  int last = cell.back();
+  cell[slot] = last;
+  mSlot[last] = slot;
+  cell.pop_back();
+  mSlot[id] = -1;
+}
+
+// Accessors
+
+int SpatialHash::getSize() const {
+  return mCount;
+}
+
+double SpatialHash::getCellSize() const {
+  return mCellSize;
+}
+
+// returns true if id refers to a point currently in the grid
+bool SpatialHash::contains(int id) const {
+  return (id >= 0 && id < (int) mSlot.size() && mSlot[id] >= 0);
+}
+
+const Point & SpatialHash::getPoint(int id) const {
+  assert(contains(id));
+  return mPoints[id];
+}
+
+// Mutators
+
+int SpatialHash::insert(const Point &p) {
+  int id;
+  if (!mFreeIds.empty()) {
+    id = mFreeIds.back();
+    mFreeIds.pop_back();
+    mPoints[id] = p;
+  } else {
+    id = (int) mPoints.size();
+    mPoints.push_back(p);
+    mCellOf.push_back(0);
+    mSlot.push_back(-1);
+  }
+
+  addToCell(id, cellKey(p));
+  mCount++;
+  return id;
+}
+
+void SpatialHash::remove(int id) {
+  assert(contains(id));
+  removeFromCell(id);
+  mFreeIds.push_back(id);
+  mCount--;
+}
+
+void SpatialHash::move(int id, const Point &p) {
+  assert(contains(id));
+  mPoints[id] = p;
+
+  long long key = cellKey(p);
+  if (key != mCellOf[id]) {   // only touch the cells if it changed cell
+    removeFromCell(id);
+    addToCell(id, key);
+  }
+}
+
+void SpatialHash::clear() {
+  mCells.clear();
+  mPoints.clear();
+  mCellOf.clear();
+  mSlot.clear();
+  mFreeIds.clear();
+  mCount = 0;
+}
+
+void SpatialHash::removeEmptyCells() {
+  cellMap::iterator it = mCells.begin();
+  while (it != mCells.end()) {
+    if (it->second.empty()) {
+      it = mCells.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Queries
+
+int SpatialHash::neighbours(const Point &q, double radius,
+                            std::vector<int> &result) const {
+  if (radius < 0 || mCount == 0) {
+    return 0;
+  }
+  size_t initialSize = result.size();
+
+  long long lo[3], hi[3];
+  double qc[3] = { q.getX(), q.getY(), q.getZ() };
+  long long numCells = 1;
+  bool scanAll = false;
+  for (int a = 0; a < 3; a++) {
+    lo[a] = cellCoord(qc[a] - radius);
+    hi[a] = cellCoord(qc[a] + radius);
+    long long span = hi[a] - lo[a] + 1;
+    if (span > CellMask) {
+      scanAll = true;   // the box would wrap around the cell keys
+    } else {
+      numCells *= span;
+      scanAll = scanAll || numCells > (long long) mCells.size();
+    }
+  }
+
+  if (scanAll) {
+    // The query box covers more cells than are in use, so it is cheaper to
+    // look through the cells that are.
+    for (cellMap::const_iterator it = mCells.begin(); it != mCells.end(); ++it) {
+      const std::vector<int> &cell = it->second;
+      for (size_t i = 0; i < cell.size(); i++) {
+        if (q.distanceTo(mPoints[cell[i]]) <= radius) {
+          result.push_back(cell[i]);
+        }
+      }
+    }
+    return (int) (result.size() - initialSize);
+  }
+
+  for (long long cx = lo[0]; cx <= hi[0]; cx++) {
+    for (long long cy = lo[1]; cy <= hi[1]; cy++) {
+      for (long long cz = lo[2]; cz <= hi[2]; cz++) {
+        cellMap::const_iterator it = mCells.find(packCell(cx, cy, cz));
+        if (it == mCells.end()) {
+          continue;
+        }
+        const std::vector<int> &cell = it->second;
+        for (size_t i = 0; i < cell.size(); i++) {
+          if (q.distanceTo(mPoints[cell[i]]) <= radius) {
+            result.push_back(cell[i]);
+          }
+        }
+      }
+    }
+  }
+
+  return (int) (result.size() - initialSize);
+}
+
+int SpatialHash::neighboursOf(int id, double radius,
+                              std::vector<int> &result) const {
+  assert(contains(id));
+  size_t initialSize = result.size();
+  neighbours(mPoints[id], radius, result);
+
+  // Drop the point itself from what was just appended.
+  for (size_t i = initialSize; i < result.size(); i++) {
+    if (result[i] == id) {
+      result[i] = result.back();
+      result.pop_back();
+      break;
+    }
+  }
+  return (int) (result.size() - initialSize);
+}
@@ -0,0 +1,86 @@
+#ifndef SPATIALHASH_HH
+#define SPATIALHASH_HH
+
+// A uniform grid over 3D space, stored as a hash table from cell to the
+// points in that cell.  Unlike KdTree, points can be inserted, removed and
+// moved one at a time in O(1) amortised time, which suits point sets that
+// change on every step of a simulation.  Fixed-radius neighbour queries are
+// fastest when the radius is close to the cell size.
+
+#include "Point.hh"
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+class SpatialHash {
+
+private:
+  // Hashes a packed cell key; the keys themselves are too regular for the
+  // identity hash that std::hash uses for integers.
+  struct cellHash {
+    size_t operator()(long long key) const {
+      unsigned long long h = (unsigned long long) key * 0x9E3779B97F4A7C15ULL;
+      return (size_t) (h ^ (h >> 32));
+    }
+  };
+
+  typedef std::unordered_map<long long, std::vector<int>, cellHash> cellMap;
+
+  double mCellSize;
+  cellMap mCells;               // ids of the points in each nonempty cell
+
+  std::vector<Point> mPoints;   // position of each id
+  std::vector<long long> mCellOf;  // cell key of each id
+  std::vector<int> mSlot;       // position of each id in its cell's list,
+                                // or -1 if the id is not in use
+  std::vector<int> mFreeIds;    // ids available for reuse
+  int mCount;
+
+  long long cellCoord(double v) const;
+  static long long packCell(long long cx, long long cy, long long cz);
+  long long cellKey(const Point &p) const;
+
+  void addToCell(int id, long long key);
+  void removeFromCell(int id);
+
+public:
+  // Constructors
+  SpatialHash(double cellSize);   // cell size, usually the query radius
+
+  // Accessors
+  int getSize() const;            // number of points currently stored
+  double getCellSize() const;
+  bool contains(int id) const;
+  const Point & getPoint(int id) const;
+
+  // Mutators
+
+  // Adds a point and returns its id.  Ids of removed points are reused.
+  int insert(const Point &p);
+
+  // Removes the point with the given id.
+  void remove(int id);
+
+  // Moves the point with the given id to a new position.  If it stays in the
+  // same cell, only its stored position changes.
+  void move(int id, const Point &p);
+
+  // Removes every point.
+  void clear();
+
+  // Cells that become empty are kept, so that points moving back and forth
+  // between cells do not reallocate them.  This frees them.
+  void removeEmptyCells();
+
+  // Queries
+
+  // Appends the ids of all points within the given distance of q to result,
+  // in no particular order.  Returns the number of ids appended.
+  int neighbours(const Point &q, double radius, std::vector<int> &result) const;
+
+  // Same as above, but around the point with the given id and excluding
+  // that point itself.
+  int neighboursOf(int id, double radius, std::vector<int> &result) const;
+};
+
+#endif // SPATIALHASH_HH
@@ -0,0 +1,219 @@
+#include "SpatialSort.hh"
+#include "Parallel.hh"
+#include <algorithm>
+#include <cassert>
+
+// Bits per coordinate in a curve key.
+static const int KeyBits = 21;
+
+// The radix sort handles this many key bits per pass:  6 passes of 11 bits
+// cover 64-bit keys.  Passes where every key has the same digit are skipped.
+static const int RadixBits = 11;
+static const int RadixSize = 1 << RadixBits;
+static const int RadixPasses = (64 + RadixBits - 1) / RadixBits;
+
+// Each core gets at least this many points.
+static const long PointsPerChunk = 65536;
+
+// Spreads the low 21 bits of v so that there are two zero bits between each
+// of them.
+static unsigned long long spreadBits(unsigned int v) {
+  unsigned long long x = v & 0x1fffff;
+  x = (x | (x << 32)) & 0x001f00000000ffffULL;
+  x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+  x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+  x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+  x = (x | (x << 2))  & 0x1249249249249249ULL;
+  return x;
+}
+
+unsigned long long mortonKey(unsigned int x, unsigned int y, unsigned int z) {
+  return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+// Uses Skilling's method ("Programming the Hilbert curve", 2004):  the
+// coordinates are transformed in place so that interleaving their bits
+// gives the Hilbert index.
+unsigned long long hilbertKey(unsigned int x, unsigned int y, unsigned int z) {
+  unsigned int X[3] = { x, y, z };
+
+  // Inverse undo
+  for (unsigned int q = 1u << (KeyBits - 1); q > 1; q >>= 1) {
+    unsigned int p = q - 1;
+    for (int i = 0; i < 3; i++) {
+      if (X[i] & q) {
+        X[0] ^= p;   // invert
+      } else {
+        unsigned int t = (X[0] ^ X[i]) & p;   // exchange
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+    }
+  }
+
+  // Gray encode
+  X[1] ^= X[0];
+  X[2] ^= X[1];
+  unsigned int t = 0;
+  for (unsigned int q = 1u << (KeyBits - 1); q > 1; q >>= 1) {
+    if (X[2] & q) {
+      t ^= q - 1;
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    X[i] ^= t;
+  }
+
+  // X[0] holds the most significant bit of each group of three.
+  return mortonKey(X[2], X[1], X[0]);
+}
+
+void computeCurveKeys(const Point *points, int numPoints,
+                      SpaceFillingCurve curve, unsigned long long *keys) {
+  if (numPoints == 0) {
+    return;
+  }
+
+  // Find the bounding box, one chunk per core.
+  int chunks = numChunks(numPoints, PointsPerChunk);
+  std::vector<double> chunkBounds(6 * chunks);
+  parallelFor(numPoints, chunks, [&](int c, long begin, long end) {
+    double *b = &chunkBounds[6 * c];
+    b[0] = b[3] = points[begin].getX();
+    b[1] = b[4] = points[begin].getY();
+    b[2] = b[5] = points[begin].getZ();
+    for (long i = begin + 1; i < end; i++) {
+      double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+      for (int a = 0; a < 3; a++) {
+        b[a] = std::min(b[a], v[a]);
+        b[a + 3] = std::max(b[a + 3], v[a]);
+      }
+    }
+  });
+
+  double lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = chunkBounds[a];
+    hi[a] = chunkBounds[a + 3];
+    for (int c = 1; c < chunks; c++) {
+      lo[a] = std::min(lo[a], chunkBounds[6 * c + a]);
+      hi[a] = std::max(hi[a], chunkBounds[6 * c + a + 3]);
+    }
+  }
+
+  // Use the same scale on every axis, so that the grid cells are cubes.
+  double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+  const double maxCell = (double) ((1u << KeyBits) - 1);
+  double scale = (extent > 0 ? maxCell / extent : 0);
+
+  parallelFor(numPoints, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+      unsigned int cell[3];
+      for (int a = 0; a < 3; a++) {
+        cell[a] = (unsigned int) std::min(maxCell, (v[a] - lo[a]) * scale);
+      }
+      keys[i] = (curve == MortonCurve ? mortonKey(cell[0], cell[1], cell[2])
+                                      : hilbertKey(cell[0], cell[1], cell[2]));
+    }
+  });
+}
+
+// This is a least-significant-digit radix sort.  Each pass counts digits
+// per chunk, turns the counts into an output offset for every (digit, chunk)
+// pair, and then has every chunk scatter its own items, so no two threads
+// write the same slot.
+void sortByKey(std::vector<unsigned long long> &keys, std::vector<int> &values) {
+  assert(keys.size() == values.size());
+  long n = (long) keys.size();
+  std::vector<unsigned long long> keyTemp(n);
+  std::vector<int> valueTemp(n);
+
+  int chunks = numChunks(n, PointsPerChunk);
+  std::vector<long> counts((size_t) chunks * RadixSize);
+
+  for (int pass = 0; pass < RadixPasses; pass++) {
+    int shift = pass * RadixBits;
+    const unsigned long long *src = keys.data();
+    const int *srcValues = values.data();
+
+    std::fill(counts.begin(), counts.end(), 0L);
+    parallelFor(n, chunks, [&](int c, long begin, long end) {
+      long *count = &counts[(size_t) c * RadixSize];
+      for (long i = begin; i < end; i++) {
+        count[(src[i] >> shift) & (RadixSize - 1)]++;
+      }
+    });
+
+    // Skip passes where every key has the same digit.
+    bool trivial = false;
+    for (int d = 0; d < RadixSize && !trivial; d++) {
+      long total = 0;
+      for (int c = 0; c < chunks; c++) {
+        total += counts[(size_t) c * RadixSize + d];
+      }
+      trivial = (total == n);
+    }
+    if (trivial) {
+      continue;
+    }
+
+    // Exclusive prefix sum, in (digit, chunk) order.
+    long offset = 0;
+    for (int d = 0; d < RadixSize; d++) {
+      for (int c = 0; c < chunks; c++) {
+        long count = counts[(size_t) c * RadixSize + d];
+        counts[(size_t) c * RadixSize + d] = offset;
+        offset += count;
+      }
+    }
+
+    unsigned long long *dst = keyTemp.data();
+    int *dstValues = valueTemp.data();
+    parallelFor(n, chunks, [&](int c, long begin, long end) {
+      long *next = &counts[(size_t) c * RadixSize];
+      for (long i = begin; i < end; i++) {
+        long pos = next[(src[i] >> shift) & (RadixSize - 1)]++;
+        dst[pos] = src[i];
+        dstValues[pos] = srcValues[i];
+      }
+    });
+
+    keys.swap(keyTemp);
+    values.swap(valueTemp);
+  }
+}
+
+void spatialSortOrder(const Point *points, int numPoints,
+                      SpaceFillingCurve curve, std::vector<int> &perm) {
+  assert(numPoints >= 0);
+  std::vector<unsigned long long> keys(numPoints);
+  computeCurveKeys(points, numPoints, curve, keys.data());
+
+  perm.resize(numPoints);
+  for (int i = 0; i < numPoints; i++) {
+    perm[i] = i;
+  }
+  sortByKey(keys, perm);
+}
+
+void spatialSort(std::vector<Point> &points, SpaceFillingCurve curve,
+                 std::vector<int> &perm) {
+  spatialSortOrder(points.data(), (int) points.size(), curve, perm);
+  applyPermutation(perm, points);
+}
+
+void remapIndices(const std::vector<int> &perm, int *indices, long numIndices) {
+  // Invert the permutation:  the point that was at perm[i] is now at i.
+  std::vector<int> newIndex(perm.size());
+  for (size_t i = 0; i < perm.size(); i++) {
+    newIndex[perm[i]] = (int) i;
+  }
+
+  int chunks = numChunks(numIndices, PointsPerChunk);
+  parallelFor(numIndices, chunks, [&](int, long begin, long end) {
+    for (long i = begin; i < end; i++) {
+      indices[i] = newIndex[indices[i]];
+    }
+  });
+}
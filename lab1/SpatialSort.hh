@@ -0,0 +1,60 @@
+#ifndef SPATIALSORT_HH
+#define SPATIALSORT_HH
+
+// Reorders point sets along a space-filling curve, so that points that are
+// close together in space are also close together in memory.  Each point's
+// coordinates are quantised to 21 bits within the bounding box of the set,
+// and the points are sorted by their Morton (Z-order) or Hilbert index with
+// a parallel radix sort.
+
+#include "Point.hh"
+#include <cstddef>
+#include <vector>
+
+enum SpaceFillingCurve {
+  MortonCurve,    // cheap to compute
+  HilbertCurve    // better locality: consecutive cells are always adjacent
+};
+
+// Returns the 63-bit Morton key of grid cell (x, y, z), 0 <= x, y, z < 2^21.
+unsigned long long mortonKey(unsigned int x, unsigned int y, unsigned int z);
+
+// Returns the 63-bit Hilbert key of grid cell (x, y, z), 0 <= x, y, z < 2^21.
+unsigned long long hilbertKey(unsigned int x, unsigned int y, unsigned int z);
+
+// Computes the curve key of each point, quantised within the bounding box of
+// all the points.  keys must have room for numPoints values.
+void computeCurveKeys(const Point *points, int numPoints,
+                      SpaceFillingCurve curve, unsigned long long *keys);
+
+// Sorts keys into increasing order, moving values[i] along with keys[i],
+// with a parallel radix sort.  Equal keys keep their original order.
+void sortByKey(std::vector<unsigned long long> &keys, std::vector<int> &values);
+
+// Computes the order in which to visit the points so that they follow the
+// curve.  perm[i] is the (old) index of the point that belongs at position i.
+// Points with equal keys keep their original order.
+void spatialSortOrder(const Point *points, int numPoints,
+                      SpaceFillingCurve curve, std::vector<int> &perm);
+
+// Reorders the points (in place) so they follow the curve, and stores the
+// permutation used in perm, as described for spatialSortOrder().
+void spatialSort(std::vector<Point> &points, SpaceFillingCurve curve,
+                 std::vector<int> &perm);
+
+// Reorders any array of per-point data to match a permutation from
+// spatialSortOrder():  afterwards values[i] is what was values[perm[i]].
+template <typename T>
+void applyPermutation(const std::vector<int> &perm, std::vector<T> &values) {
+  std::vector<T> reordered(values.size());
+  for (size_t i = 0; i < perm.size(); i++) {
+    reordered[i] = values[perm[i]];
+  }
+  values.swap(reordered);
+}
+
+// Rewrites mesh vertex indices after the vertices were reordered with the
+// given permutation, so that they refer to the same points as before.
+void remapIndices(const std::vector<int> &perm, int *indices, long numIndices);
+
+#endif // SPATIALSORT_HH
@@ -0,0 +1,18 @@
+#include "lab1.hh"
+#include <cmath>
+
+// Computes the area between 3 points using Heron's formula
+double computeArea(Point &a, Point &b, Point &c) {
+	// Compute the lengths of the sides
+	double sideAB = a.distanceTo(b);
+	double sideBC = b.distanceTo(c);
+	double sideCA = c.distanceTo(a);
+
+	// compute the "semiperimeter" and call it "s".  Heron's forumla says the
+	// area is the square root of the product of the semiperimeter and the
+	// difference between the semiperimter and the length of each of the 
+	// 3 sides.
+	double s = ((sideAB + sideBC + sideCA) / 2);
+	double area = sqrt(s * (s - sideAB) * (s - sideBC) * (s - sideCA));
+	return area;
+}
@@ -0,0 +1,2240 @@
+// A test-suite for the lab1 geometry code.  Every structure is compared
+// against a brute-force answer on small random inputs, along with the edge
+// cases (empty inputs, duplicates, exact boundaries) that the fast paths
+// handle specially.  Build with, for example:
+//
+//   g++ -std=c++14 -Wall -O2 -pthread -o checkgeom checkgeom.cc Bvh.cc
+//       ClosestPair.cc CompressedCloud.cc ConvexHull.cc KdTree.cc Mesh.cc
+//       Point.cc PointFile.cc SpatialHash.cc SpatialSort.cc
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+#include "Bvh.hh"
+#include "ClosestPair.hh"
+#include "CompressedCloud.hh"
+#include "ConvexHull.hh"
+#include "GeomPoint.hh"
+#include "KdTree.hh"
+#include "Mesh.hh"
+#include "Point.hh"
+#include "PointFile.hh"
+#include "SpatialHash.hh"
+#include "SpatialSort.hh"
+
+
+using namespace std;
+
+
+
+// ----------------------------------------------------------------------
+
+// Normally, this declaration would go in a separate header file.
+
+class ErrorContext              // displays test results
+{
+public:
+    ErrorContext(ostream &os);              // write header to stream
+    void desc(const char *msg, int line);   // write line/description
+    void desc(string msg, int line);
+    void result(bool good);                 // write test result
+    ~ErrorContext();                        // write summary info
+    bool ok() const;                        // true iff all tests passed
+    
+private:
+    ostream &os;                            // output stream to use
+    int passed;                             // # of tests which passed
+    int total;                              // total # of tests
+    int lastline;                           // line # of most recent test
+    set<int> badlines;                      // line #'s of failed tests
+    bool skip;                              // skip a line before title?
+};
+
+
+// ----------------------------------------------------------------------
+
+// Normally, these method implementations would go in a separate source file.
+
+ErrorContext::ErrorContext(ostream &os)
+  : os(os), passed(0), total(0), lastline(0), skip(false)
+{
+    os << "line: ";
+    os.width(65);
+    os.setf(ios::left, ios::adjustfield);
+    os << "description" << " result" << endl;
+    os.width(78);
+    os.fill('~');
+    os << "~" << endl;
+    os.fill(' ');
+    os.setf(ios::right, ios::adjustfield);
+}
+
+
+void ErrorContext::desc(const char *msg, int line)
+{
+    if (lastline != 0 || (*msg == '-' && skip))
+    {
+        os << endl;
+    }
+    
+    os.width(4);
+    os << line << ": ";
+    os.width(65);
+    os.setf(ios::left, ios::adjustfield);
+    os << msg << " ";
+    os.setf(ios::right, ios::adjustfield);
+    os.flush();
+    
+    lastline = line;
+    skip = true;
+}
+
+
+void ErrorContext::desc(string msg, int line)
+{
+    if ((lastline != 0) || ((msg[0] == '-') && skip))
+    {
+        os << endl;
+    }
+    
+    os.width(4);
+    os << line << ": ";
+    os.width(65);
+    os.setf(ios::left, ios::adjustfield);
+    os << msg << " ";
+    os.setf(ios::right, ios::adjustfield);
+    os.flush();
+    
+    lastline = line;
+    skip = true;
+}
+
+
+#define DESC(x) desc(x, __LINE__)  // ugly hack
+
+void ErrorContext::result(bool good)
+{
+    if (good)
+    {
+        os << "ok";
+        passed++;
+    }
+    else
+    {
+        os << "ERROR";
+        badlines.insert(lastline);
+    }
+    
+    os << endl;
+    total++;
+    lastline = 0;
+}
+
+
+ErrorContext::~ErrorContext()
+{
+    os << endl << "Passed " << passed << "/" << total << " tests." << endl
+       << endl;
+    
+    if (badlines.size() > 0)
+    {
+        os << "For more information, please consult:" << endl;
+        for (set<int>::const_iterator it = badlines.begin();
+            it != badlines.end(); it++)
+        {
+            os << "  " << __FILE__ << ", line " << *it << endl;
+        }
+        os << endl;
+        
+        if (badlines.size() > 2)
+        {
+            os << "We recommend that you "
+               << "fix the topmost failure before going on."
+               << endl << endl;
+        }
+    }
+}
+
+
+bool ErrorContext::ok() const
+{
+    return passed == total;
+}
+
+
+/*=====================================================================
+ * TEST FUNCTIONS START HERE.
+ */
+
+
+
+
+// Random coordinates, from a fixed seed so that failures can be repeated.
+static mt19937 rng(12345);
+
+static double randomCoord(double range)
+{
+  return uniform_real_distribution<double>(-range, range)(rng);
+}
+
+static Point randomPoint(double range)
+{
+  double x = randomCoord(range), y = randomCoord(range);
+  return Point(x, y, randomCoord(range));
+}
+
+// True if a and b agree to within tol, relative to the larger of them (or
+// absolutely, for values near zero).
+static bool near(double a, double b, double tol)
+{
+  double scale = max(1.0, max(fabs(a), fabs(b)));
+  return fabs(a - b) <= tol * scale;
+}
+
+
+/**
+ * Triangle areas, over indexed meshes and triangle soups, compared with
+ * areas that are known exactly.
+ **/
+void meshAreas(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Triangle mesh areas ---");
+
+  // The unit cube, two triangles per face.
+  const Point cube[8] = {
+    Point(0, 0, 0), Point(1, 0, 0), Point(1, 1, 0), Point(0, 1, 0),
+    Point(0, 0, 1), Point(1, 0, 1), Point(1, 1, 1), Point(0, 1, 1)
+  };
+  const int cubeIndices[36] = {
+    0, 2, 1,  0, 3, 2,  4, 5, 6,  4, 6, 7,  0, 1, 5,  0, 5, 4,
+    1, 2, 6,  1, 6, 5,  2, 3, 7,  2, 7, 6,  3, 0, 4,  3, 4, 7
+  };
+
+  ec.DESC("empty mesh");
+  {
+    TriangleMesh mesh(cube, 8, cubeIndices, 0);
+    pass = (computeSurfaceArea(mesh) == 0) && (computeAreas(mesh, 0) == 0);
+    ec.result(pass);
+  }
+
+  ec.DESC("indexed unit cube");
+  {
+    TriangleMesh mesh(cube, 8, cubeIndices, 12);
+    double areas[12];
+
+    pass = near(computeAreas(mesh, areas), 6, 1e-15) &&
+           near(computeSurfaceArea(mesh), 6, 1e-15);
+    for (int t = 0; t < 12; t++)
+      pass = pass && near(areas[t], 0.5, 1e-15);
+    ec.result(pass);
+  }
+
+  ec.DESC("unit cube as a triangle soup");
+  {
+    vector<Point> corners;
+    for (int i = 0; i < 36; i++)
+      corners.push_back(cube[cubeIndices[i]]);
+
+    TriangleMesh mesh(corners.data(), 12);
+    double areas[12];
+
+    pass = (mesh.indices == 0) && near(computeAreas(mesh, areas), 6, 1e-15);
+    for (int t = 0; t < 12; t++)
+      pass = pass && near(areas[t], 0.5, 1e-15);
+    ec.result(pass);
+  }
+
+  ec.DESC("long, thin triangles");
+  {
+    // Heron's formula loses most of its digits on these; the area of each
+    // is exactly 1/2 (the sides are powers of two, so they are exact).
+    const double Long = 1 << 20, Short = 1.0 / (1 << 20);
+    Point corners[6] = {
+      Point(0, 0, 0), Point(Long, 0, 0), Point(0, Short, 0),
+      Point(5, 5, 5), Point(5, 5, 5 + 64 * Short), Point(5 + Long / 64, 5, 5)
+    };
+    TriangleMesh mesh(corners, 2);
+    double areas[2];
+    computeAreas(mesh, areas);
+
+    pass = near(areas[0], 0.5, 1e-12) && near(areas[1], 0.5, 1e-12);
+    ec.result(pass);
+  }
+
+  ec.DESC("large grid, indexed and as a soup, across cores");
+  {
+    // An n x n grid of unit squares, tilted out of the xy-plane so that
+    // every coordinate is used:  each square has area sqrt(2).  The
+    // triangle count is not a multiple of the block size.
+    const int n = 129;
+    vector<Point> vertices;
+    for (int j = 0; j <= n; j++)
+      for (int i = 0; i <= n; i++)
+        vertices.push_back(Point(i, j, i));
+
+    vector<int> indices;
+    vector<Point> corners;
+    for (int j = 0; j < n; j++)
+      for (int i = 0; i < n; i++)
+      {
+        int v = j * (n + 1) + i;
+        int quad[6] = { v, v + 1, v + n + 2, v, v + n + 2, v + n + 1 };
+        for (int k = 0; k < 6; k++)
+        {
+          indices.push_back(quad[k]);
+          corners.push_back(vertices[quad[k]]);
+        }
+      }
+
+    int numTriangles = 2 * n * n;
+    TriangleMesh indexed(vertices.data(), (int) vertices.size(),
+                         indices.data(), numTriangles);
+    TriangleMesh soup(corners.data(), numTriangles);
+    vector<double> areas(numTriangles);
+    double expected = n * n * sqrt(2.0);
+
+    pass = near(computeAreas(indexed, areas.data()), expected, 1e-12) &&
+           near(computeSurfaceArea(soup), expected, 1e-12);
+    for (int t = 0; t < numTriangles; t++)
+      pass = pass && near(areas[t], sqrt(0.5), 1e-15);
+    ec.result(pass);
+  }
+
+  ec.DESC("random triangles, against a long double cross product");
+  {
+    const int NumTriangles = 5000;
+    vector<Point> vertices;
+    vector<int> indices;
+    for (int i = 0; i < 1000; i++)
+      vertices.push_back(randomPoint(100));
+    for (int i = 0; i < 3 * NumTriangles; i++)
+      indices.push_back(uniform_int_distribution<int>(0, 999)(rng));
+
+    TriangleMesh mesh(vertices.data(), 1000, indices.data(), NumTriangles);
+    vector<double> areas(NumTriangles);
+    double total = computeAreas(mesh, areas.data());
+
+    pass = true;
+    long double expectedTotal = 0;
+    for (int t = 0; t < NumTriangles; t++)
+    {
+      const Point &a = vertices[indices[3 * t]];
+      const Point &b = vertices[indices[3 * t + 1]];
+      const Point &c = vertices[indices[3 * t + 2]];
+      long double ux = (long double) b.getX() - a.getX();
+      long double uy = (long double) b.getY() - a.getY();
+      long double uz = (long double) b.getZ() - a.getZ();
+      long double vx = (long double) c.getX() - a.getX();
+      long double vy = (long double) c.getY() - a.getY();
+      long double vz = (long double) c.getZ() - a.getZ();
+      long double cx = uy * vz - uz * vy;
+      long double cy = uz * vx - ux * vz;
+      long double cz = ux * vy - uy * vx;
+      long double area = 0.5L * sqrtl(cx * cx + cy * cy + cz * cz);
+
+      pass = pass && near(areas[t], (double) area, 1e-9);
+      expectedTotal += area;
+    }
+    pass = pass && near(total, (double) expectedTotal, 1e-12);
+    ec.result(pass);
+  }
+
+  ec.DESC("pairwise summation");
+  {
+    vector<double> values;
+    for (int i = 1; i <= 1000; i++)
+      values.push_back(i);
+    vector<double> tenths(1000000, 0.1);
+
+    pass = (pairwiseSum(values.data(), 0) == 0) &&
+           (pairwiseSum(values.data(), 3) == 6) &&
+           (pairwiseSum(values.data(), 1000) == 500500) &&
+           near(pairwiseSum(tenths.data(), 1000000), 100000, 1e-13);
+    ec.result(pass);
+  }
+}
+
+
+// Distance from q to p, computed the same way as the spatial structures do,
+// so that brute-force answers can be compared exactly.
+static double bruteDistance(const Point &q, const Point &p)
+{
+  double dx = p.getX() - q.getX();
+  double dy = p.getY() - q.getY();
+  double dz = p.getZ() - q.getZ();
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Sorted distances from q to every point.
+static vector<double> bruteDistances(const Point &q,
+                                     const vector<Point> &points)
+{
+  vector<double> dist;
+  for (size_t i = 0; i < points.size(); i++)
+    dist.push_back(bruteDistance(q, points[i]));
+  sort(dist.begin(), dist.end());
+  return dist;
+}
+
+// Indices of the points within radius of q.
+static set<int> bruteWithin(const Point &q, const vector<Point> &points,
+                            double radius)
+{
+  set<int> result;
+  for (size_t i = 0; i < points.size(); i++)
+    if (bruteDistance(q, points[i]) <= radius)
+      result.insert((int) i);
+  return result;
+}
+
+// A cloud of points on an integer grid, with many duplicates and many
+// points at exactly integer distances from each other.
+static vector<Point> latticeCloud(int numPoints, int side)
+{
+  vector<Point> points;
+  uniform_int_distribution<int> coord(0, side - 1);
+  for (int i = 0; i < numPoints; i++)
+  {
+    int x = coord(rng), y = coord(rng);
+    points.push_back(Point(x, y, coord(rng)));
+  }
+  return points;
+}
+
+// True if the k nearest neighbours found for q are distinct, are as far
+// away as reported, and have the same distances as a brute-force search.
+static bool checkNearestK(const KdTree &tree, const vector<Point> &points,
+                          const Point &q, int k)
+{
+  vector<int> indices(k);
+  vector<double> distances(k);
+  int found = tree.nearestK(q, k, indices.data(), distances.data());
+  vector<double> expected = bruteDistances(q, points);
+
+  if (found != min(k, (int) points.size()))
+    return false;
+
+  set<int> seen;
+  for (int i = 0; i < found; i++)
+  {
+    int id = indices[i];
+    if (id < 0 || id >= (int) points.size() || !seen.insert(id).second ||
+        distances[i] != expected[i] ||
+        bruteDistance(q, points[id]) != distances[i])
+      return false;
+  }
+  return true;
+}
+
+
+/**
+ * Nearest-neighbour and radius queries on a k-d tree, compared with a
+ * brute-force scan of every point.
+ **/
+void kdTree(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- k-d tree queries ---");
+
+  ec.DESC("empty tree");
+  {
+    vector<Point> none;
+    KdTree tree(none);
+    double dist = 0;
+    int index;
+    vector<int> within;
+
+    pass = (tree.getSize() == 0) &&
+           (tree.nearest(Point(1, 2, 3), &dist) == -1) && std::isinf(dist) &&
+           (tree.nearestK(Point(), 3, &index) == 0) &&
+           (tree.withinRadius(Point(), 10, within) == 0) && within.empty();
+    ec.result(pass);
+  }
+
+  ec.DESC("nearest point, random cloud");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 3000; i++)
+      points.push_back(randomPoint(100));
+    KdTree tree(points);
+
+    pass = (tree.getSize() == 3000);
+    for (int i = 0; i < 300; i++)
+    {
+      Point q = (i % 3 == 0 ? points[i] : randomPoint(120));
+      double dist;
+      int id = tree.nearest(q, &dist);
+      pass = pass && (id >= 0) && (dist == bruteDistances(q, points)[0]) &&
+             (bruteDistance(q, points[id]) == dist);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("k nearest points, random cloud, small and large k");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 2000; i++)
+      points.push_back(randomPoint(100));
+    KdTree tree(points);
+
+    pass = true;
+    const int ks[4] = { 1, 5, 32, 100 };
+    for (int i = 0; i < 100; i++)
+      pass = pass && checkNearestK(tree, points, randomPoint(120), ks[i % 4]);
+    ec.result(pass);
+  }
+
+  ec.DESC("duplicate points, and points at equal distances");
+  {
+    vector<Point> points = latticeCloud(2000, 6);
+    KdTree tree(points);
+
+    pass = true;
+    for (int i = 0; i < 100; i++)
+    {
+      Point q = latticeCloud(1, 7)[0];
+      double dist;
+      int id = tree.nearest(q, &dist);
+      pass = pass && (dist == bruteDistances(q, points)[0]) &&
+             (bruteDistance(q, points[id]) == dist) &&
+             checkNearestK(tree, points, q, 1 + i % 60);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("k larger than the number of points");
+  {
+    vector<Point> points = latticeCloud(10, 3);
+    points.push_back(points[0]);
+    KdTree tree(points);
+
+    pass = checkNearestK(tree, points, Point(1, 1, 1), 11) &&
+           checkNearestK(tree, points, Point(1, 1, 1), 25) &&
+           checkNearestK(tree, points, Point(-5, 0, 9), 1000);
+    ec.result(pass);
+  }
+
+  ec.DESC("points within a radius, including exactly on it");
+  {
+    vector<Point> points = latticeCloud(3000, 10);
+    KdTree tree(points);
+
+    pass = true;
+    for (int i = 0; i < 200; i++)
+    {
+      Point q = (i % 2 == 0 ? latticeCloud(1, 10)[0] : randomPoint(12));
+      double radius = (i % 4 < 2 ? i % 5 : randomCoord(4));
+      vector<int> within(1, -1);   // results are appended
+      int count = tree.withinRadius(q, radius, within);
+      set<int> found(within.begin() + 1, within.end());
+
+      pass = pass && (count == (int) within.size() - 1) &&
+             (count == (int) found.size()) &&
+             (found == bruteWithin(q, points, radius));
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("batch queries match single queries");
+  {
+    vector<Point> points = latticeCloud(500, 8), queries;
+    for (int i = 0; i < 3000; i++)
+      queries.push_back(randomPoint(10));
+    KdTree tree(points), tiny(points.data(), 3);
+    const int K = 4;
+
+    vector<int> nearest(queries.size()), nearestK(K * queries.size());
+    vector<int> tinyK(K * queries.size());
+    vector<double> dist(queries.size()), distK(K * queries.size());
+    vector<double> tinyDistK(K * queries.size());
+    tree.nearestBatch(queries.data(), (int) queries.size(),
+                      nearest.data(), dist.data());
+    tree.nearestKBatch(queries.data(), (int) queries.size(), K,
+                       nearestK.data(), distK.data());
+    tiny.nearestKBatch(queries.data(), (int) queries.size(), K,
+                       tinyK.data(), tinyDistK.data());
+
+    pass = true;
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      double d;
+      int id[K];
+      double ds[K];
+      pass = pass && (tree.nearest(queries[i], &d) == nearest[i]) &&
+             (d == dist[i]);
+
+      tree.nearestK(queries[i], K, id, ds);
+      for (int j = 0; j < K; j++)
+        pass = pass && (id[j] == nearestK[K * i + j]) &&
+               (ds[j] == distK[K * i + j]);
+
+      // The tiny tree has only 3 points, so the 4th is padding.
+      tiny.nearestK(queries[i], 3, id, ds);
+      for (int j = 0; j < 3; j++)
+        pass = pass && (id[j] == tinyK[K * i + j]) &&
+               (ds[j] == tinyDistK[K * i + j]);
+      pass = pass && (tinyK[K * i + 3] == -1) &&
+             std::isinf(tinyDistK[K * i + 3]);
+    }
+    ec.result(pass);
+  }
+}
+
+
+// A brute-force version of SpatialHash:  every id ever handed out, and
+// whether it is still in use.
+struct BruteSet {
+  vector<Point> points;
+  vector<bool> used;
+
+  set<int> within(const Point &q, double radius) const
+  {
+    set<int> result;
+    for (size_t i = 0; i < points.size(); i++)
+      if (used[i] && q.distanceTo(points[i]) <= radius)
+        result.insert((int) i);
+    return result;
+  }
+};
+
+// True if the hash finds the same neighbours of q as a brute-force search.
+static bool checkNeighbours(const SpatialHash &hash, const BruteSet &brute,
+                            const Point &q, double radius)
+{
+  vector<int> found(1, -1);   // results are appended
+  int count = hash.neighbours(q, radius, found);
+  set<int> ids(found.begin() + 1, found.end());
+  return (count == (int) found.size() - 1) && (count == (int) ids.size()) &&
+         (ids == brute.within(q, radius));
+}
+
+// Runs a random sequence of inserts, removes and moves on a hash and on a
+// brute-force set, with points from pick(), checking the two agree
+// throughout.
+template <typename Pick>
+static bool randomHashSequence(double cellSize, int steps, Pick pick)
+{
+  SpatialHash hash(cellSize);
+  BruteSet brute;
+  vector<int> live;
+  bool pass = true;
+
+  for (int step = 0; step < steps && pass; step++)
+  {
+    int op = uniform_int_distribution<int>(0, 9)(rng);
+    if (op < 4 || live.empty())
+    {
+      // Removed ids are handed out again, most recently removed first.
+      int expected = (int) brute.points.size();
+      for (size_t i = 0; i < brute.used.size(); i++)
+        if (!brute.used[i])
+          expected = -1;
+
+      Point p = pick();
+      int id = hash.insert(p);
+      pass = (expected == -1 ? id < (int) brute.points.size()
+                             : id == expected) &&
+             (id >= (int) brute.points.size() || !brute.used[id]);
+      if (id >= (int) brute.points.size())
+      {
+        brute.points.resize(id + 1);
+        brute.used.resize(id + 1, false);
+      }
+      brute.points[id] = p;
+      brute.used[id] = true;
+      live.push_back(id);
+    }
+    else if (op < 6)
+    {
+      int k = uniform_int_distribution<int>(0, (int) live.size() - 1)(rng);
+      int id = live[k];
+      hash.remove(id);
+      brute.used[id] = false;
+      live[k] = live.back();
+      live.pop_back();
+
+      // The next insert must reuse this id.
+      if (op == 5)
+      {
+        Point p = pick();
+        pass = (hash.insert(p) == id);
+        brute.points[id] = p;
+        brute.used[id] = true;
+        live.push_back(id);
+      }
+    }
+    else
+    {
+      int k = uniform_int_distribution<int>(0, (int) live.size() - 1)(rng);
+      Point p = (op == 6 ? brute.points[live[k]] : pick());
+      hash.move(live[k], p);
+      brute.points[live[k]] = p;
+    }
+
+    pass = pass && (hash.getSize() == (int) live.size());
+    if (step % 25 == 0)
+    {
+      const double radii[4] = { 0, cellSize / 2, cellSize, 3.5 * cellSize };
+      Point q = pick();
+      pass = pass && checkNeighbours(hash, brute, q, radii[step / 25 % 4]);
+      if (!live.empty())
+      {
+        int id = live[step % live.size()];
+        vector<int> found;
+        set<int> expected = brute.within(brute.points[id], cellSize);
+        expected.erase(id);
+        hash.neighboursOf(id, cellSize, found);
+        pass = pass && (set<int>(found.begin(), found.end()) == expected) &&
+               (found.size() == expected.size());
+      }
+    }
+  }
+
+  for (size_t i = 0; i < brute.points.size(); i++)
+    pass = pass && (hash.contains((int) i) == brute.used[i]) &&
+           (!brute.used[i] || hash.getPoint((int) i).getX() ==
+                              brute.points[i].getX());
+  return pass;
+}
+
+
+/**
+ * Inserts, removes, moves and neighbour queries on a spatial hash,
+ * compared with a brute-force list of points.
+ **/
+void spatialHash(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Spatial hash ---");
+
+  ec.DESC("empty hash, and ids after clear()");
+  {
+    SpatialHash hash(2);
+    vector<int> found;
+
+    pass = (hash.getSize() == 0) && (hash.getCellSize() == 2) &&
+           !hash.contains(0) && !hash.contains(-1) &&
+           (hash.neighbours(Point(), 100, found) == 0);
+
+    int a = hash.insert(Point(1, 1, 1)), b = hash.insert(Point(1, 1, 1));
+    hash.clear();
+    pass = pass && (a == 0) && (b == 1) && (hash.getSize() == 0) &&
+           !hash.contains(0) && (hash.insert(Point(5, 5, 5)) == 0) &&
+           (hash.neighbours(Point(1, 1, 1), 1, found) == 0);
+    ec.result(pass);
+  }
+
+  ec.DESC("random inserts, removes and moves");
+  {
+    pass = randomHashSequence(1.0, 3000, []() { return randomPoint(8); });
+    ec.result(pass);
+  }
+
+  ec.DESC("many points in few cells, and exact-radius ties");
+  {
+    pass = randomHashSequence(2.0, 3000, []() {
+      return latticeCloud(1, 5)[0];
+    });
+    ec.result(pass);
+  }
+
+  ec.DESC("cells around +-2^20, where the cell keys wrap");
+  {
+    // With unit cells, cell 2^20 and cell -2^20 have the same key.
+    const double Edge = 1 << 20;
+    pass = randomHashSequence(1.0, 3000, [Edge]() {
+      double side = (rng() % 2 == 0 ? Edge : -Edge);
+      int x = (int) (rng() % 3);
+      return Point(side + randomCoord(3), x * Edge - Edge + randomCoord(2),
+                   randomCoord(2));
+    });
+    ec.result(pass);
+  }
+
+  ec.DESC("queries covering more cells than are in use");
+  {
+    SpatialHash hash(0.5);
+    BruteSet brute;
+    for (int i = 0; i < 200; i++)
+    {
+      brute.points.push_back(randomPoint(50));
+      brute.used.push_back(true);
+      hash.insert(brute.points.back());
+    }
+    for (int i = 0; i < 50; i += 2)
+    {
+      hash.remove(i);
+      brute.used[i] = false;
+    }
+    hash.removeEmptyCells();
+
+    pass = checkNeighbours(hash, brute, Point(), 40) &&
+           checkNeighbours(hash, brute, randomPoint(50), 1e7) &&
+           checkNeighbours(hash, brute, Point(1e9, 0, 0), 1e9);
+    ec.result(pass);
+  }
+}
+
+
+// Writes bytes to a new temporary file, and returns its name.
+static string writeTempFile(const vector<unsigned char> &bytes)
+{
+  char name[] = "/tmp/checkgeomXXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0)
+    return "";
+  size_t done = 0;
+  while (done < bytes.size())
+  {
+    ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+    if (n <= 0)
+      break;
+    done += (size_t) n;
+  }
+  close(fd);
+  return name;
+}
+
+// Appends the raw bytes of a value to a file image.
+template <typename T>
+static void appendBytes(vector<unsigned char> &bytes, T value)
+{
+  unsigned char raw[sizeof(T)];
+  memcpy(raw, &value, sizeof(T));
+  bytes.insert(bytes.end(), raw, raw + sizeof(T));
+}
+
+// Reads every batch of the file, checking that the batches are contiguous
+// and no larger than asked, and returns the points.
+static bool readAll(PointFile &file, long batchPoints, vector<Point> &points)
+{
+  PointBatch batch;
+  bool pass = true;
+  points.clear();
+  while (file.next(batch))
+  {
+    pass = pass && (batch.first == (long) points.size()) &&
+           (batch.count > 0) &&
+           (batch.count <= max(batchPoints, (long) 3));
+    points.insert(points.end(), batch.points, batch.points + batch.count);
+  }
+  return pass && (file.getNumPoints() == (long) points.size()) &&
+         !file.next(batch);
+}
+
+static bool samePoints(const vector<Point> &a, const vector<Point> &b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++)
+    if (a[i].getX() != b[i].getX() || a[i].getY() != b[i].getY() ||
+        a[i].getZ() != b[i].getZ())
+      return false;
+  return true;
+}
+
+
+/**
+ * Reads point and STL files written to temporary files, in batches of many
+ * sizes, so that the mapped windows start and end at many offsets within a
+ * page.
+ **/
+void pointFiles(ErrorContext &ec)
+{
+  bool pass;
+
+  // Batch sizes around the number of records in a page, so that windows
+  // end just before, on and just after page boundaries, and one larger
+  // than any file.
+  const long BatchSizes[9] = { 1, 7, 81, 82, 170, 171, 341, 342, 1 << 20 };
+
+  ec.DESC("--- Binary point files ---");
+
+  ec.DESC("raw doubles, every batch size");
+  {
+    vector<Point> expected, read;
+    vector<unsigned char> bytes;
+    for (int i = 0; i < 3000; i++)
+    {
+      expected.push_back(randomPoint(1e6));
+      appendBytes(bytes, expected.back().getX());
+      appendBytes(bytes, expected.back().getY());
+      appendBytes(bytes, expected.back().getZ());
+    }
+    bytes.push_back(1);    // a partial record at the end is ignored
+    string name = writeTempFile(bytes);
+
+    pass = !name.empty();
+    for (int b = 0; b < 9 && pass; b++)
+    {
+      PointFile file(name.c_str(), RawDoubleXYZ, BatchSizes[b]);
+      pass = (file.getFormat() == RawDoubleXYZ) &&
+             readAll(file, BatchSizes[b], read) && samePoints(read, expected);
+
+      // Read it again after stopping part-way through.
+      PointBatch batch;
+      file.rewind();
+      file.next(batch);
+      file.rewind();
+      pass = pass && readAll(file, BatchSizes[b], read) &&
+             samePoints(read, expected);
+    }
+    unlink(name.c_str());
+    ec.result(pass);
+  }
+
+  ec.DESC("raw floats, every batch size");
+  {
+    vector<Point> expected, read;
+    vector<unsigned char> bytes;
+    for (int i = 0; i < 2501; i++)
+    {
+      float x = (float) randomCoord(1e3), y = (float) randomCoord(1e3);
+      float z = (float) randomCoord(1e3);
+      expected.push_back(Point(x, y, z));
+      appendBytes(bytes, x);
+      appendBytes(bytes, y);
+      appendBytes(bytes, z);
+    }
+    string name = writeTempFile(bytes);
+
+    pass = !name.empty();
+    for (int b = 0; b < 9 && pass; b++)
+    {
+      PointFile file(name.c_str(), RawFloatXYZ, BatchSizes[b]);
+      pass = readAll(file, BatchSizes[b], read) && samePoints(read, expected);
+    }
+    unlink(name.c_str());
+    ec.result(pass);
+  }
+
+  ec.DESC("binary STL, every batch size, and its surface area");
+  {
+    // A 50-byte record doesn't divide a page, so many triangles straddle
+    // two pages; batches of under 3 points still get a whole triangle.
+    vector<Point> expected, read;
+    vector<unsigned char> bytes(80, 'x');
+    const int NumTriangles = 700;
+    appendBytes(bytes, (unsigned int) NumTriangles);
+    for (int t = 0; t < NumTriangles; t++)
+    {
+      for (int i = 0; i < 3; i++)
+        appendBytes(bytes, 0.0f);    // the normal, which is ignored
+      for (int c = 0; c < 3; c++)
+      {
+        float x = (float) randomCoord(10), y = (float) randomCoord(10);
+        float z = (float) randomCoord(10);
+        expected.push_back(Point(x, y, z));
+        appendBytes(bytes, x);
+        appendBytes(bytes, y);
+        appendBytes(bytes, z);
+      }
+      appendBytes(bytes, (unsigned short) 0);
+    }
+    string name = writeTempFile(bytes);
+
+    pass = !name.empty();
+    for (int b = 0; b < 9 && pass; b++)
+    {
+      PointFile file(name.c_str(), BinarySTL, BatchSizes[b]);
+      pass = readAll(file, BatchSizes[b], read) && samePoints(read, expected);
+    }
+
+    // Summing the areas batch by batch gives the area of the whole soup.
+    PointFile file(name.c_str(), BinarySTL, 100);
+    PointBatch batch;
+    double area = 0;
+    while (file.next(batch))
+      area += computeSurfaceArea(TriangleMesh(batch.points,
+                                              (int) batch.count / 3));
+    TriangleMesh whole(expected.data(), NumTriangles);
+    pass = pass && near(area, computeSurfaceArea(whole), 1e-12);
+    unlink(name.c_str());
+    ec.result(pass);
+  }
+
+  ec.DESC("STL triangle count that disagrees with the file size");
+  {
+    vector<unsigned char> bytes(80, 0);
+    appendBytes(bytes, (unsigned int) 1000);   // but only 5 are there
+    bytes.resize(84 + 5 * 50 + 20, 0);
+    string truncated = writeTempFile(bytes);
+
+    memset(&bytes[80], 0, 4);
+    bytes[80] = 3;                             // and only 3 of 5 counted
+    string counted = writeTempFile(bytes);
+
+    vector<Point> read;
+    PointFile a(truncated.c_str(), BinarySTL, 4), b(counted.c_str(), BinarySTL);
+    pass = readAll(a, 4, read) && (read.size() == 15) &&
+           readAll(b, 1 << 20, read) && (read.size() == 9);
+    unlink(truncated.c_str());
+    unlink(counted.c_str());
+    ec.result(pass);
+  }
+
+  ec.DESC("empty, missing and too-short files");
+  {
+    string empty = writeTempFile(vector<unsigned char>());
+    string shortStl = writeTempFile(vector<unsigned char>(83, 0));
+    PointBatch batch;
+
+    PointFile file(empty.c_str(), RawDoubleXYZ);
+    pass = (file.getNumPoints() == 0) && !file.next(batch);
+
+    bool threw = false;
+    try
+    {
+      PointFile missing("/nonexistent/points.xyz", RawFloatXYZ);
+    }
+    catch (runtime_error &)
+    {
+      threw = true;
+    }
+    pass = pass && threw;
+
+    threw = false;
+    try
+    {
+      PointFile stl(shortStl.c_str(), BinarySTL);
+    }
+    catch (runtime_error &)
+    {
+      threw = true;
+    }
+    pass = pass && threw;
+
+    unlink(empty.c_str());
+    unlink(shortStl.c_str());
+    ec.result(pass);
+  }
+}
+
+
+// True if perm holds each of 0 .. n-1 exactly once.
+static bool isPermutation(const vector<int> &perm, int n)
+{
+  vector<bool> seen(n, false);
+  if ((int) perm.size() != n)
+    return false;
+  for (int i = 0; i < n; i++)
+  {
+    if (perm[i] < 0 || perm[i] >= n || seen[perm[i]])
+      return false;
+    seen[perm[i]] = true;
+  }
+  return true;
+}
+
+// True if the cells, taken in order, each differ from the one before in
+// one coordinate by step (or not at all, for repeated cells).
+static bool cellsAdjacent(const vector<unsigned int> &cells, unsigned int step)
+{
+  for (size_t i = 3; i < cells.size(); i += 3)
+  {
+    unsigned int moved = 0;
+    for (int a = 0; a < 3; a++)
+    {
+      unsigned int d = (cells[i + a] > cells[i - 3 + a] ?
+                        cells[i + a] - cells[i - 3 + a] :
+                        cells[i - 3 + a] - cells[i + a]);
+      if (d != 0 && d != step)
+        return false;
+      moved += d;
+    }
+    if (moved > step)
+      return false;
+  }
+  return true;
+}
+
+// Sorts the cells of a side^3 grid, each scaled by step, into Hilbert order
+// and checks that they follow each other without gaps or jumps.
+static bool hilbertGridAdjacent(unsigned int side, unsigned int step)
+{
+  vector<unsigned long long> keys;
+  vector<int> order;
+  for (unsigned int x = 0; x < side; x++)
+    for (unsigned int y = 0; y < side; y++)
+      for (unsigned int z = 0; z < side; z++)
+      {
+        keys.push_back(hilbertKey(x * step, y * step, z * step) /
+                       ((unsigned long long) step * step * step));
+        order.push_back((int) order.size());
+      }
+  sortByKey(keys, order);
+
+  vector<unsigned int> cells;
+  bool pass = true;
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    pass = pass && (keys[i] == i);    // the first side^3 keys, in turn
+    cells.push_back(order[i] / (side * side) * step);
+    cells.push_back(order[i] / side % side * step);
+    cells.push_back(order[i] % side * step);
+  }
+  return pass && cellsAdjacent(cells, step);
+}
+
+
+/**
+ * Curve keys, the radix sort, and the orders that they give.
+ **/
+void spatialSorting(ErrorContext &ec)
+{
+  bool pass;
+  const unsigned int MaxCell = (1u << 21) - 1;
+
+  ec.DESC("--- Spatial sorting ---");
+
+  ec.DESC("Morton keys interleave the coordinate bits");
+  {
+    pass = (mortonKey(0, 0, 0) == 0) && (mortonKey(1, 0, 0) == 1) &&
+           (mortonKey(0, 1, 0) == 2) && (mortonKey(0, 0, 1) == 4) &&
+           (mortonKey(3, 0, 5) == 0x10D) &&
+           (mortonKey(MaxCell, MaxCell, MaxCell) == (1ULL << 63) - 1);
+    ec.result(pass);
+  }
+
+  ec.DESC("consecutive Hilbert cells are adjacent, on full grids");
+  {
+    // A 16^3 grid at the origin is the start of the curve; grids of
+    // 2^k-sized blocks check the high bits of the keys.
+    pass = hilbertGridAdjacent(16, 1) && hilbertGridAdjacent(2, 1) &&
+           hilbertGridAdjacent(8, 1 << 18) && hilbertGridAdjacent(16, 1 << 17);
+    ec.result(pass);
+  }
+
+  ec.DESC("radix sort by key, stable, against std::stable_sort");
+  {
+    const int Sizes[4] = { 0, 1, 1000, 70000 };
+    pass = true;
+    for (int s = 0; s < 4; s++)
+    {
+      vector<unsigned long long> keys;
+      vector<int> values;
+      vector<pair<unsigned long long, int> > expected;
+      for (int i = 0; i < Sizes[s]; i++)
+      {
+        // Few distinct keys, spread over all 64 bits, so that there are
+        // many ties and some radix passes can be skipped.
+        unsigned long long key = (rng() % 50) * 0x0123456789ABCDEFULL;
+        if (i % 3 == 0)
+          key = (key >> 40) << 40;
+        keys.push_back(key);
+        values.push_back(i);
+        expected.push_back(make_pair(key, i));
+      }
+      stable_sort(expected.begin(), expected.end(),
+        [](const pair<unsigned long long, int> &a,
+           const pair<unsigned long long, int> &b) {
+          return a.first < b.first;
+        });
+      sortByKey(keys, values);
+
+      for (int i = 0; i < Sizes[s]; i++)
+        pass = pass && (keys[i] == expected[i].first) &&
+               (values[i] == expected[i].second);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("sort order is a permutation with non-decreasing keys");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 20000; i++)
+      points.push_back(i % 4 == 3 ? points[i / 2] : randomPoint(1000));
+
+    pass = true;
+    for (int c = 0; c < 2; c++)
+    {
+      SpaceFillingCurve curve = (c == 0 ? MortonCurve : HilbertCurve);
+      vector<unsigned long long> keys(points.size());
+      vector<int> perm;
+      computeCurveKeys(points.data(), (int) points.size(), curve, keys.data());
+      spatialSortOrder(points.data(), (int) points.size(), curve, perm);
+
+      pass = pass && isPermutation(perm, (int) points.size());
+      for (size_t i = 1; i < perm.size() && pass; i++)
+        pass = (keys[perm[i - 1]] < keys[perm[i]]) ||
+               (keys[perm[i - 1]] == keys[perm[i]] && perm[i - 1] < perm[i]);
+    }
+
+    vector<int> perm(1, 7);
+    spatialSortOrder(points.data(), 0, HilbertCurve, perm);
+    pass = pass && perm.empty();
+    ec.result(pass);
+  }
+
+  ec.DESC("Hilbert order of a full grid of points");
+  {
+    // With a corner at 2^21 - 1 the grid cells are exactly the points'
+    // coordinates, so the 16^3 grid at the origin comes first, in adjacent
+    // steps, and the corner last.
+    vector<Point> points;
+    for (int i = 0; i < 4096; i++)
+      points.push_back(Point(i % 16, i / 16 % 16, i / 256));
+    points.push_back(Point(MaxCell, MaxCell, MaxCell));
+    vector<Point> sorted(points);
+    vector<int> perm;
+    spatialSort(sorted, HilbertCurve, perm);
+
+    vector<unsigned int> cells;
+    for (int i = 0; i < 4096; i++)
+    {
+      cells.push_back((unsigned int) sorted[i].getX());
+      cells.push_back((unsigned int) sorted[i].getY());
+      cells.push_back((unsigned int) sorted[i].getZ());
+    }
+    pass = isPermutation(perm, 4097) && (perm[0] == 0) &&
+           (perm[4096] == 4096) && cellsAdjacent(cells, 1);
+    for (int i = 0; i < 4097; i++)
+      pass = pass && (sorted[i].getX() == points[perm[i]].getX());
+    ec.result(pass);
+  }
+
+  ec.DESC("reordering per-point data and mesh indices");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 500; i++)
+      points.push_back(randomPoint(10));
+    vector<int> indices, ids;
+    for (int i = 0; i < 900; i++)
+      indices.push_back((int) (rng() % 500));
+    for (int i = 0; i < 500; i++)
+      ids.push_back(i);
+
+    vector<Point> sorted(points);
+    vector<int> perm, remapped(indices);
+    spatialSort(sorted, MortonCurve, perm);
+    applyPermutation(perm, ids);
+    remapIndices(perm, remapped.data(), (long) remapped.size());
+
+    pass = (ids == perm);
+    for (int i = 0; i < 900; i++)
+      pass = pass &&
+             (sorted[remapped[i]].getY() == points[indices[i]].getY());
+    ec.result(pass);
+  }
+}
+
+
+// The corners of triangle t of a mesh.
+static void triangleCorners(const TriangleMesh &mesh, int t, Point *corners)
+{
+  for (int k = 0; k < 3; k++)
+    corners[k] = (mesh.indices != 0 ? mesh.vertices[mesh.indices[3 * t + k]]
+                                    : mesh.vertices[3 * t + k]);
+}
+
+// Brute-force ray/triangle test, by solving for the plane hit and then
+// checking the barycentric coordinates.  Returns the ray parameter of the
+// hit, or infinity if the ray misses.
+static double bruteRayTriangle(const Ray &ray, const Point *c)
+{
+  long double o[3] = { ray.origin.getX(), ray.origin.getY(),
+                       ray.origin.getZ() };
+  long double d[3] = { ray.direction.getX(), ray.direction.getY(),
+                       ray.direction.getZ() };
+  long double v[3][3] = {
+    { c[0].getX(), c[0].getY(), c[0].getZ() },
+    { c[1].getX(), c[1].getY(), c[1].getZ() },
+    { c[2].getX(), c[2].getY(), c[2].getZ() }
+  };
+  long double e1[3], e2[3], s[3];
+  for (int a = 0; a < 3; a++)
+  {
+    e1[a] = v[1][a] - v[0][a];
+    e2[a] = v[2][a] - v[0][a];
+    s[a] = o[a] - v[0][a];
+  }
+
+  // Cramer's rule on s = -t d + u e1 + v e2.
+  long double n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                       e1[2] * e2[0] - e1[0] * e2[2],
+                       e1[0] * e2[1] - e1[1] * e2[0] };
+  long double det = -(d[0] * n[0] + d[1] * n[1] + d[2] * n[2]);
+  if (det == 0)
+    return INFINITY;
+  long double t = (s[0] * n[0] + s[1] * n[1] + s[2] * n[2]) / det;
+  long double m[3] = { s[1] * d[2] - s[2] * d[1], s[2] * d[0] - s[0] * d[2],
+                       s[0] * d[1] - s[1] * d[0] };
+  long double u = (e2[0] * m[0] + e2[1] * m[1] + e2[2] * m[2]) / det;
+  long double w = -(e1[0] * m[0] + e1[1] * m[1] + e1[2] * m[2]) / det;
+
+  const long double Slack = 1e-12L;
+  if (u < -Slack || w < -Slack || u + w > 1 + Slack ||
+      t < ray.tMin - Slack || t > ray.tMax + Slack)
+    return INFINITY;
+  return (double) t;
+}
+
+// Closest point to q on the segment from a to b.
+static Point closestOnSegment(const Point &q, const Point &a, const Point &b)
+{
+  double ab[3] = { b.getX() - a.getX(), b.getY() - a.getY(),
+                   b.getZ() - a.getZ() };
+  double aq[3] = { q.getX() - a.getX(), q.getY() - a.getY(),
+                   q.getZ() - a.getZ() };
+  double len2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+  double t = (len2 > 0 ? (aq[0] * ab[0] + aq[1] * ab[1] + aq[2] * ab[2]) / len2
+                       : 0);
+  t = max(0.0, min(1.0, t));
+  return Point(a.getX() + t * ab[0], a.getY() + t * ab[1],
+               a.getZ() + t * ab[2]);
+}
+
+// Brute-force distance from q to a triangle:  to its plane, if q projects
+// inside it, and otherwise to the nearest of its edges.
+static double bruteTriangleDistance(const Point &q, const Point *c)
+{
+  double best = INFINITY;
+  for (int k = 0; k < 3; k++)
+    best = min(best, q.distanceTo(closestOnSegment(q, c[k], c[(k + 1) % 3])));
+
+  double e1[3] = { c[1].getX() - c[0].getX(), c[1].getY() - c[0].getY(),
+                   c[1].getZ() - c[0].getZ() };
+  double e2[3] = { c[2].getX() - c[0].getX(), c[2].getY() - c[0].getY(),
+                   c[2].getZ() - c[0].getZ() };
+  double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0] };
+  double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  if (len == 0)
+    return best;
+
+  double s[3] = { q.getX() - c[0].getX(), q.getY() - c[0].getY(),
+                  q.getZ() - c[0].getZ() };
+  double h = (s[0] * n[0] + s[1] * n[1] + s[2] * n[2]) / len;
+  Point p(q.getX() - h * n[0] / len, q.getY() - h * n[1] / len,
+          q.getZ() - h * n[2] / len);
+
+  // p is inside if it is on the inner side of all three edges.
+  bool inside = true;
+  for (int k = 0; k < 3; k++)
+  {
+    const Point &a = c[k], &b = c[(k + 1) % 3];
+    double ab[3] = { b.getX() - a.getX(), b.getY() - a.getY(),
+                     b.getZ() - a.getZ() };
+    double ap[3] = { p.getX() - a.getX(), p.getY() - a.getY(),
+                     p.getZ() - a.getZ() };
+    double x[3] = { ab[1] * ap[2] - ab[2] * ap[1],
+                    ab[2] * ap[0] - ab[0] * ap[2],
+                    ab[0] * ap[1] - ab[1] * ap[0] };
+    inside = inside && (x[0] * n[0] + x[1] * n[1] + x[2] * n[2] >= 0);
+  }
+  return (inside ? min(best, fabs(h)) : best);
+}
+
+// True if the hierarchy finds the same nearest hit as testing every
+// triangle.
+static bool checkRay(const Bvh &bvh, const TriangleMesh &mesh, const Ray &ray)
+{
+  double best = INFINITY;
+  Point c[3];
+  for (int t = 0; t < mesh.numTriangles; t++)
+  {
+    triangleCorners(mesh, t, c);
+    best = min(best, bruteRayTriangle(ray, c));
+  }
+
+  RayHit hit;
+  bool found = bvh.intersect(ray, hit);
+  if (!found)
+    return std::isinf(best) && (hit.triangle == -1);
+  if (hit.triangle < 0 || hit.triangle >= mesh.numTriangles ||
+      !near(hit.t, best, 1e-9))
+    return false;
+
+  // The hit is on the triangle reported, where the coordinates say.
+  triangleCorners(mesh, hit.triangle, c);
+  double w = 1 - hit.u - hit.v;
+  double at[3] = {
+    ray.origin.getX() + hit.t * ray.direction.getX(),
+    ray.origin.getY() + hit.t * ray.direction.getY(),
+    ray.origin.getZ() + hit.t * ray.direction.getZ()
+  };
+  double bary[3] = {
+    w * c[0].getX() + hit.u * c[1].getX() + hit.v * c[2].getX(),
+    w * c[0].getY() + hit.u * c[1].getY() + hit.v * c[2].getY(),
+    w * c[0].getZ() + hit.u * c[1].getZ() + hit.v * c[2].getZ()
+  };
+  return near(bruteRayTriangle(ray, c), hit.t, 1e-9) &&
+         near(at[0], bary[0], 1e-9) && near(at[1], bary[1], 1e-9) &&
+         near(at[2], bary[2], 1e-9);
+}
+
+// True if the hierarchy finds a closest point as close as the nearest
+// triangle found by brute force, and that point is on its triangle.
+static bool checkClosest(const Bvh &bvh, const TriangleMesh &mesh,
+                         const Point &q, double maxDistance)
+{
+  double best = INFINITY;
+  Point c[3];
+  for (int t = 0; t < mesh.numTriangles; t++)
+  {
+    triangleCorners(mesh, t, c);
+    best = min(best, bruteTriangleDistance(q, c));
+  }
+
+  ClosestHit hit;
+  bool found = bvh.closestPoint(q, hit, maxDistance);
+  if (!found)
+    return (best > maxDistance * (1 - 1e-12)) && (hit.triangle == -1);
+
+  triangleCorners(mesh, hit.triangle, c);
+  return near(hit.distance, best, 1e-9) &&
+         near(q.distanceTo(hit.point), hit.distance, 1e-9) &&
+         near(bruteTriangleDistance(hit.point, c), 0, 1e-9);
+}
+
+// Appends the 12 triangles of an axis-aligned box to a triangle soup.
+static void addBox(vector<Point> &corners, const Point &lo, const Point &hi)
+{
+  double x[2] = { lo.getX(), hi.getX() }, y[2] = { lo.getY(), hi.getY() };
+  double z[2] = { lo.getZ(), hi.getZ() };
+  const int Faces[12][3] = {
+    { 0, 2, 3 }, { 0, 3, 1 }, { 4, 5, 7 }, { 4, 7, 6 },   // x = lo, hi
+    { 0, 1, 5 }, { 0, 5, 4 }, { 2, 6, 7 }, { 2, 7, 3 },   // y = lo, hi
+    { 0, 4, 6 }, { 0, 6, 2 }, { 1, 3, 7 }, { 1, 7, 5 }    // z = lo, hi
+  };
+  for (int f = 0; f < 12; f++)
+    for (int k = 0; k < 3; k++)
+    {
+      int v = Faces[f][k];    // bit 2 picks x, bit 1 y, bit 0 z
+      corners.push_back(Point(x[v >> 2], y[(v >> 1) & 1], z[v & 1]));
+    }
+}
+
+
+/**
+ * Ray and closest-point queries on a bounding volume hierarchy, compared
+ * with testing every triangle.
+ **/
+void boundingVolumes(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Bounding volume hierarchy ---");
+
+  // Random triangles of all sizes, as an indexed mesh.
+  vector<Point> vertices;
+  vector<int> indices;
+  for (int i = 0; i < 1500; i++)
+    vertices.push_back(randomPoint(50));
+  for (int t = 0; t < 2000; t++)
+  {
+    int a = (int) (rng() % 1500);
+    indices.push_back(a);
+    for (int k = 0; k < 2; k++)
+      indices.push_back(t % 10 == 0 ? (int) (rng() % 1500)
+                                    : (a + 1 + (int) (rng() % 40)) % 1500);
+  }
+  for (int i = 0; i < 1500; i++)     // pull each triangle's corners together
+    vertices[i] = Point(vertices[i].getX() * 0.2 + (i % 40),
+                        vertices[i].getY() * 0.2 - (i % 7),
+                        vertices[i].getZ() * 0.2 + (i % 13));
+  TriangleMesh mesh(vertices.data(), 1500, indices.data(), 2000);
+
+  ec.DESC("empty hierarchy");
+  {
+    TriangleMesh empty(vertices.data(), 0);
+    Bvh bvh(empty);
+    RayHit hit;
+    ClosestHit closest;
+
+    pass = (bvh.getNumTriangles() == 0) &&
+           !bvh.intersect(Ray(Point(), Point(1, 0, 0)), hit) &&
+           (hit.triangle == -1) &&
+           !bvh.closestPoint(Point(), closest) && (closest.triangle == -1);
+    ec.result(pass);
+  }
+
+  ec.DESC("random rays, against every triangle");
+  {
+    Bvh bvh(mesh);
+    pass = (bvh.getNumTriangles() == 2000) && (bvh.getNumNodes() > 1);
+    for (int i = 0; i < 500; i++)
+    {
+      Point origin = randomPoint(80), target = randomPoint(30);
+      Point dir(target.getX() - origin.getX(), target.getY() - origin.getY(),
+                target.getZ() - origin.getZ());
+      double tMin = (i % 3 == 0 ? 0.3 : 0), tMax = (i % 5 == 0 ? 0.8 : 1e300);
+      pass = pass && checkRay(bvh, mesh, Ray(origin, dir, tMin, tMax));
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("axis-parallel rays starting on box planes");
+  {
+    // Boxes on a grid, hit by rays along each axis (and with -0.0 or 0.0
+    // in the other components) whose origins lie exactly on box faces.
+    vector<Point> corners;
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+        for (int k = 0; k < 4; k++)
+          addBox(corners, Point(3 * i, 3 * j, 3 * k),
+                 Point(3 * i + 1 + k % 2, 3 * j + 2, 3 * k + 1));
+    TriangleMesh boxes(corners.data(), (int) corners.size() / 3);
+    Bvh bvh(boxes);
+
+    pass = true;
+    const double Zeros[2] = { 0.0, -0.0 };
+    for (int i = 0; i < 2000; i++)
+    {
+      int axis = i % 3;
+      double sign = (i / 3 % 2 == 0 ? 1 : -1);
+      double o[3], d[3];
+      for (int a = 0; a < 3; a++)
+      {
+        o[a] = (double) (rng() % 14) - 1;
+        d[a] = Zeros[rng() % 2];
+      }
+      o[axis] = (sign > 0 ? -2.0 : 14.0);
+      d[axis] = sign;
+      pass = pass && checkRay(bvh, boxes, Ray(Point(o[0], o[1], o[2]),
+                                              Point(d[0], d[1], d[2])));
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("closest points, against every triangle");
+  {
+    Bvh bvh(mesh);
+    pass = true;
+    for (int i = 0; i < 300; i++)
+    {
+      Point q = (i % 4 == 0 ? vertices[i] : randomPoint(60));
+      pass = pass && checkClosest(bvh, mesh, q, 1e300) &&
+             checkClosest(bvh, mesh, q, 2.0);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("batch queries match single queries");
+  {
+    Bvh bvh(mesh);
+    vector<Ray> rays;
+    vector<Point> queries;
+    for (int i = 0; i < 2500; i++)
+    {
+      rays.push_back(Ray(randomPoint(60), randomPoint(1)));
+      queries.push_back(randomPoint(60));
+    }
+    vector<RayHit> hits(rays.size());
+    vector<ClosestHit> closest(queries.size());
+    bvh.intersectBatch(rays.data(), (int) rays.size(), hits.data());
+    bvh.closestPointBatch(queries.data(), (int) queries.size(),
+                          closest.data(), 5.0);
+
+    pass = true;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+      RayHit hit;
+      ClosestHit c;
+      bvh.intersect(rays[i], hit);
+      bvh.closestPoint(queries[i], c, 5.0);
+      pass = pass && (hit.triangle == hits[i].triangle) &&
+             (hit.triangle < 0 || hit.t == hits[i].t) &&
+             (c.triangle == closest[i].triangle) &&
+             (c.triangle < 0 || c.distance == closest[i].distance);
+    }
+    ec.result(pass);
+  }
+}
+
+
+// geom::Point is checked at compile time:  these fail the build, rather
+// than a test, if construction or arithmetic stops being constexpr.
+namespace geomChecks {
+
+using geom::Point2f;
+using geom::Point2d;
+using geom::Point3f;
+using geom::Point3d;
+
+constexpr Point2f A2f(1.5f, -2.0f), B2f(0.5f, 2.0f);
+constexpr Point2d A2d(3.0, 4.0), B2d(-1.0, 0.5);
+constexpr Point3f A3f(1.0f, 2.0f, 3.0f), B3f(-4.0f, 0.5f, 2.0f);
+constexpr Point3d A3d(1.0, 2.0, 2.0), B3d(4.0, 6.0, 14.0);
+
+static_assert(A2f.getX() == 1.5f && A2f[1] == -2.0f, "2D float coordinates");
+static_assert(A3d.getZ() == 2.0 && A3d[0] == 1.0, "3D double coordinates");
+static_assert(Point3d{} == Point3d(0.0, 0.0, 0.0), "value-initialised origin");
+static_assert(Point2d(Point2f(0.25f, 8.0f)) == Point2d(0.25, 8.0),
+              "float to double conversion");
+
+static_assert(A2f + B2f == Point2f(2.0f, 0.0f), "2D float addition");
+static_assert(A2d - B2d == Point2d(4.0, 3.5), "2D double subtraction");
+static_assert(A3f * 2.0f == Point3f(2.0f, 4.0f, 6.0f) &&
+              2.0f * A3f == A3f + A3f, "3D float scaling");
+static_assert(B3d / 2.0 == Point3d(2.0, 3.0, 7.0) &&
+              -A3d == Point3d(-1.0, -2.0, -2.0),
+              "3D double division and negation");
+static_assert(A3d != B3d && !(A3d != A3d), "inequality");
+
+static_assert(A2d.dot(B2d) == -1.0 && A3f.dot(B3f) == 3.0f, "dot products");
+static_assert(A2d.squaredLength() == 25.0 && A3d.squaredLength() == 9.0,
+              "squared lengths");
+static_assert(A2f.squaredDistanceTo(B2f) == 17.0f &&
+              A3d.squaredDistanceTo(B3d) == 169.0, "squared distances");
+static_assert(geom::cross(Point3d(1.0, 0.0, 0.0), Point3d(0.0, 1.0, 0.0)) ==
+              Point3d(0.0, 0.0, 1.0) &&
+              geom::cross(A3f, A3f) == Point3f(0.0f, 0.0f, 0.0f),
+              "cross products");
+
+}  // namespace geomChecks
+
+
+/**
+ * The parts of geom::Point that can't be checked at compile time:
+ * lengths and distances (which use sqrt), and conversions from ::Point.
+ **/
+void geomPoints(ErrorContext &ec)
+{
+  bool pass;
+  using namespace geomChecks;
+
+  ec.DESC("--- Templated points ---");
+
+  ec.DESC("lengths and distances, 2D and 3D, float and double");
+  {
+    pass = (A2d.length() == 5.0) && (A3d.length() == 3.0) &&
+           (A3d.distanceTo(B3d) == 13.0) &&
+           (Point2f(3.0f, 4.0f).length() == 5.0f) &&
+           (Point3f(1.0f, 1.0f, 1.0f).distanceTo(Point3f(3.0f, 2.0f, 3.0f)) ==
+            3.0f);
+    ec.result(pass);
+  }
+
+  ec.DESC("conversions to and from Point");
+  {
+    Point p(1.5, -2.5, 1e100);
+    Point3d g = geom::fromPoint(p);
+    Point q = geom::toPoint(g * 2.0);
+
+    pass = (g[0] == 1.5) && (g[1] == -2.5) && (g[2] == 1e100) &&
+           (q.getX() == 3.0) && (q.getY() == -5.0) && (q.getZ() == 2e100) &&
+           near(g.distanceTo(geom::fromPoint(Point(0, 0, 1e100))),
+                p.distanceTo(Point(0, 0, 1e100)), 1e-15);
+    ec.result(pass);
+  }
+}
+
+
+// All pairs of points no more than epsilon apart, found by brute force
+// (sweeping along x, so that large inputs don't take too long).
+static set<pair<int, int> > bruteCloseBy(const vector<Point> &points,
+                                         double epsilon)
+{
+  vector<int> byX;
+  for (size_t i = 0; i < points.size(); i++)
+    byX.push_back((int) i);
+  sort(byX.begin(), byX.end(), [&points](int a, int b) {
+    return points[a].getX() < points[b].getX();
+  });
+
+  set<pair<int, int> > result;
+  for (size_t a = 0; a < byX.size(); a++)
+    for (size_t b = a + 1; b < byX.size(); b++)
+    {
+      const Point &p = points[byX[a]], &q = points[byX[b]];
+      double dx = p.getX() - q.getX();
+      double dy = p.getY() - q.getY();
+      double dz = p.getZ() - q.getZ();
+      if (-dx > epsilon)
+        break;
+      if (dx * dx + dy * dy + dz * dz <= epsilon * epsilon)
+        result.insert(make_pair(min(byX[a], byX[b]), max(byX[a], byX[b])));
+    }
+  return result;
+}
+
+// True if the join finds exactly the brute-force pairs, each once, with
+// a buffer of the given size (or of exactly the right size, if capacity is
+// negative).  With a smaller buffer, what was written must be a subset.
+static bool checkCloseBy(const vector<Point> &points, double epsilon,
+                         long capacity)
+{
+  set<pair<int, int> > expected = bruteCloseBy(points, epsilon);
+  if (capacity < 0)
+    capacity = (long) expected.size();
+
+  vector<PointPair> pairs(capacity + 1);
+  pairs[capacity].first = -7;         // must not be written
+  long count = pairsWithinDistance(points.data(), (int) points.size(),
+                                   epsilon, pairs.data(), capacity);
+  if (count != (long) expected.size() || pairs[capacity].first != -7)
+    return false;
+
+  set<pair<int, int> > found;
+  long written = min(count, capacity);
+  for (long k = 0; k < written; k++)
+  {
+    pair<int, int> p(pairs[k].first, pairs[k].second);
+    if (p.first >= p.second || !found.insert(p).second || !expected.count(p))
+      return false;
+  }
+  return (long) found.size() == written;
+}
+
+
+/**
+ * The closest pair and the epsilon join, compared with checking every
+ * pair of points.
+ **/
+void closePairs(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Closest pairs and epsilon joins ---");
+
+  ec.DESC("fewer than two points");
+  {
+    Point one(1, 2, 3);
+    PointPair pair;
+    PointPair unused[1];
+
+    pass = !closestPair(&one, 0, pair) && !closestPair(&one, 1, pair) &&
+           (pairsWithinDistance(&one, 1, 10, unused, 1) == 0) &&
+           (pairsWithinDistance(&one, 0, 10, unused, 1) == 0);
+    ec.result(pass);
+  }
+
+  ec.DESC("closest pair, random and duplicate points");
+  {
+    pass = true;
+    for (int trial = 0; trial < 40; trial++)
+    {
+      int n = 2 + (int) (rng() % 400);
+      vector<Point> points = (trial % 2 == 0 ? latticeCloud(n, 50)
+                                             : vector<Point>());
+      for (int i = 0; trial % 2 == 1 && i < n; i++)
+        points.push_back(randomPoint(100));
+
+      double best = INFINITY;
+      for (int i = 0; i < n; i++)
+        for (int j = i + 1; j < n; j++)
+          best = min(best, bruteDistance(points[i], points[j]));
+
+      PointPair pair;
+      double dist;
+      pass = pass && closestPair(points.data(), n, pair, &dist) &&
+             (dist == best) && (0 <= pair.first) &&
+             (pair.first < pair.second) && (pair.second < n) &&
+             (bruteDistance(points[pair.first], points[pair.second]) == best);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, random points and exact-distance ties");
+  {
+    pass = true;
+    for (int trial = 0; trial < 30; trial++)
+    {
+      vector<Point> points = (trial % 2 == 0 ? latticeCloud(600, 12)
+                                             : vector<Point>());
+      for (int i = 0; trial % 2 == 1 && i < 600; i++)
+        points.push_back(randomPoint(20));
+      const double Epsilons[5] = { 0, 1, 1.5, 2, 3.3 };
+      pass = pass && checkCloseBy(points, Epsilons[trial % 5], -1);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, all points in one place");
+  {
+    vector<Point> points(300, Point(4, 4, 4));
+    pass = checkCloseBy(points, 0, -1) && checkCloseBy(points, 1, -1);
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, grid wider than the cell keys");
+  {
+    // Close pairs spread over a box so large that the cell keys wrap
+    // around.
+    vector<Point> points;
+    for (int i = 0; i < 300; i++)
+    {
+      Point p = randomPoint(1e9);
+      points.push_back(p);
+      points.push_back(Point(p.getX() + 1e-3 * (i % 3), p.getY(),
+                             p.getZ() - 1e-3 * (i % 2)));
+    }
+    pass = checkCloseBy(points, 2e-3, -1) && checkCloseBy(points, 1e5, -1);
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, cells whose keys wrap onto each other");
+  {
+    // Clusters exactly 2^21 cells apart share cell keys.  The lone point
+    // below them all puts the clusters across the wrap on every axis, so
+    // some of their neighbouring cells have the smallest keys and some the
+    // largest.
+    vector<Point> points(1, Point(-2097152, -2097152, -2097152));
+    for (int m = 0; m < 8; m++)
+      for (int i = 0; i < 40; i++)
+        points.push_back(Point(m * 2097152.0 + randomCoord(1.5),
+                               randomCoord(1.5), m % 2 + randomCoord(1.5)));
+    pass = checkCloseBy(points, 1, -1) && checkCloseBy(points, 0.5, -1);
+    ec.result(pass);
+  }
+
+  ec.DESC("closest pair, a tight cluster in a wide box");
+  {
+    pass = true;
+    for (int trial = 0; trial < 4; trial++)
+    {
+      vector<Point> points;
+      for (int i = 0; i < 3000; i++)
+        points.push_back(i % 2 == trial % 2 ? randomPoint(1e6)
+                                            : randomPoint(1e-6));
+
+      double best = INFINITY;
+      for (size_t i = 0; i < points.size(); i++)
+        for (size_t j = i + 1; j < points.size(); j++)
+          best = min(best, bruteDistance(points[i], points[j]));
+
+      PointPair pair;
+      double dist;
+      pass = pass && closestPair(points.data(), 3000, pair, &dist) &&
+             (dist == best) &&
+             (bruteDistance(points[pair.first], points[pair.second]) == best);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, enough cells to be split across cores");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 60000; i++)
+      points.push_back(randomPoint(1000));
+    pass = checkCloseBy(points, 5, -1) && checkCloseBy(points, 5, 100);
+    ec.result(pass);
+  }
+
+  ec.DESC("epsilon join, output buffer too small");
+  {
+    // A dense cluster gives many more pairs than a per-thread block holds.
+    vector<Point> points = latticeCloud(800, 6);
+    const long Capacities[5] = { 0, 1, 255, 1000, 20000 };
+
+    pass = (bruteCloseBy(points, 1.5).size() > 20000);
+    for (int c = 0; c < 5; c++)
+      pass = pass && checkCloseBy(points, 1.5, Capacities[c]);
+    pass = pass && (pairsWithinDistance(points.data(), (int) points.size(),
+                                        1.5, 0, 0) ==
+                    (long) bruteCloseBy(points, 1.5).size());
+    ec.result(pass);
+  }
+}
+
+
+// True if every point is on or below every face of the hull (so the hull
+// contains them all), and each vertex is the input point it says it is.
+static bool hullContains(const ConvexHull &hull, const vector<Point> &points)
+{
+  const vector<Point> &v = hull.getVertices();
+  const vector<int> &ids = hull.getVertexIds(), &idx = hull.getIndices();
+  for (size_t i = 0; i < v.size(); i++)
+    if (v[i].distanceTo(points[ids[i]]) != 0)
+      return false;
+
+  for (int t = 0; t < hull.getNumTriangles(); t++)
+  {
+    const Point &a = v[idx[3 * t]], &b = v[idx[3 * t + 1]];
+    const Point &c = v[idx[3 * t + 2]];
+    double u[3] = { b.getX() - a.getX(), b.getY() - a.getY(),
+                    b.getZ() - a.getZ() };
+    double w[3] = { c.getX() - a.getX(), c.getY() - a.getY(),
+                    c.getZ() - a.getZ() };
+    double n[3] = { u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2],
+                    u[0] * w[1] - u[1] * w[0] };
+    double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len == 0)
+      return false;     // a degenerate triangle
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      const Point &p = points[i];
+      double d = n[0] * (p.getX() - a.getX()) + n[1] * (p.getY() - a.getY()) +
+                 n[2] * (p.getZ() - a.getZ());
+      if (d > 1e-9 * len)
+        return false;
+    }
+  }
+  return true;
+}
+
+// True if the hull has the given corners as its vertices (and no others),
+// is a closed triangulated surface, and has the given volume and area.
+static bool checkHull(const ConvexHull &hull, const vector<Point> &points,
+                      const set<int> &corners, double volume, double area)
+{
+  const vector<int> &ids = hull.getVertexIds();
+  return (set<int>(ids.begin(), ids.end()) == corners) &&
+         (hull.getNumVertices() == (int) corners.size()) &&
+         (hull.getNumTriangles() == 2 * hull.getNumVertices() - 4) &&
+         near(hull.getVolume(), volume, 1e-12) &&
+         near(hull.getSurfaceArea(), area, 1e-12) &&
+         hullContains(hull, points);
+}
+
+
+/**
+ * Convex hulls of point sets whose hulls are known:  cubes with and without
+ * points on their faces and edges, lattices, and points on a sphere.
+ **/
+void convexHulls(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Convex hulls ---");
+
+  ec.DESC("too few points, and degenerate point sets");
+  {
+    vector<Point> points;
+    pass = ConvexHull(points).isEmpty();
+    for (int i = 0; i < 3; i++)
+      points.push_back(randomPoint(10));
+    pass = pass && ConvexHull(points).isEmpty();
+
+    vector<Point> flat, line, same(10, Point(1, 2, 3));
+    for (int i = 0; i < 50; i++)
+    {
+      flat.push_back(Point(randomCoord(10), randomCoord(10), 2));
+      line.push_back(Point(i, 2 * i, -i));
+    }
+    ConvexHull hull(flat);
+    pass = pass && hull.isEmpty() && (hull.getNumVertices() == 0) &&
+           (hull.getVolume() == 0) && ConvexHull(line).isEmpty() &&
+           ConvexHull(same).isEmpty();
+    ec.result(pass);
+  }
+
+  ec.DESC("unit cube");
+  {
+    vector<Point> points;
+    set<int> corners;
+    for (int i = 0; i < 8; i++)
+    {
+      points.push_back(Point(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+      corners.insert(i);
+    }
+    pass = checkHull(ConvexHull(points), points, corners, 1, 6);
+    ec.result(pass);
+  }
+
+  ec.DESC("cubes with points inside, on faces and on edges");
+  {
+    // Only the corners are vertices; the points on the faces and edges
+    // are on the hull but are not corners of it.
+    pass = true;
+    for (int trial = 0; trial < 200; trial++)
+    {
+      double side = 1 + (int) (rng() % 20);
+      bool lattice = (trial % 2 == 0);
+      vector<Point> points;
+      for (int i = 0; i < 200; i++)
+      {
+        double c[3];
+        for (int a = 0; a < 3; a++)
+          c[a] = (lattice ? (double) (rng() % ((int) side + 1))
+                          : side * (0.5 + randomCoord(0.5)));
+        int onFaces = (int) (rng() % 3);        // 0, 1 or 2 faces
+        for (int k = 0; k < onFaces; k++)
+          c[rng() % 3] = side * (rng() % 2);
+        points.push_back(Point(c[0], c[1], c[2]));
+      }
+
+      set<int> corners;
+      for (int i = 0; i < 8; i++)
+      {
+        int at = (int) (rng() % points.size());
+        points.insert(points.begin() + at, Point(side * (i & 1),
+                      side * ((i >> 1) & 1), side * ((i >> 2) & 1)));
+      }
+      for (size_t i = 0; i < points.size(); i++)
+        if ((points[i].getX() == 0 || points[i].getX() == side) &&
+            (points[i].getY() == 0 || points[i].getY() == side) &&
+            (points[i].getZ() == 0 || points[i].getZ() == side))
+          corners.insert((int) i);
+
+      // With duplicate corners, any one of each may be the vertex.
+      ConvexHull hull(points);
+      set<int> found;
+      for (int i = 0; i < hull.getNumVertices(); i++)
+        found.insert(hull.getVertexIds()[i]);
+      pass = pass && (hull.getNumVertices() == 8) &&
+             (hull.getNumTriangles() == 12) &&
+             includes(corners.begin(), corners.end(),
+                      found.begin(), found.end()) &&
+             near(hull.getVolume(), side * side * side, 1e-12) &&
+             near(hull.getSurfaceArea(), 6 * side * side, 1e-12) &&
+             hullContains(hull, points);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("10 x 10 x 10 lattice");
+  {
+    vector<Point> points;
+    set<int> corners;
+    for (int i = 0; i < 1000; i++)
+    {
+      int x = i % 10, y = i / 10 % 10, z = i / 100;
+      points.push_back(Point(x, y, z));
+      if ((x == 0 || x == 9) && (y == 0 || y == 9) && (z == 0 || z == 9))
+        corners.insert(i);
+    }
+    pass = checkHull(ConvexHull(points), points, corners, 729, 486);
+    ec.result(pass);
+  }
+
+  ec.DESC("points on a sphere, and inside it");
+  {
+    // Points spread evenly over a sphere (a golden-angle spiral) are all
+    // vertices; the volume and area approach those of the sphere.
+    const int N = 2000;
+    const double Radius = 50, Pi = acos(-1.0);
+    vector<Point> points;
+    set<int> corners;
+    for (int i = 0; i < N; i++)
+    {
+      double z = 1 - (2 * i + 1) / (double) N, r = sqrt(1 - z * z);
+      double angle = i * Pi * (3 - sqrt(5.0));
+      points.push_back(Point(Radius * r * cos(angle), Radius * r * sin(angle),
+                             Radius * z));
+      corners.insert(i);
+    }
+    for (int i = 0; i < 5000; i++)
+    {
+      Point p = randomPoint(Radius);
+      if (p.distanceTo(Point()) < 0.99 * Radius)
+        points.push_back(p);
+    }
+
+    ConvexHull hull(points);
+    const vector<int> &ids = hull.getVertexIds();
+    pass = (set<int>(ids.begin(), ids.end()) == corners) &&
+           (hull.getNumTriangles() == 2 * N - 4) &&
+           near(hull.getVolume(), 4 * Pi * pow(Radius, 3) / 3, 5e-3) &&
+           near(hull.getSurfaceArea(), 4 * Pi * Radius * Radius, 5e-3) &&
+           (hull.getVolume() < 4 * Pi * pow(Radius, 3) / 3) &&
+           hullContains(hull, points);
+    ec.result(pass);
+  }
+}
+
+
+// True if decoding stored points [first, first + count) of the cloud gives
+// points within half a grid step (plus rounding) of the originals.
+static bool checkDecode(const CompressedCloud &cloud,
+                        const vector<Point> &points, int first, int count)
+{
+  // The grid, as the cloud works it out.
+  double lo[3], hi[3];
+  for (int a = 0; a < 3; a++)
+  {
+    lo[a] = INFINITY;
+    hi[a] = -INFINITY;
+  }
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    double v[3] = { points[i].getX(), points[i].getY(), points[i].getZ() };
+    for (int a = 0; a < 3; a++)
+    {
+      lo[a] = min(lo[a], v[a]);
+      hi[a] = max(hi[a], v[a]);
+    }
+  }
+  double levels = (cloud.getPrecision() == Quantise16 ? 65535.0
+                                                      : 4294967295.0);
+
+  vector<Point> out(count + 1, Point(-1, -1, -1));
+  cloud.decode(first, count, out.data());
+  if (out[count].getX() != -1)
+    return false;               // wrote past the end
+
+  const vector<int> &order = cloud.getOrder();
+  for (int i = 0; i < count; i++)
+  {
+    int id = (cloud.isDeltaEncoded() ? order[first + i] : first + i);
+    double v[3] = { points[id].getX(), points[id].getY(), points[id].getZ() };
+    double d[3] = { out[i].getX(), out[i].getY(), out[i].getZ() };
+    for (int a = 0; a < 3; a++)
+    {
+      // A flat axis has no extent, and is decoded exactly.
+      double halfStep = (hi[a] - lo[a]) / levels / 2;
+      double rounding = 4e-16 * (fabs(lo[a]) + fabs(hi[a]));
+      if (fabs(d[a] - v[a]) > halfStep * (1 + 1e-9) + rounding)
+        return false;
+    }
+  }
+  return true;
+}
+
+// Checks every stored point, decoded all at once, in runs that start
+// partway through a delta block, and through forEachBatch().
+static bool checkCloud(const CompressedCloud &cloud,
+                       const vector<Point> &points)
+{
+  int n = (int) points.size();
+  bool pass = (cloud.getNumPoints() == n) && checkDecode(cloud, points, 0, n);
+  if (cloud.isDeltaEncoded())
+    pass = pass && isPermutation(cloud.getOrder(), n);
+  else
+    pass = pass && cloud.getOrder().empty();
+
+  const int Starts[6] = { 1, 127, 128, 129, 300, 1000 };
+  for (int s = 0; s < 6; s++)
+    if (Starts[s] < n)
+    {
+      int first = Starts[s];
+      pass = pass && checkDecode(cloud, points, first, 1) &&
+             checkDecode(cloud, points, first, min(n - first, 300)) &&
+             checkDecode(cloud, points, first, n - first);
+    }
+
+  int expectedFirst = 0;
+  cloud.forEachBatch(100, [&](const Point *batch, int count, int first) {
+    pass = pass && (first == expectedFirst) && (count <= 100) &&
+           checkDecode(cloud, points, first, count);
+    vector<Point> again(count);
+    cloud.decode(first, count, again.data());
+    for (int i = 0; i < count; i++)
+      pass = pass && (again[i].getX() == batch[i].getX()) &&
+             (again[i].getZ() == batch[i].getZ());
+    expectedFirst += count;
+  });
+  return pass && (expectedFirst == n);
+}
+
+
+/**
+ * Quantised point clouds:  decoded points must be within half a grid step
+ * of the originals, at both precisions, with and without delta encoding.
+ **/
+void compressedClouds(ErrorContext &ec)
+{
+  bool pass;
+  const CloudPrecision Precisions[2] = { Quantise16, Quantise32 };
+
+  ec.DESC("--- Compressed point clouds ---");
+
+  ec.DESC("empty cloud");
+  {
+    pass = true;
+    for (int p = 0; p < 2; p++)
+      for (int delta = 0; delta < 2; delta++)
+      {
+        CompressedCloud cloud(0, 0, Precisions[p], delta == 1);
+        pass = pass && (cloud.getNumPoints() == 0) &&
+               checkCloud(cloud, vector<Point>());
+      }
+    ec.result(pass);
+  }
+
+  ec.DESC("random points, 16 and 32 bits, with and without deltas");
+  {
+    vector<Point> points;
+    for (int i = 0; i < 1000; i++)
+      points.push_back(Point(randomCoord(1e3), 5e6 + randomCoord(1),
+                             randomCoord(1e-3)));
+    pass = true;
+    for (int p = 0; p < 2; p++)
+      for (int delta = 0; delta < 2; delta++)
+      {
+        CompressedCloud cloud(points.data(), 1000, Precisions[p], delta == 1);
+        pass = pass && (cloud.getPrecision() == Precisions[p]) &&
+               (cloud.isDeltaEncoded() == (delta == 1)) &&
+               checkCloud(cloud, points);
+      }
+    ec.result(pass);
+  }
+
+  ec.DESC("dense scan, where deltas pay off");
+  {
+    // Points a few grid steps apart on a wavy surface.
+    vector<Point> points;
+    for (int i = 0; i < 100; i++)
+      for (int j = 0; j < 100; j++)
+        points.push_back(Point(i * 0.01, j * 0.01,
+                               0.05 * sin(i * 0.1) * cos(j * 0.1)));
+
+    pass = true;
+    for (int p = 0; p < 2; p++)
+    {
+      CompressedCloud plain(points.data(), 10000, Precisions[p]);
+      CompressedCloud delta(points.data(), 10000, Precisions[p], true);
+      pass = pass && checkCloud(plain, points) && checkCloud(delta, points) &&
+             (delta.getEncodedSize() < plain.getEncodedSize()) &&
+             (plain.getEncodedSize() == 10000 * (p == 0 ? 6 : 12));
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("flat bounding boxes, where a grid step is 1");
+  {
+    vector<Point> same(300, Point(1.25, -3, 7e10)), plane;
+    for (int i = 0; i < 300; i++)
+      plane.push_back(Point(randomCoord(10), 2.5, randomCoord(10)));
+
+    pass = true;
+    for (int p = 0; p < 2; p++)
+      for (int delta = 0; delta < 2; delta++)
+      {
+        CompressedCloud a(same.data(), 300, Precisions[p], delta == 1);
+        CompressedCloud b(plane.data(), 300, Precisions[p], delta == 1);
+        CompressedCloud c(same.data(), 1, Precisions[p], delta == 1);
+        Point one;
+        c.decode(0, 1, &one);
+        pass = pass && checkCloud(a, same) && checkCloud(b, plane) &&
+               (one.getX() == 1.25) && (one.getY() == -3) &&
+               (one.getZ() == 7e10);
+        for (int i = 0; i < 300; i++)
+        {
+          b.decode(i, 1, &one);
+          pass = pass && (one.getY() == 2.5);
+        }
+      }
+    ec.result(pass);
+  }
+}
+
+
+/**
+ * This program is a test-suite for the lab1 geometry code.
+ **/
+int main()
+{
+  cout << "Testing the lab1 geometry code!!" << endl << endl;
+
+  ErrorContext ec(cout);
+
+  meshAreas(ec);        // Triangle areas of indexed meshes and soups
+  kdTree(ec);           // Nearest-neighbour and radius queries
+  spatialHash(ec);      // Dynamic point sets in a uniform grid
+  pointFiles(ec);       // Streaming points from mapped files
+  spatialSorting(ec);   // Morton and Hilbert orders
+  boundingVolumes(ec);  // Ray and closest-point queries on meshes
+  geomPoints(ec);       // geom::Point (mostly checked at compile time)
+  closePairs(ec);       // Closest pairs and epsilon joins
+  convexHulls(ec);      // Quickhull on cubes, lattices and spheres
+  compressedClouds(ec); // Quantised, delta-encoded point storage
+
+  return (ec.ok() ? 0 : 1);
+}
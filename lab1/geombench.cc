@@ -0,0 +1,235 @@
+// A non-interactive benchmark for the lab1 geometry code.  It generates
+// random points and triangle meshes, times distanceTo(), computeArea() and
+// the batched mesh functions, and reports their throughput and their error
+// relative to a long double reference.
+//
+// Usage:  geombench [numPoints [numTriangles [repeats [sliverFraction [seed]]]]]
+//
+// sliverFraction is the fraction of triangles that are made long and thin,
+// which is where Heron's formula loses accuracy.  Build with, for example:
+//
+//   g++ -std=c++14 -O2 -pthread geombench.cc area.cc Mesh.cc Point.cc
+
+#include "lab1.hh"
+#include "Mesh.hh"
+#include "Point.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Coordinates are drawn from [-CoordRange, CoordRange].
+static const double CoordRange = 1000;
+
+// Keeps results alive, so the compiler cannot drop the timed loops.
+static volatile double sink;
+
+// Runs func repeats times, and returns the fastest time in seconds.
+static double bestTime(int repeats, const std::function<void()> &func) {
+  double best = 0;
+  for (int r = 0; r < repeats; r++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (r == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+  return best;
+}
+
+// Reference distance between two points, in long double.
+static long double refDistance(const Point &a, const Point &b) {
+  long double dx = (long double) a.getX() - b.getX();
+  long double dy = (long double) a.getY() - b.getY();
+  long double dz = (long double) a.getZ() - b.getZ();
+  return sqrtl(dx * dx + dy * dy + dz * dz);
+}
+
+// Reference triangle area, from the cross product in long double.
+static long double refArea(const Point &a, const Point &b, const Point &c) {
+  long double ux = (long double) b.getX() - a.getX();
+  long double uy = (long double) b.getY() - a.getY();
+  long double uz = (long double) b.getZ() - a.getZ();
+  long double vx = (long double) c.getX() - a.getX();
+  long double vy = (long double) c.getY() - a.getY();
+  long double vz = (long double) c.getZ() - a.getZ();
+  long double cx = uy * vz - uz * vy;
+  long double cy = uz * vx - ux * vz;
+  long double cz = ux * vy - uy * vx;
+  return sqrtl(cx * cx + cy * cy + cz * cz) / 2;
+}
+
+// Accumulates the relative error of a set of results.
+struct errorStats {
+  double maxRel;
+  long double sumAbs;
+  long double sumRef;
+
+  errorStats() : maxRel(0), sumAbs(0), sumRef(0) { }
+
+  void add(double value, long double ref) {
+    long double err = fabsl((long double) value - ref);
+    sumAbs += err;
+    sumRef += fabsl(ref);
+    if (ref != 0) {
+      maxRel = std::max(maxRel, (double) (err / fabsl(ref)));
+    }
+  }
+};
+
+// Prints one line of results.
+static void report(const char *name, long count, const char *unit,
+                   double seconds, const errorStats &err) {
+  printf("%-28s %12.1f M%s/s   max rel err %9.2e   mean rel err %9.2e\n",
+         name, count / seconds / 1e6, unit, err.maxRel,
+         (double) (err.sumRef > 0 ? err.sumAbs / err.sumRef : 0));
+}
+
+// Prints the relative error of a total against its reference.
+static void reportTotal(const char *name, long count, const char *unit,
+                        double seconds, double total, long double ref) {
+  errorStats err;
+  err.add(total, ref);
+  printf("%-28s %12.1f M%s/s   total rel err %9.2e\n",
+         name, count / seconds / 1e6, unit, err.maxRel);
+}
+
+int main(int argc, char **argv) {
+  long numPoints = (argc > 1 ? atol(argv[1]) : 1 << 20);
+  long numTriangles = (argc > 2 ? atol(argv[2]) : 1 << 20);
+  int repeats = (argc > 3 ? atoi(argv[3]) : 5);
+  double sliverFraction = (argc > 4 ? atof(argv[4]) : 0.1);
+  unsigned int seed = (argc > 5 ? (unsigned int) atol(argv[5]) : 12345);
+  if (numPoints < 2 || numTriangles < 1 || repeats < 1 ||
+      sliverFraction < 0 || sliverFraction > 1) {
+    fprintf(stderr, "usage: %s [numPoints [numTriangles [repeats "
+            "[sliverFraction [seed]]]]]\n", argv[0]);
+    return 1;
+  }
+
+  printf("points %ld, triangles %ld, repeats %d, slivers %.2f, seed %u\n\n",
+         numPoints, numTriangles, repeats, sliverFraction, seed);
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> coord(-CoordRange, CoordRange);
+  std::uniform_real_distribution<double> unit(0, 1);
+
+  // Random points, for distanceTo().
+  std::vector<Point> points(numPoints);
+  for (long i = 0; i < numPoints; i++) {
+    points[i] = Point(coord(rng), coord(rng), coord(rng));
+  }
+
+  // An indexed mesh over half as many vertices as triangles (about the
+  // ratio of a closed surface), with some triangles made into slivers by
+  // putting their third corner almost on the line through the other two.
+  long numVertices = std::max(3L, numTriangles / 2);
+  std::vector<Point> vertices(numVertices);
+  for (long i = 0; i < numVertices; i++) {
+    vertices[i] = Point(coord(rng), coord(rng), coord(rng));
+  }
+  std::uniform_int_distribution<long> pick(0, numVertices - 1);
+  std::vector<int> indices(3 * numTriangles);
+  for (long t = 0; t < numTriangles; t++) {
+    for (int k = 0; k < 3; k++) {
+      indices[3 * t + k] = (int) pick(rng);
+    }
+  }
+  for (long t = 0; t < numTriangles; t++) {
+    if (unit(rng) >= sliverFraction) {
+      continue;
+    }
+    // Give the triangle a new third corner, part way along its first edge
+    // and a tiny distance off it.
+    Point a = vertices[indices[3 * t]];
+    Point b = vertices[indices[3 * t + 1]];
+    double s = unit(rng), off = 1e-6 * CoordRange;
+    vertices.push_back(Point(a.getX() + s * (b.getX() - a.getX()) + off * unit(rng),
+                             a.getY() + s * (b.getY() - a.getY()) + off * unit(rng),
+                             a.getZ() + s * (b.getZ() - a.getZ()) + off * unit(rng)));
+    indices[3 * t + 2] = (int) vertices.size() - 1;
+  }
+  numVertices = (long) vertices.size();
+
+  // The same triangles as a soup.
+  std::vector<Point> corners(3 * numTriangles);
+  for (long i = 0; i < 3 * numTriangles; i++) {
+    corners[i] = vertices[indices[i]];
+  }
+  TriangleMesh indexed(vertices.data(), (int) numVertices, indices.data(),
+                       (int) numTriangles);
+  TriangleMesh soup(corners.data(), (int) numTriangles);
+
+  // Reference results.
+  std::vector<long double> refAreas(numTriangles);
+  long double refTotal = 0;
+  for (long t = 0; t < numTriangles; t++) {
+    refAreas[t] = refArea(corners[3 * t], corners[3 * t + 1], corners[3 * t + 2]);
+    refTotal += refAreas[t];
+  }
+
+  // distanceTo() between consecutive points.
+  std::vector<double> distances(numPoints - 1);
+  double seconds = bestTime(repeats, [&]() {
+    for (long i = 0; i + 1 < numPoints; i++) {
+      distances[i] = points[i].distanceTo(points[i + 1]);
+    }
+    sink = distances[numPoints / 2 - 1];
+  });
+  errorStats err;
+  for (long i = 0; i + 1 < numPoints; i++) {
+    err.add(distances[i], refDistance(points[i], points[i + 1]));
+  }
+  report("Point::distanceTo", numPoints - 1, "pairs", seconds, err);
+
+  // computeArea(), one triangle at a time.
+  std::vector<double> areas(numTriangles);
+  seconds = bestTime(repeats, [&]() {
+    for (long t = 0; t < numTriangles; t++) {
+      areas[t] = computeArea(corners[3 * t], corners[3 * t + 1], corners[3 * t + 2]);
+    }
+    sink = areas[numTriangles / 2];
+  });
+  err = errorStats();
+  for (long t = 0; t < numTriangles; t++) {
+    err.add(areas[t], refAreas[t]);
+  }
+  report("computeArea (Heron)", numTriangles, "tris", seconds, err);
+
+  // computeAreas() over the indexed mesh and the soup.
+  double total = 0;
+  seconds = bestTime(repeats, [&]() {
+    total = computeAreas(indexed, areas.data());
+    sink = total;
+  });
+  err = errorStats();
+  for (long t = 0; t < numTriangles; t++) {
+    err.add(areas[t], refAreas[t]);
+  }
+  report("computeAreas (indexed)", numTriangles, "tris", seconds, err);
+
+  seconds = bestTime(repeats, [&]() {
+    total = computeAreas(soup, areas.data());
+    sink = total;
+  });
+  err = errorStats();
+  for (long t = 0; t < numTriangles; t++) {
+    err.add(areas[t], refAreas[t]);
+  }
+  report("computeAreas (soup)", numTriangles, "tris", seconds, err);
+
+  // computeSurfaceArea(), which only produces the total.
+  seconds = bestTime(repeats, [&]() {
+    total = computeSurfaceArea(indexed);
+    sink = total;
+  });
+  reportTotal("computeSurfaceArea (indexed)", numTriangles, "tris", seconds,
+              total, refTotal);
+
+  return 0;
+}
@@ -1,5 +1,3 @@
 #include "Point.hh"
 
 double computeArea(Point &a, Point &b, Point &c);
-
-int main();
\ No newline at end of file
@@ -1,388 +1,2221 @@
 #include "SparseVector.hh"
+#include "Parallel.hh"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <queue>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// How much the internal arrays are checked, chosen at compile time with
+// -DSPARSEVECTOR_CHECKS=n:
+//   0  never (the default when NDEBUG is defined);
+//   1  after one in every SPARSEVECTOR_CHECK_RATE changes;
+//   2  after every change (the default otherwise).
+// A check walks the whole vector, so level 2 is for debugging only; level 1
+// keeps some checking in release builds at a small, fixed fraction of the
+// cost.
+#ifndef SPARSEVECTOR_CHECKS
+#ifdef NDEBUG
+#define SPARSEVECTOR_CHECKS 0
+#else
+#define SPARSEVECTOR_CHECKS 2
+#endif
+#endif
+
+#ifndef SPARSEVECTOR_CHECK_RATE
+#define SPARSEVECTOR_CHECK_RATE 1024
+#endif
+
+// Largest scratch arrays (in elements) that a thread keeps between merges.
+static const size_t MaxScratch = 1 << 22;
+
+// Per-thread scratch arrays for merges.  A merge writes into these and then
+// swaps them with the vector's own arrays, so the old arrays become the
+// scratch arrays for the next merge, and repeated += and -= on a vector
+// reuse the same two pairs of buffers instead of allocating new ones.
+// (Each instantiation of the class has its own.)
+template <typename Index, typename Value>
+thread_local std::vector<Index> BasicSparseVector<Index, Value>::scratchIndices;
+template <typename Index, typename Value>
+thread_local std::vector<Value> BasicSparseVector<Index, Value>::scratchValues;
+
+// Makes the scratch value array at least n elements long.  Bitmaps and
+// dense arrays only need that one, so the two arrays can differ in length.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::growScratchValues(int n) {
+  if ((int) scratchValues.size() < n) {
+    scratchValues.resize(n);
+  }
+}
 
-// Default constructor:  initializes a Sparse Vector of size 0
-SparseVector::SparseVector() {
-  mSize = 0;
-  mStart = 0;
+// Makes the scratch arrays at least n elements long.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::growScratch(int n) {
+  if ((int) scratchIndices.size() < n) {
+    scratchIndices.resize(n);
+  }
+  growScratchValues(n);
 }
 
-// Copy constructor: deep copy a sparse vector
-SparseVector::SparseVector(const SparseVector &sv) {
-  copyList(sv);  // simply call helper function to copy
+// Drops the scratch arrays if an unusually large merge left them big, so
+// that they don't pin the memory to the thread.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::trimScratch() {
+  if (scratchIndices.capacity() > MaxScratch ||
+      scratchValues.capacity() > MaxScratch) {
+    std::vector<Index>().swap(scratchIndices);
+    std::vector<Value>().swap(scratchValues);
+  }
 }
 
-// Initializes the a Sparse Vector of a given size
-SparseVector::SparseVector(int size) {
-  assert (size >= 0);
-  mSize = size;
+// Arithmetic on values.  Integers are added and multiplied as unsigned
+// integers, so that an overflow wraps instead of being undefined (which
+// is also why a sum or product of nonzero values can come to zero);
+// floating-point values use plain arithmetic, which leaves the compiler
+// free to vectorise the loops over them.
+template <typename Value, bool Integral = std::is_integral<Value>::value>
+struct valueOps {
+  typedef typename std::make_unsigned<Value>::type Unsigned;
+
+  static Value add(Value a, Value b) {
+    return (Value) ((Unsigned) a + (Unsigned) b);
+  }
+  static Value multiply(Value a, Value b) {
+    return (Value) ((Unsigned) a * (Unsigned) b);
+  }
+  static Value addScaled(Value a, Value scale, Value b) {
+    return (Value) ((Unsigned) a + (Unsigned) scale * (Unsigned) b);
+  }
+};
 
-  mStart = 0;  // the linked list is initially empty
+template <typename Value>
+struct valueOps<Value, false> {
+  static Value add(Value a, Value b) {
+    return a + b;
+  }
+  static Value multiply(Value a, Value b) {
+    return a * b;
+  }
+  static Value addScaled(Value a, Value scale, Value b) {
+    return a + scale * b;
+  }
+};
+
+// Random inserts and removals are buffered in a small sorted array until it
+// holds MinPending elements or PendingFactor * sqrt(n), whichever is more,
+// where n is the number of elements in the main arrays.  Then the buffer is
+// merged into the main arrays.  An insert costs O(sqrt(n)) amortised:  a
+// shift of part of the buffer, plus a share of the linear merge.
+static const int MinPending = 256;
+static const double PendingFactor = 4;
+
+// sum() merges its inputs through a heap when the result's size is more
+// than HeapRatio times the total number of nonzero inputs, and otherwise
+// adds them up in an array spanning the result.  The heap costs O(log k) for
+// each input element, where k is the number of inputs, but only looks at
+// the elements; the array costs O(1) per element but also O(size).
+static const long HeapRatio = 16;
+
+// The representation is chosen by density (the fraction of elements that
+// are nonzero):  sorted arrays below BitmapDensity, a bitmap plus packed
+// values up to DenseDensity, and a dense array above that.  A bitmap takes
+// an eighth of a byte per element plus four bytes per nonzero one, against
+// eight bytes per nonzero element for the arrays, so it is smaller from a
+// density of 1/32.  Vectors only go back to a sparser representation when
+// their density falls below half the threshold, so that a vector near a
+// threshold doesn't keep switching.
+static const double BitmapDensity = 1.0 / 32;
+static const double DenseDensity = 0.5;
+
+// Number of 64-bit words in a bitmap of size bits.
+static int numWords(long long size) {
+  return (int) ((size + 63) / 64);
 }
 
+// Elements per block of a frozen vector.  A lookup decodes the indices of
+// one block, so smaller blocks mean faster lookups but a bigger table of
+// where the blocks start.
+static const int FrozenBlockSize = 128;
+
+// Spare bytes after a frozen vector's encoded indices, so that decoding can
+// always load 16 bytes at a time.
+static const int FrozenPadding = 16;
+
+// Frozen indices are stored as the gaps between them, StreamVByte-encoded:
+// each gap takes 1 to 4 bytes, low byte first, and its length minus one is
+// kept in 2 bits of a control byte, four gaps to a control byte.  A block's
+// control bytes come first, then the gaps' bytes.  With SSSE3 a whole
+// control byte's worth of gaps is unpacked with one byte shuffle, using a
+// table of the shuffles (and their total lengths) for every control byte.
+// Gaps between 64-bit indices take 1, 2, 4 or 8 bytes instead, and are
+// decoded one at a time.
+template <typename Index>
+static int gapLength(int code) {
+  return (sizeof(Index) == 4 ? code + 1 : 1 << code);
+}
 
-// Destructor - Clean up the  linked list
-SparseVector::~SparseVector() {
-  clear();  // simply call clear function to empty linked list
+#ifdef __SSSE3__
+struct streamVByteTable {
+  __m128i shuffles[256];
+  int lengths[256];
+};
+
+static streamVByteTable makeStreamVByteTable() {
+  streamVByteTable table;
+  for (int control = 0; control < 256; control++) {
+    signed char shuffle[16];
+    int pos = 0;
+    for (int g = 0; g < 4; g++) {
+      int length = ((control >> (2 * g)) & 3) + 1;
+      for (int byte = 0; byte < 4; byte++) {
+        shuffle[4 * g + byte] = (signed char) (byte < length ? pos++ : -1);
+      }
+    }
+    table.shuffles[control] = _mm_loadu_si128((const __m128i *) shuffle);
+    table.lengths[control] = pos;
+  }
+  return table;
 }
 
-// Private helper functions for constructors/destructors/assignemnt operator
+static const streamVByteTable & streamVByteShuffles() {
+  static const streamVByteTable table = makeStreamVByteTable();
+  return table;
+}
+#endif
+
+// Decodes the gaps of a frozen block from gap number i on, given its
+// control bytes and the data of gap i, into indices[i + 1 .. gaps]:  each
+// index is the one before it plus its gap.
+template <typename Index>
+static void decodeGapsFrom(const unsigned char *control,
+                           const unsigned char *data, int i, int gaps,
+                           Index *indices) {
+  typedef typename std::make_unsigned<Index>::type Gap;
+  Index index = indices[i];
+  for (; i < gaps; i++) {
+    int length = gapLength<Index>((control[i >> 2] >> (2 * (i & 3))) & 3);
+    Gap gap;
+    memcpy(&gap, data, sizeof(gap));   // (little-endian, like the encoding)
+    gap &= (Gap) ~(Gap) 0 >> (8 * (sizeof(Gap) - length));
+    data += length;
+    index += (Index) gap;
+    indices[i + 1] = index;
+  }
+}
 
-// copy contents of sv into the object
-void SparseVector::copyList(const SparseVector &sv) {
+// Decodes all gaps gaps of a frozen block, whose first index is already in
+// indices[0].
+template <typename Index>
+static void decodeGaps(const unsigned char *control, const unsigned char *data,
+                       int gaps, Index *indices) {
+  decodeGapsFrom(control, data, 0, gaps, indices);
+}
 
-  mSize = sv.getSize();
+#ifdef __SSSE3__
+// decodeGaps() for int indices:  the gaps are unpacked four at a time with
+// an SSSE3 shuffle, and added up with SSE2.
+static void decodeGaps(const unsigned char *control, const unsigned char *data,
+                       int gaps, int *indices) {
+  const streamVByteTable &table = streamVByteShuffles();
+  __m128i prev = _mm_set1_epi32(indices[0]);
+  int i = 0;
+  for (; i + 4 <= gaps; i += 4) {
+    int c = control[i >> 2];
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) data),
+                                 table.shuffles[c]);
+    data += table.lengths[c];
+    // prefix sums of the four gaps, plus the index before them.
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, prev);
+    _mm_storeu_si128((__m128i *) (indices + 1 + i), x);
+    prev = _mm_shuffle_epi32(x, 0xff);
+  }
+  decodeGapsFrom(control, data, i, gaps, indices);
+}
+#endif
+
+// Intersections gallop through the longer vector when it has this many times
+// more elements than the shorter one.
+static const long GallopRatio = 32;
+
+// Bulk construction sorts entries by index with an LSD radix sort, this many
+// bits per pass.
+static const int RadixBits = 11;
+static const int RadixBuckets = 1 << RadixBits;
+
+// Each core gets at least this many entries or elements in operations that
+// are split across cores.  (-DSPARSEVECTOR_ENTRIES_PER_CHUNK=n lowers it, so
+// that the tests' small vectors are split too.)
+#ifndef SPARSEVECTOR_ENTRIES_PER_CHUNK
+#define SPARSEVECTOR_ENTRIES_PER_CHUNK (1 << 20)
+#endif
+
+static const long EntriesPerChunk = SPARSEVECTOR_ENTRIES_PER_CHUNK;
+
+// Parallel merges split the index space at every (samples / chunks)th of
+// SamplesPerChunk * chunks indices sampled from the two inputs.
+static const int SamplesPerChunk = 64;
+
+// Returns the position of the first of the n sorted indices that is not
+// less than index, searching outwards from position hint:  steps of 1, 2,
+// 4, ... positions, then a binary search of the last step.  This takes
+// O(log d) steps when the answer is d positions from hint.
+template <typename Index>
+static int gallop(const Index *indices, int n, Index index, int hint) {
+  hint = std::max(0, std::min(n, hint));
+  int lo, hi, step = 1;
+
+  if (hint < n && indices[hint] < index) {
+    // the answer is after hint:  everything before lo is less than index.
+    lo = hint + 1;
+    while (lo + step - 1 < n && indices[lo + step - 1] < index) {
+      lo += step;
+      step *= 2;
+    }
+    hi = std::min(n, lo + step - 1);
+  } else {
+    // the answer is at or before hint:  indices[hi] is not less than index
+    // (or hi is the end).
+    hi = hint;
+    while (hi - step >= 0 && indices[hi - step] >= index) {
+      hi -= step;
+      step *= 2;
+    }
+    lo = std::max(0, hi - step + 1);
+  }
 
+  return (int) (std::lower_bound(indices + lo, indices + hi, index) - indices);
+}
 
-  // Get a pointer to other list's first node
-  node *otherCurr = sv.mStart;
-  if (otherCurr == 0) {  // if empty, return early
-    mStart = 0;
-    return;
+// Steps i and j through the sorted arrays of n and m indices, in blocks,
+// calling func(i, j) for every pair of positions where ai[i] == bj[j],
+// and stops when the next block of either would run off its end.  The
+// caller then finishes the arrays one element at a time.  There are no
+// blocks for indices other than ints, so this does nothing for them.
+template <typename Index, typename Func>
+static void forEachCommonBlock(const Index *, int, const Index *, int,
+                               int &, int &, Func) {
+}
+
+#ifdef __SSE2__
+// forEachCommonBlock() for int indices:  it compares blocks of four
+// indices from each array, all against all.  The block from b is rotated
+// through its four positions, and each rotation compared with the block
+// from a, which finds the elements of a's block that are in b's without
+// any branches.  Then the block with the smaller last index is done with,
+// since everything that could match it has been seen.
+template <typename Func>
+static void forEachCommonBlock(const int *ai, int n, const int *bi, int m,
+                               int &i, int &j, Func func) {
+  while (i + 4 <= n && j + 4 <= m) {
+    __m128i va = _mm_loadu_si128((const __m128i *) (ai + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *) (bi + j));
+    __m128i eq01 = _mm_or_si128(
+      _mm_cmpeq_epi32(va, vb),
+      _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+    __m128i eq23 = _mm_or_si128(
+      _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+      _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(eq01, eq23)));
+
+    int lastA = ai[i + 3], lastB = bi[j + 3];
+    for (int jj = j; mask != 0; mask &= mask - 1) {
+      // the matches are rare enough that finding their place in b's
+      // block one step at a time is fine.
+      int lane = __builtin_ctz(mask);
+      while (bi[jj] != ai[i + lane]) {
+        jj++;
+      }
+      func(i + lane, jj);
+    }
+    i += (lastA <= lastB ? 4 : 0);
+    j += (lastB <= lastA ? 4 : 0);
   }
+}
+#endif
+
+// Calls func(i, j) for every pair of positions where ai[i] == bj[j], in
+// increasing order, for sorted arrays of n and m indices.  If one array is
+// more than GallopRatio times longer than the other, this walks the short
+// one and gallops through the long one, which takes O(m log(n / m)) steps
+// instead of O(n + m).
+template <typename Index, typename Func>
+static void forEachCommon(const Index *ai, int n, const Index *bi, int m,
+                          Func func) {
+  if ((long) n > GallopRatio * m) {
+    for (int j = 0, i = 0; j < m && i < n; j++) {
+      i = gallop(ai, n, bi[j], i);
+      if (i < n && ai[i] == bi[j]) {
+        func(i, j);
+      }
+    }
+  } else if ((long) m > GallopRatio * n) {
+    for (int i = 0, j = 0; i < n && j < m; i++) {
+      j = gallop(bi, m, ai[i], j);
+      if (j < m && ai[i] == bi[j]) {
+        func(i, j);
+      }
+    }
+  } else {
+    int i = 0, j = 0;
+    forEachCommonBlock(ai, n, bi, m, i, j, func);
+    while (i < n && j < m) {
+      if (ai[i] == bi[j]) {
+        func(i++, j++);
+      } else if (ai[i] < bi[j]) {
+        i++;
+      } else {
+        j++;
+      }
+    }
+  }
+}
 
-  // Use prev and curr to create the copy
-  node *prev = 0;
-  node *curr;
+// Copies four indices or values, which is one vector load and store for
+// ints with SSE2.
+template <typename T>
+static void copyFour(const T *from, T *to) {
+  for (int r = 0; r < 4; r++) {
+    to[r] = from[r];
+  }
+}
 
-  while (otherCurr != 0) {
-    // Copy other list's current node
-    curr = new node(otherCurr->index, otherCurr->value);
-    if (prev == 0) {
-      mStart = curr;      // curr is the first node in our copy!
+#ifdef __SSE2__
+static void copyFour(const int *from, int *to) {
+  _mm_storeu_si128((__m128i *) to, _mm_loadu_si128((const __m128i *) from));
+}
+#endif
+
+// Copies four values times scale, which must be 1 or -1.
+template <typename Value>
+static void copyFourScaled(const Value *from, Value scale, Value *to) {
+  for (int r = 0; r < 4; r++) {
+    to[r] = valueOps<Value>::multiply(scale, from[r]);
+  }
+}
+
+#ifdef __SSE2__
+static void copyFourScaled(const int *from, int scale, int *to) {
+  __m128i values = _mm_loadu_si128((const __m128i *) from);
+  if (scale < 0) {
+    values = _mm_sub_epi32(_mm_setzero_si128(), values);
+  }
+  _mm_storeu_si128((__m128i *) to, values);
+}
+#endif
+
+// Returns a + scale * b, leaving out a unless takeA is 1 and b unless takeB
+// is 1, for merges that add up the elements of two vectors in one step
+// whether they come from one vector or both.  The values are chosen with
+// selects, which the compiler can do without branches.
+template <typename Value>
+static Value stepSum(unsigned int takeA, Value a, unsigned int takeB,
+                     Value scale, Value b) {
+  return valueOps<Value>::add(
+    (takeA ? a : Value()),
+    (takeB ? valueOps<Value>::multiply(scale, b) : Value()));
+}
+
+// stepSum() for ints, which masks the values with the flags instead.
+static int stepSum(unsigned int takeA, int a, unsigned int takeB, int scale,
+                   int b) {
+  return (int) (((unsigned int) a & -takeA) +
+                ((unsigned int) scale * (unsigned int) b & -takeB));
+}
+
+// Merges the sorted elements (ai, av) and (bi, bv) into (outIndices,
+// outValues), which must have room for n + m elements, as a + scale * b.
+// Zero sums are left out.  Returns the number of elements written.
+//
+// The main loop has no data-dependent branches:  each step works out which
+// array(s) the next index comes from with comparisons, and writes the
+// element either to the output or, if its value is zero, to a spare slot,
+// so nothing is ever written past the elements returned (which the
+// parallel merge relies on).  Where one array has a run of four or more
+// elements below the other's next index, they are copied four at a time,
+// which is a vector load and store of int indices and values with SSE2.
+//
+// The union itself is not vectorised:  where the indices of the two arrays
+// interleave, it takes one element per step, because where each output
+// goes depends on every step before it.  Only the intersections
+// (forEachCommonBlock()) compare indices four by four.
+template <typename Index, typename Value>
+static int mergeScaled(const Index *ai, const Value *av, int n,
+                       const Index *bi, const Value *bv, int m, Value scale,
+                       Index *outIndices, Value *outValues) {
+  int i = 0, j = 0, k = 0;
+  bool unitScale = (scale == 1 || scale == -1);
+  Index spareIndex;   // where elements that come to zero go
+  Value spareValue;
+
+  while (i < n && j < m) {
+    if (i + 4 <= n && ai[i + 3] < bi[j]) {
+      // a run of a's elements.  (They are nonzero, so all are kept.)
+      copyFour(ai + i, outIndices + k);
+      copyFour(av + i, outValues + k);
+      i += 4;
+      k += 4;
+      continue;
     }
-    else {
-      prev->next = curr; // Make previous node point to current
+    if (unitScale && j + 4 <= m && bi[j + 3] < ai[i]) {
+      // a run of b's elements, negated if need be.  (Negating a nonzero
+      // value never gives zero, so all are kept.)
+      copyFour(bi + j, outIndices + k);
+      copyFourScaled(bv + j, scale, outValues + k);
+      j += 4;
+      k += 4;
+      continue;
     }
-    prev = curr;                  // Done with current node!
-    otherCurr = otherCurr->next;  // Move to next node to copy
+
+    // one element, from a, b or both.  The arithmetic on ints is unsigned,
+    // so an overflow wraps (the same as it does in the scalar code
+    // elsewhere) instead of being undefined; with a scale other than 1 or
+    // -1, even b's value alone could wrap (or, for floats, underflow) to
+    // zero.
+    Index x = ai[i], y = bi[j];
+    unsigned int takeA = (x <= y), takeB = (y <= x);
+    Value value = stepSum(takeA, av[i], takeB, scale, bv[j]);
+    bool keep = (value != 0);
+    *(keep ? outIndices + k : &spareIndex) = (x < y ? x : y);
+    *(keep ? outValues + k : &spareValue) = value;
+    k += keep;
+    i += takeA;
+    j += takeB;
+  }
+
+  // copy whatever is left of either vector.
+  for (; i < n; i++, k++) {
+    outIndices[k] = ai[i];
+    outValues[k] = av[i];
+  }
+  for (; j < m; j++) {
+    Value value = valueOps<Value>::multiply(scale, bv[j]);
+    bool keep = (value != 0);
+    *(keep ? outIndices + k : &spareIndex) = bi[j];
+    *(keep ? outValues + k : &spareValue) = value;
+    k += keep;
+  }
+
+  return k;
+}
+
+// mergeScaled() split across chunks cores, returning the number of elements
+// written.  The index space is divided into ranges holding about the same
+// number of elements of a and b together, using a sorted sample of both
+// arrays' indices taken in proportion to their lengths.  Each core first
+// counts its range's output (from the indices the two have in common and
+// the sums there that cancel), so that it knows where its output goes, and
+// then merges its range straight into place.  The cores share no writes, so
+// they need no locks.
+template <typename Index, typename Value>
+static int mergeScaledParallel(const Index *ai, const Value *av, int n,
+                               const Index *bi, const Value *bv, int m,
+                               Value scale, int chunks, Index *outIndices,
+                               Value *outValues) {
+  long total = std::max((long) n + m, 1L);
+  int samplesA = (int) (SamplesPerChunk * chunks * (long) n / total);
+  int samplesB = (int) (SamplesPerChunk * chunks * (long) m / total);
+  std::vector<Index> samples;
+  for (int s = 0; s < samplesA; s++) {
+    samples.push_back(ai[(long) n * s / samplesA]);
+  }
+  for (int s = 0; s < samplesB; s++) {
+    samples.push_back(bi[(long) m * s / samplesB]);
+  }
+  std::sort(samples.begin(), samples.end());
+
+  std::vector<int> aBegin(chunks + 1), bBegin(chunks + 1);
+  aBegin[chunks] = n;
+  bBegin[chunks] = m;
+  for (int c = 1; c < chunks; c++) {
+    Index bound = (samples.empty() ? 0 : samples[samples.size() * c / chunks]);
+    aBegin[c] = (int) (std::lower_bound(ai, ai + n, bound) - ai);
+    bBegin[c] = (int) (std::lower_bound(bi, bi + m, bound) - bi);
+  }
+
+  std::vector<int> outStart(chunks + 1, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    parallelFor(chunks, chunks, [&](int c, long, long) {
+      int a0 = aBegin[c], b0 = bBegin[c];
+      int na = aBegin[c + 1] - a0, nb = bBegin[c + 1] - b0;
+      if (pass == 0) {
+        int dropped = 0;
+        // (the sums are worked out just as mergeScaled() does, so that the
+        // two agree on which come to zero)
+        forEachCommon(ai + a0, na, bi + b0, nb, [&](int i, int j) {
+          Value sum = stepSum(1, av[a0 + i], 1, scale, bv[b0 + j]);
+          dropped += (sum == 0 ? 2 : 1);
+        });
+        outStart[c + 1] = na + nb - dropped;   // (a count, until the prefix sum)
+      } else {
+        mergeScaled(ai + a0, av + a0, na, bi + b0, bv + b0, nb, scale,
+                    outIndices + outStart[c], outValues + outStart[c]);
+      }
+    });
+
+    if (pass == 0) {
+      for (int c = 0; c < chunks; c++) {
+        outStart[c + 1] += outStart[c];
+      }
+    }
+  }
+  return outStart[chunks];
+}
+
+// Adds scale * b[i] to out[i] for n values.  (Ints wrap on overflow, as
+// in the other merges.)
+template <typename Value>
+static void addScaledDense(Value *out, const Value *b, Value scale, int n) {
+  for (int i = 0; i < n; i++) {
+    out[i] = valueOps<Value>::addScaled(out[i], scale, b[i]);
+  }
+}
+
+#ifdef __SSE2__
+// addScaledDense() for floats, four at a time.
+static void addScaledDense(float *out, const float *b, float scale, int n) {
+  __m128 vscale = _mm_set1_ps(scale);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_mul_ps(vscale, _mm_loadu_ps(b + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), x));
+  }
+  for (; i < n; i++) {
+    out[i] = valueOps<float>::addScaled(out[i], scale, b[i]);
   }
+}
+
+// addScaledDense() for doubles, two at a time.
+static void addScaledDense(double *out, const double *b, double scale,
+                           int n) {
+  __m128d vscale = _mm_set1_pd(scale);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d x = _mm_mul_pd(vscale, _mm_loadu_pd(b + i));
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(out + i), x));
+  }
+  for (; i < n; i++) {
+    out[i] = valueOps<double>::addScaled(out[i], scale, b[i]);
+  }
+}
+#endif
+
+// Returns the sum of a[i] * b[i] for n values, summed as a dot product is
+// (see SparseSum).
+template <typename Value>
+static typename SparseSum<Value>::type denseDot(const Value *a, const Value *b,
+                                                int n) {
+  typedef typename SparseSum<Value>::type Sum;
+  Sum sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += (Sum) a[i] * b[i];
+  }
+  return sum;
+}
 
-  checkListOrder();
+#ifdef __SSE2__
+// denseDot() for floats:  four at a time, widened to doubles before they
+// are multiplied.  The compiler won't vectorise a floating-point sum by
+// itself, since doing so changes the order that it is added up in.
+static double denseDot(const float *a, const float *b, int n) {
+  __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+    lo = _mm_add_pd(lo, _mm_mul_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb)));
+    hi = _mm_add_pd(hi, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)),
+                                   _mm_cvtps_pd(_mm_movehl_ps(vb, vb))));
+  }
+  double sums[2];
+  _mm_storeu_pd(sums, _mm_add_pd(lo, hi));
+  double sum = sums[0] + sums[1];
+  for (; i < n; i++) {
+    sum += (double) a[i] * b[i];
+  }
+  return sum;
 }
 
-// clean up the linked list by deleting every element
-void SparseVector::clear() {
-  node *curr = mStart;
-  while (curr != 0) {
-    node *next = curr->next; // Get what is next, before deleting curr.
-    delete curr;   // Delete this node.
-    curr = next;   // Go to next node in list
+// denseDot() for doubles, two at a time.
+static double denseDot(const double *a, const double *b, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
   }
-  mStart = 0;   // indicate that the list is empty
+  double sums[2];
+  _mm_storeu_pd(sums, acc);
+  double sum = sums[0] + sums[1];
+  for (; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+#endif
+
+// Sorts count entries by index, where every index is less than size.  The
+// sort is stable, and split across cores for large inputs.  Returns the
+// sorted entries, which are either in buf1 or buf2 (each of which must have
+// room for count entries), or are entries itself if it was already sorted
+// by the digits that vary.
+template <typename Entry, typename Index>
+static const Entry * sortEntries(const Entry *entries, long count, Index size,
+                                 Entry *buf1, Entry *buf2) {
+  int bits = 0, maxBits = 8 * (int) sizeof(Index) - 1;   // (indices are signed)
+  while (bits < maxBits && ((long long) 1 << bits) < size) {
+    bits++;
+  }
+
+  int chunks = numChunks(count, EntriesPerChunk);
+  std::vector<long> counts((size_t) chunks * RadixBuckets);
+  const Entry *src = entries;
+  Entry *dst = buf1;
+
+  for (int shift = 0; shift < bits; shift += RadixBits) {
+    // Count each chunk's digits.
+    std::fill(counts.begin(), counts.end(), 0);
+    parallelFor(count, chunks, [&](int c, long begin, long end) {
+      long *hist = &counts[(size_t) c * RadixBuckets];
+      for (long i = begin; i < end; i++) {
+        hist[(src[i].index >> shift) & (RadixBuckets - 1)]++;
+      }
+    });
+
+    // Skip the pass if every entry has the same digit.
+    bool trivial = false;
+    for (int d = 0; d < RadixBuckets && !trivial; d++) {
+      long total = 0;
+      for (int c = 0; c < chunks; c++) {
+        total += counts[(size_t) c * RadixBuckets + d];
+      }
+      trivial = (total == count);
+    }
+    if (trivial) {
+      continue;
+    }
+
+    // Turn the counts into where each chunk's entries with each digit go:
+    // by digit, then by chunk, which keeps the sort stable.
+    long pos = 0;
+    for (int d = 0; d < RadixBuckets; d++) {
+      for (int c = 0; c < chunks; c++) {
+        long n = counts[(size_t) c * RadixBuckets + d];
+        counts[(size_t) c * RadixBuckets + d] = pos;
+        pos += n;
+      }
+    }
+
+    parallelFor(count, chunks, [&](int c, long begin, long end) {
+      long *next = &counts[(size_t) c * RadixBuckets];
+      for (long i = begin; i < end; i++) {
+        dst[next[(src[i].index >> shift) & (RadixBuckets - 1)]++] = src[i];
+      }
+    });
+
+    src = dst;
+    dst = (dst == buf1 ? buf2 : buf1);
+  }
+
+  return src;
+}
+
+// Default constructor:  initializes a Sparse Vector of size 0
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::BasicSparseVector() {
+  mSize = 0;
+  mRep = SparseRep;
+  mNumNonzeros = 0;
+}
+
+// Copy constructor: deep copy a sparse vector
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::BasicSparseVector(const BasicSparseVector &sv)
+  : mSize(sv.mSize), mRep(sv.mRep), mIndices(sv.mIndices),
+    mValues(sv.mValues), mBits(sv.mBits), mRanks(sv.mRanks),
+    mNumNonzeros(sv.mNumNonzeros), mBytes(sv.mBytes),
+    mBlockFirst(sv.mBlockFirst), mBlockStart(sv.mBlockStart),
+    mPendingIndices(sv.mPendingIndices), mPendingValues(sv.mPendingValues) {
+}
+
+// Move constructor: takes over the arrays of sv, which is left as an empty
+// vector of size 0
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::BasicSparseVector(
+  BasicSparseVector &&sv) noexcept : BasicSparseVector() {
+  swap(sv);
+}
+
+// Initializes the a Sparse Vector of a given size
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::BasicSparseVector(Index size) {
+  assert (size >= 0);
+  mSize = size;
+  mRep = SparseRep;
+  mNumNonzeros = 0;
+
+  // the arrays are initially empty
+}
+
+
+// Builds a Sparse Vector of a given size from count entries in any order.
+// Entries with the same index are summed, and zero sums are left out.
+// Large inputs are sorted and combined on all cores.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::BasicSparseVector(Index size,
+                                                   const Entry *entries,
+                                                   long count) {
+  assert(size >= 0 && count >= 0);
+  mSize = size;
+  mRep = SparseRep;
+  mNumNonzeros = 0;
+  if (count == 0) {
+    return;
+  }
+
+#ifndef NDEBUG
+  for (long i = 0; i < count; i++) {
+    assert(entries[i].index >= 0 && entries[i].index < size);
+  }
+#endif
+
+  std::vector<Entry> buf1(count), buf2;
+  if (size > RadixBuckets) {
+    buf2.resize(count);  // (a single pass never needs the second buffer)
+  }
+  const Entry *sorted = sortEntries(entries, count, size, buf1.data(),
+                                    buf2.data());
+
+  // Split the sorted entries into chunks that don't split a run of equal
+  // indices, then sum each run:  first to count each chunk's nonzero sums,
+  // so that every chunk knows where its output goes, and then to store them.
+  int chunks = numChunks(count, EntriesPerChunk);
+  std::vector<long> begins(chunks + 1);
+  for (int c = 0; c <= chunks; c++) {
+    long b = chunkBegin(count, chunks, c);
+    while (b > 0 && b < count && sorted[b].index == sorted[b - 1].index) {
+      b++;
+    }
+    begins[c] = std::max(b, (c > 0 ? begins[c - 1] : 0L));
+  }
+
+  std::vector<long> outStart(chunks + 1, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    parallelFor(chunks, chunks, [&](int c, long, long) {
+      long k = (pass == 0 ? 0 : outStart[c]);
+      for (long i = begins[c]; i < begins[c + 1]; ) {
+        Index index = sorted[i].index;
+        Value sum = 0;
+        for (; i < begins[c + 1] && sorted[i].index == index; i++) {
+          sum = valueOps<Value>::add(sum, sorted[i].value);
+        }
+        if (sum != 0) {
+          if (pass == 1) {
+            mIndices[k] = index;
+            mValues[k] = sum;
+          }
+          k++;
+        }
+      }
+      if (pass == 0) {
+        outStart[c + 1] = k;   // (a count, until the prefix sum below)
+      }
+    });
+
+    if (pass == 0) {
+      for (int c = 0; c < chunks; c++) {
+        outStart[c + 1] += outStart[c];
+      }
+      mIndices.resize(outStart[chunks]);
+      mValues.resize(outStart[chunks]);
+    }
+  }
+
+  adapt();
+  validate();
+}
+
+// Destructor - the arrays clean up after themselves
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::~BasicSparseVector() {
 }
 
 // Operators
 
 // Assignment operator that checks for self-assignment
-SparseVector & SparseVector::operator=(const SparseVector &rhs) {
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::operator=(const BasicSparseVector &rhs) {
   // Only do assignment if RHS is a different object from this.
   if (this != &rhs) {
-    // empty the linked list, and create a new one and copy values...
-    clear();  
-    copyList(rhs);
+    mSize = rhs.mSize;
+    mRep = rhs.mRep;
+    mIndices = rhs.mIndices;
+    mValues = rhs.mValues;
+    mBits = rhs.mBits;
+    mRanks = rhs.mRanks;
+    mNumNonzeros = rhs.mNumNonzeros;
+    mBytes = rhs.mBytes;
+    mBlockFirst = rhs.mBlockFirst;
+    mBlockStart = rhs.mBlockStart;
+    mPendingIndices = rhs.mPendingIndices;
+    mPendingValues = rhs.mPendingValues;
   }
 
   return *this;
 }
 
-// add a sparse vector to self
-SparseVector & SparseVector::operator+=(const SparseVector &rhs) {
+// Move assignment operator:  swaps contents with rhs, so rhs is left with
+// this vector's old elements and frees them when it goes.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::operator=(BasicSparseVector &&rhs) noexcept {
+  swap(rhs);
+  return *this;
+}
 
-  assert(mSize == rhs.getSize());   // the sparse vectors must be the same size
+// exchange the contents of two vectors, without copying any elements
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::swap(BasicSparseVector &other) noexcept {
+  std::swap(mSize, other.mSize);
+  std::swap(mRep, other.mRep);
+  mIndices.swap(other.mIndices);
+  mValues.swap(other.mValues);
+  mBits.swap(other.mBits);
+  mRanks.swap(other.mRanks);
+  std::swap(mNumNonzeros, other.mNumNonzeros);
+  mBytes.swap(other.mBytes);
+  mBlockFirst.swap(other.mBlockFirst);
+  mBlockStart.swap(other.mBlockStart);
+  mPendingIndices.swap(other.mPendingIndices);
+  mPendingValues.swap(other.mPendingValues);
+}
 
-  addSubVector(rhs, true);  // call helper function to add rhs to this
+// add a sparse vector to self
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::operator+=(const BasicSparseVector &rhs) {
 
-  removeZeros();
+  assert(mSize == rhs.getSize());   // the sparse vectors must be the same size
 
-  assert(checkZeros());
+  BasicSparseVector tmp;
+  addSubVector(rhs.settled(tmp), true);  // call helper function to add rhs to this
 
   return *this;
 }
 
 // subtract a sparse vector from self
-SparseVector & SparseVector::operator-=(const SparseVector &rhs) {
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::operator-=(const BasicSparseVector &rhs) {
 
   assert(mSize == rhs.getSize());   // the sparse vectors must be the same size
 
-  addSubVector(rhs, false);  // call helper function to subtract rhs from this
-
-  removeZeros();
-
-  assert(checkZeros());
+  BasicSparseVector tmp;
+  addSubVector(rhs.settled(tmp), false);  // call helper function to subtract rhs from this
 
   return *this;
 }
 
-// add operation to create a new sparse vector object
-const SparseVector SparseVector::operator+(const SparseVector &sv) const {
+// add operation to create a new sparse vector object.  The sum is merged
+// straight into the result, rather than into a copy of self.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>
+BasicSparseVector<Index, Value>::operator+(
+  const BasicSparseVector &sv) const & {
+
+  assert(mSize == sv.getSize());   // the sparse vectors must be the same size
 
-  SparseVector result(*this);   // make a copy of self
-  result += sv; // add the RHS to the result.
+  BasicSparseVector result, tmp1, tmp2;
+  result.mergeVectors(settled(tmp1), sv.settled(tmp2), 1);
   return result;
 }
 
 // subtract operation to create a new sparse vector object
-const SparseVector SparseVector::operator-(const SparseVector &sv) const {
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>
+BasicSparseVector<Index, Value>::operator-(
+  const BasicSparseVector &sv) const & {
 
-  SparseVector result(*this);   // make a copy of self
-  result -= sv; // add the RHS to the result.
+  assert(mSize == sv.getSize());   // the sparse vectors must be the same size
+
+  BasicSparseVector result, tmp1, tmp2;
+  result.mergeVectors(settled(tmp1), sv.settled(tmp2), -1);
   return result;
 }
 
-// return true iff each node of this is exactly equal to each corresponding
-// not of other SparseVector
-bool SparseVector::operator==(const SparseVector &other) const {
-  // Compare the nodes, and return a bool result.
-  if (mSize != other.getSize()) {
+// add operation on a temporary:  adds sv to the temporary itself, and
+// moves it into the result
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>
+BasicSparseVector<Index, Value>::operator+(const BasicSparseVector &sv) && {
+  *this += sv;
+  return std::move(*this);
+}
+
+// subtract operation on a temporary
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>
+BasicSparseVector<Index, Value>::operator-(const BasicSparseVector &sv) && {
+  *this -= sv;
+  return std::move(*this);
+}
+
+// return true iff both vectors have the same size and exactly the same
+// nonzero elements
+template <typename Index, typename Value>
+bool BasicSparseVector<Index, Value>::operator==(
+  const BasicSparseVector &other) const {
+  if (mSize != other.mSize) {
     return false;
   }
+  BasicSparseVector tmp1, tmp2;
+  const BasicSparseVector &a = settled(tmp1), &b = other.settled(tmp2);
+
+  // Equal vectors can be held differently (see adapt()), in which case
+  // they are compared as sorted arrays, as frozen vectors are.
+  if (a.mRep != b.mRep || a.mRep == FrozenRep) {
+    BasicSparseVector sa(a), sb(b);
+    sa.toSparse();
+    sb.toSparse();
+    return sa.mIndices == sb.mIndices && sa.mValues == sb.mValues;
+  }
+  return a.mIndices == b.mIndices && a.mValues == b.mValues &&
+         a.mBits == b.mBits;
+}
+
+// return true iff at least 1 element of this differs from other SparseVector
+template <typename Index, typename Value>
+bool BasicSparseVector<Index, Value>::operator!=(
+  const BasicSparseVector &other) const {
+  return !(*this == other);  // must be opposite of == operator.
+}  
+
+// Vector products
+
+// returns the dot product of this and other.  The sum is a Sum:  a long
+// long for ints, since products of ints quickly overflow an int, and a
+// double for floats.
+template <typename Index, typename Value>
+typename BasicSparseVector<Index, Value>::Sum
+BasicSparseVector<Index, Value>::dot(const BasicSparseVector &other) const {
+  assert(mSize == other.getSize());   // the sparse vectors must be the same size
+
+  BasicSparseVector tmp1, tmp2;
+  const BasicSparseVector &a = settled(tmp1), &b = other.settled(tmp2);
+  if (a.mRep == FrozenRep || b.mRep == FrozenRep) {
+    BasicSparseVector tmp3, tmp4;
+    return a.thawed(tmp3).dot(b.thawed(tmp4));
+  }
+  Sum sum = 0;
+
+  if (a.mRep == SparseRep && b.mRep == SparseRep) {
+    const Value *av = a.mValues.data(), *bv = b.mValues.data();
+    forEachCommon(a.mIndices.data(), (int) a.mIndices.size(),
+                  b.mIndices.data(), (int) b.mIndices.size(),
+                  [&](int i, int j) { sum += (Sum) av[i] * bv[j]; });
+  } else if (a.mRep == BitmapRep && b.mRep == BitmapRep) {
+    // the common elements are the bits set in both.
+    for (int w = 0; w < (int) a.mBits.size(); w++) {
+      unsigned long long wa = a.mBits[w], wb = b.mBits[w];
+      for (unsigned long long common = wa & wb; common != 0; common &= common - 1) {
+        unsigned long long below = (common & -common) - 1;
+        sum += (Sum) a.mValues[a.mRanks[w] + __builtin_popcountll(wa & below)] *
+               b.mValues[b.mRanks[w] + __builtin_popcountll(wb & below)];
+      }
+    }
+  } else if (a.mRep == DenseRep && b.mRep == DenseRep) {
+    sum = denseDot(a.mValues.data(), b.mValues.data(), (int) mSize);
+  } else {
+    // walk the vector that is sparser to walk, and look its elements up in
+    // the other, which takes O(1) time in a bitmap or dense array.
+    bool walkA = (a.mRep == SparseRep || b.mRep == DenseRep);
+    const BasicSparseVector &walk = (walkA ? a : b), &look = (walkA ? b : a);
+    walk.forEachElem([&](Index index, Value value) {
+      sum += (Sum) value * look.mainValue(index);
+    });
+  }
+  return sum;
+}
+
+// returns the dot product of this and a dense vector of getSize() values.
+template <typename Index, typename Value>
+typename BasicSparseVector<Index, Value>::Sum
+BasicSparseVector<Index, Value>::dot(const Value *dense) const {
+  BasicSparseVector tmp;
+  const BasicSparseVector &a = settled(tmp);
+  Sum sum = 0;
+  a.forEachElem([&](Index index, Value value) {
+    sum += (Sum) value * dense[index];
+  });
+  return sum;
+}
 
-  node *curr = mStart;
-  node *otherCurr = other.mStart;
+// adds scale * x to this in a single merge, without building scale * x.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::axpy(Value scale, const BasicSparseVector &x) {
+  assert(mSize == x.getSize());   // the sparse vectors must be the same size
 
-  // if we find a node that has a different index or value, the linked lists
-  // are not equal
-  while (curr != 0 && otherCurr != 0) {
-    if ((curr->index != otherCurr->index) || (curr->value != otherCurr->value)) {
-      return false;
+  if (scale != 0) {
+    flush();
+    BasicSparseVector tmp;
+    mergeVectors(*this, x.settled(tmp), scale);
+  }
+  return *this;
+}
+
+// multiplies each element of this by the same element of other, keeping
+// only the elements where both are nonzero.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::multiplyElems(const BasicSparseVector &other) {
+  assert(mSize == other.getSize());   // the sparse vectors must be the same size
+
+  flush();
+  thaw();
+  BasicSparseVector tmp, tmp2;
+  const BasicSparseVector &b =
+    (&other == this ? (tmp = other) : other.settled(tmp).thawed(tmp2));
+
+  if (mRep == SparseRep && b.mRep == SparseRep) {
+    // the survivors are moved down in place, since there can't be more of
+    // them than there were elements.
+    Index *ai = mIndices.data();
+    Value *av = mValues.data();
+    const Value *bv = b.mValues.data();
+    int k = 0;
+    forEachCommon(ai, (int) mIndices.size(),
+                  b.mIndices.data(), (int) b.mIndices.size(),
+                  [&](int i, int j) {
+      Value product = valueOps<Value>::multiply(av[i], bv[j]);
+      if (product != 0) {   // (only if it overflowed, or underflowed)
+        ai[k] = ai[i];
+        av[k++] = product;
+      }
+    });
+    mIndices.resize(k);
+    mValues.resize(k);
+  } else if (mRep == DenseRep && b.mRep == DenseRep) {
+    Value *av = mValues.data();
+    const Value *bv = b.mValues.data();
+    int count = 0;
+    for (int i = 0; i < mSize; i++) {
+      av[i] = valueOps<Value>::multiply(av[i], bv[i]);
+      count += (av[i] != 0);
     }
-    curr = curr->next;
-    otherCurr = otherCurr->next;
+    mNumNonzeros = count;
+  } else {
+    // walk one vector as in dot(), looking up the other, and collect the
+    // products in index order as sorted arrays.
+    bool walkThis = (mRep == SparseRep || b.mRep == DenseRep);
+    const BasicSparseVector &walk = (walkThis ? *this : b);
+    const BasicSparseVector &look = (walkThis ? b : *this);
+    growScratch(walk.mainCount());
+    Index *outIndices = scratchIndices.data();
+    Value *outValues = scratchValues.data();
+    int k = 0;
+    walk.forEachElem([&](Index index, Value value) {
+      Value product = valueOps<Value>::multiply(value, look.mainValue(index));
+      if (product != 0) {
+        outIndices[k] = index;
+        outValues[k++] = product;
+      }
+    });
+
+    scratchIndices.resize(k);
+    scratchValues.resize(k);
+    mIndices.swap(scratchIndices);
+    mValues.swap(scratchValues);
+    trimScratch();
+    mBits.clear();
+    mRanks.clear();
+    mRep = SparseRep;
   }
 
-  // if we reached the end of one linked list before the other, the linked lists 
-  // are not equal.  If this happens, one linked list will be at at 0 node
-  // while the other is still at a valid node.
-  if ((curr == 0 && otherCurr != 0) || (curr != 0 && otherCurr == 0)) {
-    return false;
+  adapt();
+  validate();
+  return *this;
+}
+
+// Sums
+
+// the sum of the vectors, for sum().  Every input is split by index range
+// into one piece per chunk, and each chunk sums its pieces, either by
+// merging them through a heap or by adding them into an array for the
+// chunk's range of indices.  The chunks' sums are then joined together.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>
+BasicSparseVector<Index, Value>::sumVectors(
+  const std::vector<const BasicSparseVector *> &vectors) {
+  if (vectors.empty()) {
+    return BasicSparseVector();
   }
 
-  return true;
-} 
+  Index size = vectors[0]->mSize;
+  int k = (int) vectors.size();
+  std::vector<BasicSparseVector> tmps(k);
+  std::vector<const BasicSparseVector *> inputs(k);
+  long total = 0;
+  bool allSparse = true;
+  for (int v = 0; v < k; v++) {
+    assert(vectors[v]->mSize == size);   // the vectors must be the same size
+    inputs[v] = &vectors[v]->settled(tmps[v]);
+    if (inputs[v]->mRep == FrozenRep) {
+      inputs[v] = &inputs[v]->thawed(tmps[v]);
+    }
+    total += inputs[v]->mainCount();
+    allSparse = allSparse && (inputs[v]->mRep == SparseRep);
+  }
+  // (walking a bitmap or dense input costs O(size) anyway)
+  bool useHeap = (allSparse && size > HeapRatio * total);
+
+  int chunks = numChunks(total, EntriesPerChunk);
+  std::vector<std::vector<Index> > chunkIndices(chunks);
+  std::vector<std::vector<Value> > chunkValues(chunks);
+  parallelFor(size, chunks, [&](int c, long lo, long hi) {
+    std::vector<Index> &outIndices = chunkIndices[c];
+    std::vector<Value> &outValues = chunkValues[c];
+
+    if (useHeap) {
+      // the heap holds the next index of each input, and which input it is.
+      typedef std::pair<Index, int> heapEntry;
+      std::priority_queue<heapEntry, std::vector<heapEntry>,
+                          std::greater<heapEntry> > heap;
+      std::vector<int> pos(k), end(k);
+      for (int v = 0; v < k; v++) {
+        const std::vector<Index> &indices = inputs[v]->mIndices;
+        pos[v] = inputs[v]->findPos((Index) lo);
+        end[v] = inputs[v]->findPos((Index) hi);
+        if (pos[v] < end[v]) {
+          heap.push(heapEntry(indices[pos[v]], v));
+        }
+      }
 
-// return true iff at least 1 node of this does not other SparseVector
-bool SparseVector::operator!=(const SparseVector &other) const {
-  return !(*this == other);  // must be opposite of == operator.
-}  
+      while (!heap.empty()) {
+        Index index = heap.top().first;
+        Value sum = 0;   // (wraps on overflow, as += does)
+        while (!heap.empty() && heap.top().first == index) {
+          int v = heap.top().second;
+          heap.pop();
+          sum = valueOps<Value>::add(sum, inputs[v]->mValues[pos[v]++]);
+          if (pos[v] < end[v]) {
+            heap.push(heapEntry(inputs[v]->mIndices[pos[v]], v));
+          }
+        }
+        if (sum != 0) {
+          outIndices.push_back(index);
+          outValues.push_back(sum);
+        }
+      }
+    } else {
+      std::vector<Value> acc(hi - lo, 0);
+      for (int v = 0; v < k; v++) {
+        inputs[v]->forEachElemIn((Index) lo, (Index) hi,
+                                 [&](Index index, Value value) {
+          acc[index - lo] = valueOps<Value>::add(acc[index - lo], value);
+        });
+      }
+      for (long i = 0; i < hi - lo; i++) {
+        if (acc[i] != 0) {
+          outIndices.push_back((Index) (lo + i));
+          outValues.push_back(acc[i]);
+        }
+      }
+    }
+  });
+
+  BasicSparseVector result(size);
+  if (chunks == 1) {
+    result.mIndices.swap(chunkIndices[0]);
+    result.mValues.swap(chunkValues[0]);
+  } else {
+    for (int c = 0; c < chunks; c++) {
+      result.mIndices.insert(result.mIndices.end(), chunkIndices[c].begin(),
+                             chunkIndices[c].end());
+      result.mValues.insert(result.mValues.end(), chunkValues[c].begin(),
+                            chunkValues[c].end());
+    }
+  }
+  result.adapt();
+  result.validate();
+  return result;
+}
 
 // Private helper functions
 
-void SparseVector::addSubVector(const SparseVector &other, bool add) {
-
-  int sign = (add ? 1 : -1);  // sign value to help with add vs subtract
-
-  node *prev = 0;
-  node *curr = mStart;
-  node *otherCurr = other.mStart;
-  while (curr != 0 && otherCurr != 0) {
-    int i = curr->index;
-    int j = otherCurr->index;
-    if (i == j) {
-      // if have a node from both lists at this an index, add the value from
-      // other list's node to this list's node.
-      curr->value += sign * otherCurr->value;
-      prev = curr;
-      curr = curr->next;
-      otherCurr = otherCurr->next;
-    } else if (i < j) {
-      // this has an node at the index, but other doesn't.
-      // no change, just move to next node of this.
-      prev = curr;
-      curr = curr->next;
-    } else {
-      // this has no node at the index, but other does.
-      // need to an a new node into this.
-      node *insertNode = new node(otherCurr->index, sign * otherCurr->value);
-      if (prev == 0) { // if we are inserting the first node, update start
-        mStart = insertNode;
-        mStart->next = curr;
-        prev = mStart;
-      } else {    // else, fix linking by skipping over curr
-        prev->next = insertNode;
-        insertNode->next = curr;
-        prev = insertNode;
-      }
-      otherCurr = otherCurr->next;  // advance other's node
-    }
-  }
-
-  // if we reached the end of our list first, we need to add the rest of the 
-  // other nodes.
-  while (curr == 0 && otherCurr != 0) {
-    node *insertNode = new node(otherCurr->index, sign * otherCurr->value);
-    if (prev == 0) { // if we are copying to the first node, update start
-      mStart = insertNode;
-      prev = mStart;
-    } else {    // else, add to the end
-      prev->next = insertNode;
-      prev = insertNode;
-    }
-    otherCurr = otherCurr->next;
-  }
-}
-
-void SparseVector::removeZeros() {
-
-  // Use prev and curr to keep track of nodes
-  node *prev = 0;
-  node *curr = mStart;
-
-  checkListOrder();
-  while (curr != 0) {
-    if (curr->value == 0) {    // if the value of the node is 0, remove it
-      node *nextNode = curr->next;
-      if (prev == 0) { // if we are removing the first node, update start
-        mStart = nextNode;
-      } else {    // else, fix linking by skipping over curr
-        prev->next = nextNode;
-      }
-      delete curr;  // remove the node with zero value
-      curr = nextNode; // move to next node (note that prev is not changed)
+// returns the position of the first stored element whose index is not less
+// than index (which is the number of stored elements if there is none).
+// Sorted arrays only.
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::findPos(Index index) const {
+  return (int) (std::lower_bound(mIndices.begin(), mIndices.end(), index) -
+                mIndices.begin());
+}
+
+// the same as findPos(), but searching outwards from position hint, so
+// that it takes O(log d) steps when the answer is d positions away.
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::findPosFrom(Index index, int hint) const {
+  return gallop(mIndices.data(), (int) mIndices.size(), index, hint);
+}
+
+// the same as findPos(), but in the buffer of pending changes.
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::findPendingPos(Index index) const {
+  return (int) (std::lower_bound(mPendingIndices.begin(),
+                                 mPendingIndices.end(), index) -
+                mPendingIndices.begin());
+}
+
+// returns the position in mValues of the element at index, or -1 if it is
+// not stored (ignoring pending changes).  A bitmap finds the position by
+// counting the bits set before the element's bit.
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::mainPos(Index index) const {
+  switch (mRep) {
+  case SparseRep: {
+    int pos = findPos(index);
+    return (pos < (int) mIndices.size() && mIndices[pos] == index ? pos : -1);
+  }
+  case BitmapRep: {
+    unsigned long long word = mBits[index >> 6];
+    unsigned long long bit = 1ULL << (index & 63);
+    if ((word & bit) == 0) {
+      return -1;
+    }
+    return mRanks[index >> 6] + __builtin_popcountll(word & (bit - 1));
+  }
+  case FrozenRep: {
+    // find the last block starting at or before index, and search it.
+    int block = (int) (std::upper_bound(mBlockFirst.begin(), mBlockFirst.end(),
+                                        index) - mBlockFirst.begin()) - 1;
+    if (block < 0) {
+      return -1;
+    }
+    Index indices[FrozenBlockSize];
+    int count = decodeBlock(block, indices);
+    int pos = (int) (std::lower_bound(indices, indices + count, index) - indices);
+    return (pos < count && indices[pos] == index ?
+            block * FrozenBlockSize + pos : -1);
+  }
+  default:
+    return (mValues[index] != 0 ? index : -1);
+  }
+}
+
+// returns the value of the element at index, ignoring pending changes.
+template <typename Index, typename Value>
+Value BasicSparseVector<Index, Value>::mainValue(Index index) const {
+  int pos = mainPos(index);
+  return (pos < 0 ? 0 : mValues[pos]);
+}
+
+// returns the number of nonzero elements, ignoring pending changes.
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::mainCount() const {
+  switch (mRep) {
+  case SparseRep:
+    return (int) mIndices.size();
+  case BitmapRep:
+  case FrozenRep:
+    return (int) mValues.size();
+  default:
+    return mNumNonzeros;
+  }
+}
+
+// calls func(index, value) for every nonzero element, in index order.
+// There must be no pending changes.
+template <typename Index, typename Value>
+template <typename Func>
+void BasicSparseVector<Index, Value>::forEachElem(Func func) const {
+  forEachElemIn(0, mSize, func);
+}
+
+// the same as forEachElem(), but only for the elements with indices in
+// [lo, hi).
+template <typename Index, typename Value>
+template <typename Func>
+void BasicSparseVector<Index, Value>::forEachElemIn(Index lo, Index hi,
+                                                   Func func) const {
+  assert(mPendingIndices.empty());
+  if (lo >= hi) {
+    return;
+  }
+
+  switch (mRep) {
+  case SparseRep:
+    for (int i = findPos(lo); i < (int) mIndices.size() && mIndices[i] < hi; i++) {
+      func(mIndices[i], mValues[i]);
+    }
+    break;
+  case BitmapRep: {
+    // start part way through lo's word, at the value of its first bit set
+    // from lo on.
+    int w = (int) (lo >> 6);
+    unsigned long long below = (1ULL << (lo & 63)) - 1;
+    int k = mRanks[w] + __builtin_popcountll(mBits[w] & below);
+    for (unsigned long long bits = mBits[w] & ~below; ; bits = mBits[w]) {
+      for (; bits != 0; bits &= bits - 1) {
+        Index index = 64 * w + __builtin_ctzll(bits);
+        if (index >= hi) {
+          return;
+        }
+        func(index, mValues[k++]);
+      }
+      if (++w == (int) mBits.size() || 64 * w >= hi) {
+        break;
+      }
+    }
+    break;
+  }
+  case FrozenRep: {
+    // decode from the block holding lo (if any), a block at a time.
+    Index indices[FrozenBlockSize];
+    int block = (int) (std::upper_bound(mBlockFirst.begin(), mBlockFirst.end(),
+                                        lo) - mBlockFirst.begin()) - 1;
+    for (block = std::max(block, 0);
+         block < (int) mBlockFirst.size() && mBlockFirst[block] < hi; block++) {
+      int count = decodeBlock(block, indices);
+      const Value *values = mValues.data() + (long) block * FrozenBlockSize;
+      for (int i = 0; i < count && indices[i] < hi; i++) {
+        if (indices[i] >= lo) {
+          func(indices[i], values[i]);
+        }
+      }
+    }
+    break;
+  }
+  case DenseRep:
+    for (Index i = lo; i < hi; i++) {
+      if (mValues[i] != 0) {
+        func(i, mValues[i]);
+      }
+    }
+    break;
+  }
+}
+
+// returns this vector if it has no pending changes.  Otherwise copies it
+// into tmp, applies the changes there, and returns tmp.  Operations that
+// walk every element use this, so that they can read a const vector without
+// changing it, at a cost no worse than the walk itself.
+template <typename Index, typename Value>
+const BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::settled(BasicSparseVector &tmp) const {
+  if (mPendingIndices.empty()) {
+    return *this;
+  }
+  tmp = *this;
+  tmp.flush();
+  return tmp;
+}
+
+// returns this vector if it is not frozen, and otherwise decodes it into
+// tmp as sorted arrays and returns tmp.  For operations that have no
+// streaming path for frozen vectors.
+template <typename Index, typename Value>
+const BasicSparseVector<Index, Value> &
+BasicSparseVector<Index, Value>::thawed(BasicSparseVector &tmp) const {
+  if (mRep != FrozenRep) {
+    return *this;
+  }
+  tmp = BasicSparseVector(mSize);
+  tmp.mIndices.resize(mValues.size());
+  for (int block = 0; block < (int) mBlockFirst.size(); block++) {
+    decodeBlock(block, tmp.mIndices.data() + (long) block * FrozenBlockSize);
+  }
+  tmp.mValues = mValues;
+  return tmp;
+}
+
+// decodes the indices of a block of a frozen vector into indices, and
+// returns how many there are.  (With SSSE3, int indices are decoded four
+// at a time; see decodeGaps().)
+template <typename Index, typename Value>
+int
+BasicSparseVector<Index, Value>::decodeBlock(int block, Index *indices) const {
+  int count = std::min(FrozenBlockSize,
+                       (int) (mValues.size() - (long) block * FrozenBlockSize));
+  int gaps = count - 1;
+  const unsigned char *control = mBytes.data() + mBlockStart[block];
+  indices[0] = mBlockFirst[block];
+  decodeGaps(control, control + (gaps + 3) / 4, gaps, indices);
+  return count;
+}
+
+// merge the buffer of pending changes into the main arrays.  A pending
+// value replaces the main array's value at the same index, and a pending
+// zero removes it.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::flush() {
+  if (mPendingIndices.empty()) {
+    return;
+  }
+  if (mRep == BitmapRep) {
+    flushBitmap();
+    return;
+  }
+
+  int n = (int) mIndices.size();
+  int m = (int) mPendingIndices.size();
+  growScratch(n + m);
+
+  const Index *ai = mIndices.data(), *bi = mPendingIndices.data();
+  const Value *av = mValues.data(), *bv = mPendingValues.data();
+  Index *outIndices = scratchIndices.data();
+  Value *outValues = scratchValues.data();
+  int i = 0, j = 0, k = 0;
+  while (j < m) {
+    if (i < n && ai[i] < bi[j]) {
+      outIndices[k] = ai[i];
+      outValues[k++] = av[i++];
     } else {
-      prev = curr;    // Done with current node!
-      curr = curr->next;  // Move to next node
+      if (i < n && ai[i] == bi[j]) {
+        i++;  // replaced (or removed) by the pending value
+      }
+      if (bv[j] != 0) {
+        outIndices[k] = bi[j];
+        outValues[k++] = bv[j];
+      }
+      j++;
     }
   }
+  for (; i < n; i++, k++) {
+    outIndices[k] = ai[i];
+    outValues[k] = av[i];
+  }
+
+  scratchIndices.resize(k);
+  scratchValues.resize(k);
+  mIndices.swap(scratchIndices);
+  mValues.swap(scratchValues);
+  trimScratch();
 
-  checkListOrder();
+  mPendingIndices.clear();
+  mPendingValues.clear();
+
+  adapt();
+  validate();
 }
 
-// look for node with the right index, and set it to value.
-// if we can't find the right index, insert a new node in the right place
-void SparseVector::setNonzeroElem(int index, int value) {
-  assert(value != 0);
+// merge the pending changes once there are too many of them.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::flushIfFull() {
+  int limit = std::max(MinPending,
+                       (int) (PendingFactor * sqrt((double) mainCount())));
+  if ((int) mPendingIndices.size() > limit) {
+    flush();
+  }
+}
+
+// flush() for a bitmap:  the pending elements in each word of the bitmap
+// are merged with the word's packed values, and the values of the words in
+// between are copied along in one go.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::flushBitmap() {
+  int n = (int) mValues.size();
+  int m = (int) mPendingIndices.size();
+  growScratchValues(n + m);
+
+  const Index *bi = mPendingIndices.data();
+  const Value *av = mValues.data(), *bv = mPendingValues.data();
+  Value *out = scratchValues.data();
+  int words = (int) mBits.size();
+  int i = 0, j = 0, k = 0;
+  for (int w = 0; w < words; w++) {
+    // words up to the next pending change keep their values.
+    int next = (j < m ? (int) (bi[j] >> 6) : words);
+    int start = i;
+    for (; w < next; w++) {
+      mRanks[w] = k + (i - start);
+      i += __builtin_popcountll(mBits[w]);
+    }
+    std::copy(av + start, av + i, out + k);
+    k += i - start;
+    if (w == words) {
+      break;
+    }
+
+    unsigned long long word = mBits[w], pending = 0;
+    int first = j;
+    for (; j < m && (bi[j] >> 6) == w; j++) {
+      pending |= 1ULL << (bi[j] & 63);
+    }
+
+    unsigned long long result = 0;
+    mRanks[w] = k;
+    for (unsigned long long u = word | pending; u != 0; u &= u - 1) {
+      unsigned long long bit = u & -u;
+      Value value = ((word & bit) != 0 ? av[i++] : 0);
+      if ((pending & bit) != 0) {
+        value = bv[first++];
+      }
+      if (value != 0) {
+        out[k++] = value;
+        result |= bit;
+      }
+    }
+    mBits[w] = result;
+  }
+
+  scratchValues.resize(k);
+  mValues.swap(scratchValues);
+  trimScratch();
+
+  mPendingIndices.clear();
+  mPendingValues.clear();
+
+  adapt();
+  validate();
+}
+
+// Representations
+
+// switch to the representation that suits the vector's density.  There
+// must be no pending changes.  Bitmaps and dense arrays are addressed with
+// int positions, so a vector of more than INT_MAX elements (which needs
+// 64-bit indices) always stays as sorted arrays.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::adapt() {
+  assert(mPendingIndices.empty());
+
+  double density = (mSize > 0 ? (double) mainCount() / mSize : 0);
+  Representation rep;
+  if ((long long) mSize > INT_MAX) {
+    rep = SparseRep;
+  } else if (density >= DenseDensity ||
+      (mRep == DenseRep && density >= DenseDensity / 2)) {
+    rep = DenseRep;
+  } else if (density >= BitmapDensity ||
+             (mRep == BitmapRep && density >= BitmapDensity / 2)) {
+    rep = BitmapRep;
+  } else {
+    rep = SparseRep;
+  }
+
+  if (rep == SparseRep) {
+    toSparse();
+  } else if (rep == BitmapRep) {
+    toBitmap();
+  } else {
+    toDense();
+  }
+}
+
+// adapt() if the vector's density has crossed one of the thresholds since
+// its representation was chosen.  This only counts elements, so it is cheap
+// enough to call after every element that bypasses flush():  appends, Cursor
+// writes and changes to dense arrays.  There must be no pending changes.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::adaptIfCrossed() {
+  assert(mPendingIndices.empty());
+  if ((long long) mSize > INT_MAX) {
+    return;
+  }
+
+  double count = mainCount();
+  bool crossed;
+  switch (mRep) {
+  case SparseRep:
+    crossed = (count >= BitmapDensity * mSize);
+    break;
+  case BitmapRep:
+    crossed = (count >= DenseDensity * mSize ||
+               count < BitmapDensity / 2 * mSize);
+    break;
+  case DenseRep:
+    crossed = (count < DenseDensity / 2 * mSize);
+    break;
+  default:
+    crossed = false;   // frozen vectors are chosen for again when thawed
+  }
+
+  if (crossed) {
+    adapt();
+  }
+}
+
+// convert to sorted index and value arrays.  This may be done with changes
+// pending, since it doesn't change which elements are stored.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::toSparse() {
+  if (mRep == SparseRep) {
+    return;
+  }
+
+  if (mRep == BitmapRep) {
+    // the packed values are already in index order; only the indices need
+    // to be listed.
+    mIndices.resize(mValues.size());
+    for (int w = 0, k = 0; w < (int) mBits.size(); w++) {
+      for (unsigned long long bits = mBits[w]; bits != 0; bits &= bits - 1) {
+        mIndices[k++] = 64 * w + __builtin_ctzll(bits);
+      }
+    }
+  } else if (mRep == FrozenRep) {
+    // the values are in order too; the indices are decoded.
+    mIndices.resize(mValues.size());
+    for (int block = 0; block < (int) mBlockFirst.size(); block++) {
+      decodeBlock(block, mIndices.data() + (long) block * FrozenBlockSize);
+    }
+    std::vector<unsigned char>().swap(mBytes);
+    std::vector<Index>().swap(mBlockFirst);
+    std::vector<long>().swap(mBlockStart);
+  } else {
+    // move the nonzero values down to the front.
+    mIndices.resize(mNumNonzeros);
+    int k = 0;
+    for (int i = 0; i < mSize; i++) {
+      if (mValues[i] != 0) {
+        mIndices[k] = i;
+        mValues[k++] = mValues[i];
+      }
+    }
+    mValues.resize(k);
+  }
+
+  std::vector<unsigned long long>().swap(mBits);
+  std::vector<int>().swap(mRanks);
+  mRep = SparseRep;
+}
 
-  // Use prev and curr to keep track of nodes
-  node *prev = 0;
-  node *curr = mStart;
+// convert to a bitmap and packed values.  There must be no pending changes.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::toBitmap() {
+  assert(mPendingIndices.empty());
+  if (mRep == BitmapRep) {
+    return;
+  }
+  toSparse();
+
+  int words = numWords(mSize);
+  mBits.assign(words, 0);
+  for (size_t i = 0; i < mIndices.size(); i++) {
+    mBits[mIndices[i] >> 6] |= 1ULL << (mIndices[i] & 63);
+  }
+  mRanks.resize(words);
+  for (int w = 0, k = 0; w < words; w++) {
+    mRanks[w] = k;
+    k += __builtin_popcountll(mBits[w]);
+  }
+
+  std::vector<Index>().swap(mIndices);
+  mRep = BitmapRep;
+}
 
-  // find the node we need to insert in front of.
-  while (curr != 0 && curr->index <= index) {
-    if (curr->index == index) {
-      curr->value = value;  // if we found the index, set new value. Done.
+// convert to a dense array.  There must be no pending changes.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::toDense() {
+  assert(mPendingIndices.empty());
+  if (mRep == DenseRep) {
+    return;
+  }
+  toSparse();   // (only needed for a frozen vector, whose arrays it drops)
+
+  std::vector<Value> values(mSize, 0);
+  forEachElem([&](Index index, Value value) { values[index] = value; });
+  mNumNonzeros = mainCount();
+  mValues.swap(values);
+
+  std::vector<Index>().swap(mIndices);
+  std::vector<unsigned long long>().swap(mBits);
+  std::vector<int>().swap(mRanks);
+  mRep = DenseRep;
+}
+
+// Merging
+
+// merge other into this (or subtract it from this)
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::addSubVector(
+  const BasicSparseVector &other, bool add) {
+  flush();
+  mergeVectors(*this, other, (Value) (add ? 1 : -1));
+}
+
+// set this to a + scale * b.  Elements that cancel out are left out, so no
+// zeros are stored.  Either vector may be this one, and neither may have
+// pending changes.  Sorted arrays are merged with mergeScaled(); if either
+// vector is dense the result is built densely; otherwise the two are
+// merged as bitmaps.  Then the result's representation is chosen afresh.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::mergeVectors(const BasicSparseVector &a,
+                                                   const BasicSparseVector &b,
+                                                   Value scale) {
+  assert(a.mPendingIndices.empty() && b.mPendingIndices.empty());
+  assert(a.mSize == b.mSize);
+
+  if (a.mRep == FrozenRep || b.mRep == FrozenRep) {
+    // a frozen vector is decoded as it is merged with sorted arrays;
+    // otherwise it is decoded first.
+    if ((a.mRep == FrozenRep && b.mRep == SparseRep) ||
+        (a.mRep == SparseRep && b.mRep == FrozenRep)) {
+      mergeFrozen(a, b, scale);
+    } else {
+      BasicSparseVector tmp1, tmp2;
+      mergeVectors(a.thawed(tmp1), b.thawed(tmp2), scale);
       return;
     }
-    prev = curr;         // Done with current node!
-    curr = curr->next;  // Move to the next node
+  } else if (a.mRep == DenseRep || b.mRep == DenseRep) {
+    mergeDense(a, b, scale);
+  } else if (a.mRep == BitmapRep || b.mRep == BitmapRep) {
+    mergeBitmaps(a, b, scale);
+  } else {
+    int n = (int) a.mIndices.size();
+    int m = (int) b.mIndices.size();
+    growScratch(n + m);
+    int chunks = numChunks((long) n + m, EntriesPerChunk);
+
+    int k;
+    if (chunks == 1) {
+      k = mergeScaled(a.mIndices.data(), a.mValues.data(), n,
+                      b.mIndices.data(), b.mValues.data(), m, scale,
+                      scratchIndices.data(), scratchValues.data());
+    } else {
+      k = mergeScaledParallel(a.mIndices.data(), a.mValues.data(), n,
+                              b.mIndices.data(), b.mValues.data(), m, scale,
+                              chunks, scratchIndices.data(), scratchValues.data());
+    }
+
+    scratchIndices.resize(k);
+    scratchValues.resize(k);
+    mSize = a.mSize;
+    mIndices.swap(scratchIndices);
+    mValues.swap(scratchValues);
+    trimScratch();
+    mBits.clear();
+    mRanks.clear();
+    mRep = SparseRep;
   }
 
-  node *insertNode = new node(index, value);
+  adapt();
+  validate();
+}
 
-  // If curr != 0, we found a place to insert in front of.  We have already 
-  // created the node, but we need its next to point to the current node to 
-  // correctly link it up.
-  if (curr != 0) { 
-    insertNode->next = curr;
+// set this to a + scale * b as a dense array:  a is copied or scattered
+// into it, and then b is added in the same way.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::mergeDense(const BasicSparseVector &a,
+                                                 const BasicSparseVector &b,
+                                                 Value scale) {
+  int size = (int) a.mSize;
+  growScratchValues(size);
+  Value *out = scratchValues.data();
+
+  if (a.mRep == DenseRep) {
+    std::copy(a.mValues.begin(), a.mValues.end(), out);
+  } else {
+    std::fill(out, out + size, 0);
+    a.forEachElem([&](Index index, Value value) { out[index] = value; });
   }
 
-  // update the previous node, depending on whether we are trying to add to the
-  // beginning of the list or not.
-  if (prev != 0) {     // add correct link to new node if we are not at start
-    prev->next = insertNode;
+  // (int arithmetic wraps on overflow, as the other merges do.)
+  if (b.mRep == DenseRep) {
+    addScaledDense(out, b.mValues.data(), scale, size);
   } else {
-    mStart = insertNode;  // if we are at beginning of list, update start.
+    b.forEachElem([&](Index index, Value value) {
+      out[index] = valueOps<Value>::addScaled(out[index], scale, value);
+    });
   }
 
+  int count = 0;
+  for (int i = 0; i < size; i++) {
+    count += (out[i] != 0);
+  }
 
-  checkListOrder(); // make sure we didn't mangle list
+  scratchValues.resize(size);
+  mSize = size;
+  mValues.swap(scratchValues);
+  trimScratch();
+  mIndices.clear();
+  mBits.clear();
+  mRanks.clear();
+  mNumNonzeros = count;
+  mRep = DenseRep;
 }
 
-// if set value to 0, remove the node at the given index
-void SparseVector::removeElem(int index) {
-  node *prev = 0;
-  node *curr = mStart;
+// set this to a + scale * b as a bitmap, a word at a time:  the result's
+// candidate elements in each word are the bits set in either input.  One
+// of a and b may be sorted arrays, which are turned into a bitmap first.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::mergeBitmaps(const BasicSparseVector &a,
+                                                   const BasicSparseVector &b,
+                                                   Value scale) {
+  BasicSparseVector tmp;
+  const BasicSparseVector *pa = &a, *pb = &b;
+  if (a.mRep != BitmapRep) {
+    tmp = a;
+    tmp.toBitmap();
+    pa = &tmp;
+  } else if (b.mRep != BitmapRep) {
+    tmp = b;
+    tmp.toBitmap();
+    pb = &tmp;
+  }
 
-  // try to find the correct node to remove
-  while (curr != 0) {
-    if (curr->index == index) {  // we found the correct node
-      break;
+  int words = numWords(a.mSize);
+  std::vector<unsigned long long> bits(words);
+  std::vector<int> ranks(words);
+  int n = (int) pa->mValues.size(), m = (int) pb->mValues.size();
+  growScratchValues(n + m);
+  Value *out = scratchValues.data();
+  const Value *av = pa->mValues.data(), *bv = pb->mValues.data();
+
+  // The loop is branch-free, like mergeScaled():  each step loads the next
+  // value of both inputs and leaves out the one whose bit isn't set.  Loads
+  // past the end of an input are clamped to its last value (or a zero, if
+  // it has none), and are always left out.
+  static const Value none = 0;
+  if (n == 0) {
+    av = &none;
+  }
+  if (m == 0) {
+    bv = &none;
+  }
+  int lastA = std::max(n - 1, 0), lastB = std::max(m - 1, 0);
+
+  int i = 0, j = 0, k = 0;
+  for (int w = 0; w < words; w++) {
+    unsigned long long wa = pa->mBits[w], wb = pb->mBits[w], result = 0;
+    ranks[w] = k;
+    if (wb == 0) {   // (a word of a's alone is copied as it is)
+      int count = __builtin_popcountll(wa);
+      std::copy(av + i, av + i + count, out + k);
+      i += count;
+      k += count;
+      bits[w] = wa;
+      continue;
     }
-    if (curr->index > index) { 
-      return;  // if we passed it, return early
+    for (unsigned long long u = wa | wb; u != 0; u &= u - 1) {
+      int pos = __builtin_ctzll(u);
+      unsigned int takeA = (unsigned int) (wa >> pos) & 1;
+      unsigned int takeB = (unsigned int) (wb >> pos) & 1;
+      Value value = stepSum(takeA, av[std::min(i, lastA)], takeB, scale,
+                            bv[std::min(j, lastB)]);
+      i += takeA;
+      j += takeB;
+      unsigned int keep = (value != 0);
+      out[k] = value;
+      k += keep;
+      result |= (unsigned long long) keep << pos;
     }
-    prev = curr;
-    curr = curr->next; // Go to the next node
+    bits[w] = result;
+  }
 
+  scratchValues.resize(k);
+  mSize = a.mSize;
+  mValues.swap(scratchValues);
+  trimScratch();
+  mBits.swap(bits);
+  mRanks.swap(ranks);
+  mIndices.clear();
+  mRep = BitmapRep;
+}
+
+// set this to a + scale * b, where one of them is frozen and the other is
+// sorted arrays.  The frozen one is decoded a block at a time and merged
+// with the other's elements up to the start of its next block.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::mergeFrozen(const BasicSparseVector &a,
+                                                  const BasicSparseVector &b,
+                                                  Value scale) {
+  bool aFrozen = (a.mRep == FrozenRep);
+  const BasicSparseVector &frozen = (aFrozen ? a : b);
+  const BasicSparseVector &other = (aFrozen ? b : a);
+  const Index *oi = other.mIndices.data();
+  const Value *ov = other.mValues.data();
+  int n = (int) frozen.mValues.size(), m = (int) other.mIndices.size();
+  growScratch(n + m);
+  Index *outIndices = scratchIndices.data();
+  Value *outValues = scratchValues.data();
+
+  Index indices[FrozenBlockSize];
+  int blocks = (int) frozen.mBlockFirst.size();
+  int j = 0, k = 0;
+  // (with no blocks at all, one pass still takes all of the other's
+  // elements)
+  for (int block = 0; block < std::max(blocks, 1); block++) {
+    int count = 0;
+    const Value *values = 0;
+    if (block < blocks) {
+      count = frozen.decodeBlock(block, indices);
+      values = frozen.mValues.data() + (long) block * FrozenBlockSize;
+    }
+    int end = (block + 1 < blocks ?
+               gallop(oi, m, frozen.mBlockFirst[block + 1], j) : m);
+    if (aFrozen) {
+      k += mergeScaled(indices, values, count, oi + j, ov + j, end - j, scale,
+                       outIndices + k, outValues + k);
+    } else {
+      k += mergeScaled(oi + j, ov + j, end - j, indices, values, count, scale,
+                       outIndices + k, outValues + k);
+    }
+    j = end;
   }
 
-  if (curr == 0) {  // if we didn't find index, nothing to remove
+  scratchIndices.resize(k);
+  scratchValues.resize(k);
+  mSize = a.mSize;
+  mIndices.swap(scratchIndices);
+  mValues.swap(scratchValues);
+  trimScratch();
+  std::vector<unsigned char>().swap(mBytes);
+  std::vector<Index>().swap(mBlockFirst);
+  std::vector<long>().swap(mBlockStart);
+  mBits.clear();
+  mRanks.clear();
+  mRep = SparseRep;
+}
+
+// Element changes
+
+// set the element at index to a nonzero value.  A dense array is updated
+// directly, as is an element that is already stored; a new element goes
+// into the buffer of pending changes, unless it can be appended.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::setNonzeroElem(Index index, Value value) {
+  assert(value != 0);
+
+  if (mRep == DenseRep) {
+    mNumNonzeros += (mValues[index] == 0);
+    mValues[index] = value;
+    validate();
     return;
   }
 
-  if (curr == mStart) {  // if we remove start node, update start
-    mStart = curr->next;
+  // appending after the last element, with nothing pending, is cheap.
+  if (mRep == SparseRep && mPendingIndices.empty() &&
+      (mIndices.empty() || index > mIndices.back())) {
+    mIndices.push_back(index);
+    mValues.push_back(value);
+    adaptIfCrossed();
+    validate();
+    return;
   }
 
-  if (prev != 0) {   // fix the linked list to skip over the removed node
-    prev->next = curr->next;
+  int pos = mainPos(index);
+  int pend = findPendingPos(index);
+  bool inPending = (pend < (int) mPendingIndices.size() &&
+                    mPendingIndices[pend] == index);
+
+  if (pos >= 0) {
+    mValues[pos] = value;  // if we found the index, set new value.
+    if (inPending) {       // ... and cancel its pending removal
+      mPendingIndices.erase(mPendingIndices.begin() + pend);
+      mPendingValues.erase(mPendingValues.begin() + pend);
+    }
+  } else if (inPending) {
+    mPendingValues[pend] = value;
+  } else {
+    mPendingIndices.insert(mPendingIndices.begin() + pend, index);
+    mPendingValues.insert(mPendingValues.begin() + pend, value);
+    flushIfFull();
+  }
+
+  validate(); // make sure we didn't mangle the arrays
+}
+
+// if set value to 0, remove the element at the given index.  An element in
+// a dense array is simply zeroed; other stored elements are removed by a
+// pending zero, and a pending element is dropped.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::removeElem(Index index) {
+  if (mRep == DenseRep) {
+    mNumNonzeros -= (mValues[index] != 0);
+    mValues[index] = 0;
+    adaptIfCrossed();
+    validate();
+    return;
   }
 
-  delete curr;  // remove the node
+  bool inMain = (mainPos(index) >= 0);
+  int pend = findPendingPos(index);
+  bool inPending = (pend < (int) mPendingIndices.size() &&
+                    mPendingIndices[pend] == index);
+
+  if (inMain && !inPending) {
+    mPendingIndices.insert(mPendingIndices.begin() + pend, index);
+    mPendingValues.insert(mPendingValues.begin() + pend, 0);
+    flushIfFull();
+  } else if (!inMain && inPending) {
+    mPendingIndices.erase(mPendingIndices.begin() + pend);
+    mPendingValues.erase(mPendingValues.begin() + pend);
+  }
+  // (if the index is in both, its removal is already pending, and if it is
+  // in neither there is nothing to remove)
 
-  checkListOrder();  // make sure we didn't mangle list
+  validate();  // make sure we didn't mangle the arrays
 }
 
 // private debugging functions
 
-// loop through all nodes of linked list, print some debugging output if
-// indices somehow get out of order.
-void SparseVector::checkListOrder() const{
-  if (mStart == 0) {
-    return;
+// run the debugging checks if SPARSEVECTOR_CHECKS asks for it, and abort if
+// they fail.  This does not rely on assert(), so that sampled checks still
+// work in builds with NDEBUG defined.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::validate() const {
+#if SPARSEVECTOR_CHECKS >= 2
+  bool check = true;
+#elif SPARSEVECTOR_CHECKS == 1
+  static thread_local unsigned long changes = 0;
+  bool check = (++changes % SPARSEVECTOR_CHECK_RATE == 0);
+#else
+  bool check = false;
+#endif
+
+  if (check && !(checkListOrder() && checkZeros())) {
+    std::abort();
+  }
+}
+
+// check that the arrays of the vector's representation fit together, and
+// print some debugging output if indices somehow get out of order.
+// returns true if all is well.
+template <typename Index, typename Value>
+bool BasicSparseVector<Index, Value>::checkListOrder() const{
+  if (mRep == SparseRep && mIndices.size() != mValues.size()) {
+    std::cout << "-------------------------------------" << std::endl;
+    std::cout << "Index and value arrays differ in length!" << std::endl;
+    return false;
+  }
+
+  if (mRep == FrozenRep) {
+    // every block must decode to indices in order, that carry on from the
+    // block before.
+    int blocks = (int) mBlockFirst.size();
+    bool good = (blocks == ((int) mValues.size() + FrozenBlockSize - 1) /
+                           FrozenBlockSize &&
+                 (int) mBlockStart.size() == blocks &&
+                 mIndices.empty() && mPendingIndices.empty());
+    Index indices[FrozenBlockSize], last = -1;
+    for (int block = 0; good && block < blocks; block++) {
+      int count = decodeBlock(block, indices);
+      for (int i = 0; i < count; i++) {
+        good = good && (indices[i] > last && indices[i] < mSize);
+        last = indices[i];
+      }
+    }
+    if (!good) {
+      std::cout << "-------------------------------------" << std::endl;
+      std::cout << "Frozen indices are out of order!" << std::endl;
+      return false;
+    }
+  }
+
+  if (mRep == BitmapRep) {
+    int words = numWords(mSize);
+    bool good = ((int) mBits.size() == words && (int) mRanks.size() == words);
+    for (int w = 0, k = 0; good && w < words; w++) {
+      good = (mRanks[w] == k);
+      k += __builtin_popcountll(mBits[w]);
+      good = good && (w + 1 < words || k == (int) mValues.size());
+    }
+    if (good && mSize % 64 != 0) {   // no bits past the end
+      good = ((mBits[words - 1] >> (mSize % 64)) == 0);
+    }
+    if (!good) {
+      std::cout << "-------------------------------------" << std::endl;
+      std::cout << "Bitmap doesn't match its values!" << std::endl;
+      return false;
+    }
+  }
+
+  if (mRep == DenseRep) {
+    int count = 0;
+    for (size_t i = 0; i < mValues.size(); i++) {
+      count += (mValues[i] != 0);
+    }
+    if ((int) mValues.size() != mSize || count != mNumNonzeros ||
+        !mPendingIndices.empty()) {
+      std::cout << "-------------------------------------" << std::endl;
+      std::cout << "Dense array has the wrong size or count!" << std::endl;
+      return false;
+    }
   }
-  node *prev = 0;
-  node *curr = mStart;
 
-  while (curr != 0) {
-    if ((prev != 0) && (curr->index <= prev->index)) {
+  for (size_t i = 1; i < mIndices.size(); i++) {
+    if (mIndices[i] <= mIndices[i - 1]) {
 
       std::cout << "-------------------------------------" << std::endl;
-      std::cout << "Nodes are our of order!" << std::endl;
+      std::cout << "Elements are out of order!" << std::endl;
 
-      std::cout << "Previous Index: " << prev->index << std::endl;
-      std::cout << "Previous Value: " << prev->value << std::endl;
+      std::cout << "Previous Index: " << mIndices[i - 1] << std::endl;
+      std::cout << "Previous Value: " << mValues[i - 1] << std::endl;
 
-      std::cout << "Current Index: " << curr->index << std::endl;
-      std::cout << "Current Value: " << curr->value << std::endl;
+      std::cout << "Current Index: " << mIndices[i] << std::endl;
+      std::cout << "Current Value: " << mValues[i] << std::endl;
 
-      node *next = curr->next;
-      if (next != 0) {
-        std::cout << "Next Index: " << next->index << std::endl;
-        std::cout << "Next Value: " << next->value << std::endl;
+      if (i + 1 < mIndices.size()) {
+        std::cout << "Next Index: " << mIndices[i + 1] << std::endl;
+        std::cout << "Next Value: " << mValues[i + 1] << std::endl;
       }
 
-      assert (0 > 1); // trip an assertion so we know where we messed up
+      return false;
     }
+  }
 
-    prev = curr;
-    curr = curr->next;  // go to the next node
+  // pending changes must be in order too, and a pending zero must remove an
+  // element that is stored, while a pending nonzero value must be for an
+  // element that isn't.
+  if (mPendingIndices.size() != mPendingValues.size()) {
+    std::cout << "-------------------------------------" << std::endl;
+    std::cout << "Pending index and value arrays differ in length!" << std::endl;
+    return false;
   }
-}
+  for (size_t i = 0; i < mPendingIndices.size(); i++) {
+    Index index = mPendingIndices[i];
+    bool inMain = (mainPos(index) >= 0);
+    if ((i > 0 && index <= mPendingIndices[i - 1]) ||
+        inMain != (mPendingValues[i] == 0)) {
+      std::cout << "-------------------------------------" << std::endl;
+      std::cout << "Bad pending change!" << std::endl;
+
+      std::cout << "Pending Index: " << index << std::endl;
+      std::cout << "Pending Value: " << mPendingValues[i] << std::endl;
+      std::cout << "Index In Main Arrays: " << inMain << std::endl;
 
-// returns true if there are no nodes with value 0.
-bool SparseVector::checkZeros() const{
-  if (mStart == 0) {
-    return true;
+      return false;
+    }
   }
-  node *prev = 0;
-  node *curr = mStart;
+
+  return true;
+}
+
+// returns true if no stored element has the value 0.  (a dense array
+// stores zeros, of course.)
+template <typename Index, typename Value>
+bool BasicSparseVector<Index, Value>::checkZeros() const{
   bool flag = true;
+  if (mRep == DenseRep) {
+    return flag;
+  }
 
-  while (curr != 0) {
-    if (curr->value == 0) {
+  for (size_t i = 0; i < mValues.size(); i++) {
+    if (mValues[i] == 0) {
       std::cout << "-------------------------------------" << std::endl;
-      std::cout << "There is still a ZERO node!" << std::endl;
+      std::cout << "There is still a ZERO element!" << std::endl;
 
-      std::cout << "Current Index: " << curr->index << std::endl;
-      std::cout << "Current Value: " << curr->value << std::endl;
+      if (mRep == SparseRep) {
+        std::cout << "Current Index: " << mIndices[i] << std::endl;
+      }
+      std::cout << "Current Value: " << mValues[i] << std::endl;
 
       flag = false;
     }
-
-    prev = curr;
-    curr = curr->next;  // go to the next node
   }
 
   return flag;
@@ -391,38 +2224,183 @@ bool SparseVector::checkZeros() const{
 // Accessors:
 
 // get the size of the Sparse Vector
-int SparseVector::getSize() const {
+template <typename Index, typename Value>
+Index BasicSparseVector<Index, Value>::getSize() const {
   return mSize;
 }
 
-// return the value corresponding to the index in the linked list.
-// if the index is not in the linked list, return 0
-int SparseVector::getElem(int idx) const {
-  checkListOrder();  // make sure we aren't trying to traverse a mangled list
-  node *curr = mStart;
-  while (curr != 0) {
-    if (curr->index == idx) {
-      return curr->value;
-    }
-    if (curr->index > idx) {  // if index bigger, can't find
-      return 0;  
-    }
-    curr = curr->next; // Go to the next node
+// return the value corresponding to the index.  if the index is not
+// stored, return 0
+template <typename Index, typename Value>
+Value BasicSparseVector<Index, Value>::getElem(Index idx) const {
+  int pend = findPendingPos(idx);
+  if (pend < (int) mPendingIndices.size() && mPendingIndices[pend] == idx) {
+    return mPendingValues[pend];   // (which is 0 for a pending removal)
   }
-  return 0;  // reached the end of the list.
+  return mainValue(idx);
+}
+
+// get the number of nonzero elements stored
+template <typename Index, typename Value>
+int BasicSparseVector<Index, Value>::getNumNonzeros() const {
+  // each pending value adds an element, and each pending zero removes one.
+  int count = mainCount();
+  for (size_t i = 0; i < mPendingValues.size(); i++) {
+    count += (mPendingValues[i] != 0 ? 1 : -1);
+  }
+  return count;
+}
+
+// get how the elements are currently stored
+template <typename Index, typename Value>
+typename BasicSparseVector<Index, Value>::Representation
+BasicSparseVector<Index, Value>::getRepresentation() const {
+  return mRep;
+}
+
+// get the bytes used by the arrays that hold the elements
+template <typename Index, typename Value>
+long BasicSparseVector<Index, Value>::getStorageSize() const {
+  return (long) ((mIndices.size() + mBlockFirst.size() +
+                  mPendingIndices.size()) * sizeof(Index) +
+                 (mValues.size() + mPendingValues.size()) * sizeof(Value) +
+                 mRanks.size() * sizeof(int) +
+                 mBits.size() * sizeof(unsigned long long) + mBytes.size() +
+                 mBlockStart.size() * sizeof(long));
 }
 
 
 // Mutators
 
-void SparseVector::setElem(int index, int value) {
+// make room for nonzeros elements, so that filling the vector up to that
+// many does not reallocate.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::reserve(int nonzeros) {
+  assert(nonzeros >= 0);
+  mIndices.reserve(nonzeros);
+  mValues.reserve(nonzeros);
+}
+
+// compress the vector into blocks of FrozenBlockSize elements.  Each block
+// keeps its first index in mBlockFirst, and StreamVByte-encodes the gaps
+// from there to the rest of its indices.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::freeze() {
+  flush();
+  if (mRep == FrozenRep) {
+    return;
+  }
+  toSparse();
+
+  int n = (int) mIndices.size();
+  int blocks = (n + FrozenBlockSize - 1) / FrozenBlockSize;
+  mBlockFirst.resize(blocks);
+  mBlockStart.resize(blocks);
+  mBytes.clear();
+  for (int block = 0; block < blocks; block++) {
+    int first = block * FrozenBlockSize;
+    int gaps = std::min(FrozenBlockSize, n - first) - 1;
+    mBlockFirst[block] = mIndices[first];
+    mBlockStart[block] = (long) mBytes.size();
+
+    long control = (long) mBytes.size();
+    mBytes.resize(control + (gaps + 3) / 4, 0);
+    for (int i = 0; i < gaps; i++) {
+      unsigned long long gap = (unsigned long long) (mIndices[first + i + 1] -
+                                                     mIndices[first + i]);
+      int code = 0;
+      while (code < 3 && (gap >> (8 * gapLength<Index>(code))) != 0) {
+        code++;
+      }
+      int length = gapLength<Index>(code);
+      mBytes[control + i / 4] |= (unsigned char) (code << (2 * (i % 4)));
+      for (int byte = 0; byte < length; byte++) {
+        mBytes.push_back((unsigned char) (gap >> (8 * byte)));
+      }
+    }
+  }
+  mBytes.resize(mBytes.size() + FrozenPadding, 0);
+  std::vector<unsigned char>(mBytes).swap(mBytes);   // trim spare capacity
+  std::vector<Value>(mValues).swap(mValues);
+
+  std::vector<Index>().swap(mIndices);
+  mRep = FrozenRep;
+  validate();
+}
+
+// decode a frozen vector again, choosing its representation afresh.
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::thaw() {
+  if (mRep == FrozenRep) {
+    toSparse();
+    adapt();
+    validate();
+  }
+}
 
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::setElem(Index index, Value value) {
+
+  thaw();
   if (value == 0) {
     removeElem(index);
   } else {
     setNonzeroElem(index, value);
   }
+}
+
 
-  assert(checkZeros());
+// Cursors
 
+// Makes a cursor for writing to sv, starting at its first element.
+template <typename Index, typename Value>
+BasicSparseVector<Index, Value>::Cursor::Cursor(BasicSparseVector &sv)
+  : mVector(sv), mPos(0) {
 }
+
+// Sets an element, searching for it from the last element written.  The
+// cursor works on the vector's sorted arrays directly, so any pending
+// changes (from SparseVector::setElem()) are applied first.  Bitmaps and
+// dense arrays are simply written with setElem().
+template <typename Index, typename Value>
+void BasicSparseVector<Index, Value>::Cursor::setElem(Index index,
+                                                     Value value) {
+  BasicSparseVector &sv = mVector;
+  assert(index >= 0 && index < sv.mSize);
+  sv.flush();
+  if (sv.mRep != SparseRep) {
+    sv.setElem(index, value);
+    return;
+  }
+
+  int pos = sv.findPosFrom(index, mPos);
+  bool found = (pos < (int) sv.mIndices.size() && sv.mIndices[pos] == index);
+  if (value != 0) {
+    if (found) {
+      sv.mValues[pos] = value;
+    } else {
+      sv.mIndices.insert(sv.mIndices.begin() + pos, index);
+      sv.mValues.insert(sv.mValues.begin() + pos, value);
+    }
+    mPos = pos + 1;
+  } else {
+    if (found) {
+      sv.mIndices.erase(sv.mIndices.begin() + pos);
+      sv.mValues.erase(sv.mValues.begin() + pos);
+    }
+    mPos = pos;
+  }
+
+  sv.adaptIfCrossed();
+  sv.validate();  // make sure we didn't mangle the arrays
+}
+
+
+// The instantiations that are built:  int or long long indices, with int,
+// float or double values.
+template class BasicSparseVector<int, int>;
+template class BasicSparseVector<int, float>;
+template class BasicSparseVector<int, double>;
+template class BasicSparseVector<long long, int>;
+template class BasicSparseVector<long long, float>;
+template class BasicSparseVector<long long, double>;
@@ -1,64 +1,255 @@
 // A Sparse Vector class!
-// Stores nonzero integer values of a vector which is sparsely populated
+// Stores nonzero values of a vector which is sparsely populated
+//
+// The nonzero elements are kept in two parallel arrays, sorted by index:
+// one of indices and one of values.  Element lookups use binary search, and
+// addition and subtraction merge the two sorted arrays in a single pass.
+// Elements added or removed by setElem() go into a small sorted buffer of
+// pending changes first, which is merged into the main arrays when it
+// fills up, so random inserts don't shift the whole vector each time.
+// Elements set in increasing index order are simply appended; a Cursor
+// does the same for runs of nearby writes in any order.
+//
+// Vectors that fill up are stored differently:  as a bitmap of which
+// elements are nonzero plus their packed values, and beyond that as a plain
+// dense array.  The representation is chosen again after each merge, flush
+// and product, and whenever an element set directly (by an append, a Cursor
+// or a write to a dense array) takes the vector's density past a threshold;
+// see getRepresentation().
+//
+// A vector that won't change any more can be frozen, which compresses its
+// indices to a byte or two each; see freeze().
+//
+// The class is a template on the index and value types, like
+// std::basic_string:  SparseVector has int indices and int values, and
+// BasicSparseVector<long long, float> (say) suits vectors with more than
+// 2^31 elements and float values.  The members are defined in
+// SparseVector.cc, which instantiates the combinations of int or long long
+// indices with int, float or double values.  Positions within a vector are
+// still ints, so a vector holds fewer than 2^31 nonzero elements, and one
+// with more than 2^31 elements is never made into a bitmap or dense array.
+
+#include <vector>
+
+// One element of a sparse vector, for building vectors in bulk.
+template <typename Index, typename Value>
+struct BasicSparseEntry {
+  Index index;
+  Value value;
+};
 
-class SparseVector {
+typedef BasicSparseEntry<int, int> SparseEntry;
 
-private:
+// The type that dot products are summed in:  long long for int values,
+// whose products quickly overflow an int, double for floats, and otherwise
+// the value type itself.
+template <typename Value> struct SparseSum { typedef Value type; };
+template <> struct SparseSum<int> { typedef long long type; };
+template <> struct SparseSum<float> { typedef double type; };
 
-  // A linked-list node for our sparse vector elements.
-  struct node {
-    int index;   // Element number, in the range [0, size)
-    int value;   // The value of this element.
-    node *next;    // A pointer to the next node in the linked-list.
+template <typename Index, typename Value>
+class BasicSparseVector {
 
-    // Node constructor - simply initializes the data-members.
-    node(int index, int value, node *next = 0) : index(index), value(value), next(next) { }
+public:
+  typedef BasicSparseEntry<Index, Value> Entry;
+  typedef typename SparseSum<Value>::type Sum;
+
+  // How the elements are stored.
+  enum Representation {
+    SparseRep,    // sorted arrays of indices and values
+    BitmapRep,    // a bit per element, and the nonzero values in order
+    DenseRep,     // every value, zero or not
+    FrozenRep     // compressed indices, read-only (see freeze())
   };
 
-  int mSize;
-  node *mStart;
-
-  void copyList(const SparseVector &sv);
-  void clear();
-
-  void removeElem(int index);
-  void setNonzeroElem(int index, int value);
-
-  void addSubVector(const SparseVector &other, bool add);
-  void removeZeros();
-
-  void checkListOrder() const;
+private:
+  Index mSize;
+  Representation mRep;
+
+  std::vector<Index> mIndices;  // Element numbers of the nonzero elements,
+                                // in increasing order, in the range
+                                // [0, size) (SparseRep only)
+  std::vector<Value> mValues;   // mValues[i] is the value at mIndices[i];
+                                // for BitmapRep and FrozenRep the nonzero
+                                // values in index order, and for DenseRep
+                                // all size values
+
+  // BitmapRep only:  bit i of word i / 64 is set if element i is nonzero,
+  // and mRanks[w] is the number of bits set in the words before w.
+  std::vector<unsigned long long> mBits;
+  std::vector<int> mRanks;
+
+  int mNumNonzeros;           // (DenseRep only)
+
+  // FrozenRep only:  the indices in blocks of 128, each stored as its first
+  // index, mBlockFirst[b], and the gaps from there to the others, encoded
+  // from byte mBlockStart[b] of mBytes.
+  std::vector<unsigned char> mBytes;
+  std::vector<Index> mBlockFirst;
+  std::vector<long> mBlockStart;
+
+  // Pending changes, sorted by index:  new nonzero elements that are not in
+  // the arrays above, and zeros that remove elements that are.
+  std::vector<Index> mPendingIndices;
+  std::vector<Value> mPendingValues;
+
+  // Per-thread scratch arrays for merges (see SparseVector.cc).
+  static thread_local std::vector<Index> scratchIndices;
+  static thread_local std::vector<Value> scratchValues;
+  static void growScratch(int n);
+  static void growScratchValues(int n);
+  static void trimScratch();
+
+  int findPos(Index index) const;
+  int findPosFrom(Index index, int hint) const;
+  int findPendingPos(Index index) const;
+  int mainPos(Index index) const;
+  Value mainValue(Index index) const;
+  int mainCount() const;
+  template <typename Func> void forEachElem(Func func) const;
+  template <typename Func>
+  void forEachElemIn(Index lo, Index hi, Func func) const;
+  const BasicSparseVector & settled(BasicSparseVector &tmp) const;
+  const BasicSparseVector & thawed(BasicSparseVector &tmp) const;
+  int decodeBlock(int block, Index *indices) const;
+  void flush();
+  void flushBitmap();
+  void flushIfFull();
+
+  void adapt();
+  void adaptIfCrossed();
+  void toSparse();
+  void toBitmap();
+  void toDense();
+
+  void removeElem(Index index);
+  void setNonzeroElem(Index index, Value value);
+
+  void addSubVector(const BasicSparseVector &other, bool add);
+  void mergeVectors(const BasicSparseVector &a, const BasicSparseVector &b,
+                    Value scale);
+  void mergeDense(const BasicSparseVector &a, const BasicSparseVector &b,
+                  Value scale);
+  void mergeBitmaps(const BasicSparseVector &a, const BasicSparseVector &b,
+                    Value scale);
+  void mergeFrozen(const BasicSparseVector &a, const BasicSparseVector &b,
+                   Value scale);
+  static BasicSparseVector sumVectors(
+    const std::vector<const BasicSparseVector *> &vectors);
+
+  void validate() const;
+  bool checkListOrder() const;
   bool checkZeros() const;
 
 public:
+  // A cursor for writing many elements in (roughly) increasing order of
+  // index.  It remembers where the last write went and searches from there,
+  // so appending is O(1) and a write d elements away from the last one
+  // takes O(log d) steps to find its place.  Inserting before the end still
+  // shifts the elements after it, so writes should mostly move forwards.
+  // On a bitmap or dense vector it just calls BasicSparseVector::setElem().
+  class Cursor {
+  private:
+    BasicSparseVector &mVector;
+    int mPos;      // position just after the last element written
+
+  public:
+    Cursor(BasicSparseVector &sv);
+
+    void setElem(Index index, Value value);
+  };
+
   // Constructors
 
-  SparseVector();        // default constructor
-  SparseVector(int size);    // 1-argument constructor
-  SparseVector(const SparseVector &sv);  // copy constructor
+  BasicSparseVector();        // default constructor
+  BasicSparseVector(Index size);    // 1-argument constructor
+  BasicSparseVector(const BasicSparseVector &sv);  // copy constructor
+  BasicSparseVector(BasicSparseVector &&sv) noexcept;  // move constructor
+
+  // Builds a vector from count entries in any order.  Entries with the same
+  // index are added together, and elements that come to zero are left out.
+  // The entries are radix sorted, on all cores if there are many of them.
+  BasicSparseVector(Index size, const Entry *entries, long count);
 
   // Destructor
-  ~SparseVector();
+  ~BasicSparseVector();
 
   // Accessors
-  int getSize() const;
-  int getElem(int idx) const;
+  Index getSize() const;
+  Value getElem(Index idx) const;
+  int getNumNonzeros() const;
 
-  // Mutators
-  void setElem(int index, int value);
+  // Vectors with at least 1/32 of their elements nonzero are kept as
+  // bitmaps, and those with at least half as dense arrays.
+  Representation getRepresentation() const;
 
+  // Bytes used to store the elements.
+  long getStorageSize() const;
 
-  // Operators
-  SparseVector & operator=(const SparseVector &rhs);
+  // Mutators
+  void setElem(Index index, Value value);
+  void reserve(int nonzeros);
 
-  SparseVector & operator+=(const SparseVector &rhs);
-  SparseVector & operator-=(const SparseVector &rhs);
+  // Compresses the vector for storage:  its indices are kept as the gaps
+  // between them, a byte or more each, in blocks with a table of where
+  // each block starts for lookups.  A frozen vector can be read, and used
+  // in arithmetic (merges decode it a block at a time), but setElem() and
+  // compound assignments on it thaw it first.
+  void freeze();
+  void thaw();
 
-  const SparseVector operator+(const SparseVector &sv) const;
-  const SparseVector operator-(const SparseVector &sv) const;
 
-  bool operator==(const SparseVector &other) const;
-  bool operator!=(const SparseVector &other) const;
+  // Operators
+  BasicSparseVector & operator=(const BasicSparseVector &rhs);
+  BasicSparseVector & operator=(BasicSparseVector &&rhs) noexcept;
+
+  void swap(BasicSparseVector &other) noexcept;
+
+  BasicSparseVector & operator+=(const BasicSparseVector &rhs);
+  BasicSparseVector & operator-=(const BasicSparseVector &rhs);
+
+  // The results are returned by value, so that they can be moved.  On a
+  // temporary left operand (as in a + b - c) the result is built in the
+  // temporary's storage, instead of in a new vector.
+  BasicSparseVector operator+(const BasicSparseVector &sv) const &;
+  BasicSparseVector operator-(const BasicSparseVector &sv) const &;
+  BasicSparseVector operator+(const BasicSparseVector &sv) &&;
+  BasicSparseVector operator-(const BasicSparseVector &sv) &&;
+
+  bool operator==(const BasicSparseVector &other) const;
+  bool operator!=(const BasicSparseVector &other) const;
+
+  // Vector products.  When one operand has far fewer nonzero elements than
+  // the other, the sparse products gallop through the longer one, so they
+  // cost little more than a lookup per element of the shorter one.  Dot
+  // products are summed as Sum (see SparseSum).
+  Sum dot(const BasicSparseVector &other) const;
+  Sum dot(const Value *dense) const;        // dense has getSize() values
+  // this += scale * x
+  BasicSparseVector & axpy(Value scale, const BasicSparseVector &x);
+  BasicSparseVector & multiplyElems(const BasicSparseVector &other);
+
+  // Returns the sum of the vectors in [begin, end), which must all be the
+  // same size.  The vectors are merged all at once, on all cores, rather
+  // than one at a time as repeated += would.
+  template <typename Iter>
+  static BasicSparseVector sum(Iter begin, Iter end) {
+    std::vector<const BasicSparseVector *> vectors;
+    for (; begin != end; ++begin) {
+      vectors.push_back(&*begin);
+    }
+    return sumVectors(vectors);
+  }
 
 
 };
+
+// Lets std::swap() and unqualified swap() calls use BasicSparseVector::swap().
+template <typename Index, typename Value>
+inline void swap(BasicSparseVector<Index, Value> &a,
+                 BasicSparseVector<Index, Value> &b) noexcept {
+  a.swap(b);
+}
+
+// Int indices and values.
+typedef BasicSparseVector<int, int> SparseVector;
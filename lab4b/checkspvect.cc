@@ -1,8 +1,27 @@
+// Tests for the SparseVector class.  SparseVector.cc has code paths that are
+// chosen at compile time, so run these once for each of them:
+//
+//   g++ -std=c++11 -Wall -O2 -pthread -o checkspvect checkspvect.cc
+//       SparseVector.cc
+//
+// and again with each of these added to the command line:
+//
+//   -DNDEBUG                       no internal checks
+//   -DSPARSEVECTOR_CHECKS=1 -DSPARSEVECTOR_CHECK_RATE=1
+//                                  sampled checks, sampling every change
+//   -U__SSE2__ -U__SSSE3__         scalar code in place of the SSE kernels
+//   -mssse3                        the SSSE3 byte-shuffle decoder
+//   -DSPARSEVECTOR_ENTRIES_PER_CHUNK=16 -DSPARSEVECTOR_THREADS=4
+//                                  operations split across four threads,
+//                                  even for small vectors and on one core
+
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
 #include <set>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include "SparseVector.hh"
 
@@ -1484,6 +1503,902 @@ void basicMathSAO(ErrorContext &ec, int runs)
 }
 
 
+/**
+ * Tests on vectors with many nonzero elements, to make sure that lookups
+ * and arithmetic work (and finish quickly) at realistic sizes.
+ **/
+void largeVectors(ErrorContext &ec)
+{
+  bool pass;
+  const int N = 20000;
+
+  ec.DESC("--- Large sparse-vectors ---");
+
+  ec.DESC("count of nonzero elements");
+  {
+    SparseVector a(4 * N);
+
+    for (int i = 0; i < N; i++)
+      a.setElem(4 * i + i % 3, i + 1);
+
+    pass = (a.getNumNonzeros() == N);
+
+    a.setElem(1, 0);        // i = 0 is at index 0, so index 1 is unset
+    a.setElem(4 * 7 + 1, 0);
+    pass = pass && (a.getNumNonzeros() == N - 1);
+    ec.result(pass);
+  }
+
+  ec.DESC("large vector, set and clear elements in scattered order");
+  {
+    SparseVector a(N);
+
+    // 7919 is prime, so i * 7919 % N visits every index once.
+    for (int i = 0; i < N; i++)
+      a.setElem((int) ((long long) i * 7919 % N), i + 1);
+
+    for (int i = 0; i < N; i += 3)
+      a.setElem((int) ((long long) i * 7919 % N), 0);
+
+    pass = (a.getNumNonzeros() == N - (N + 2) / 3);
+    for (int i = 0; i < N; i++)
+    {
+      int expected = (i % 3 == 0 ? 0 : i + 1);
+      pass = pass && (a.getElem((int) ((long long) i * 7919 % N)) == expected);
+    }
+
+    // Adding zero must give an equal vector, however its elements are held.
+    SparseVector b(a);
+    b += SparseVector(N);
+    pass = pass && (a == b) && (b == a);
+    ec.result(pass);
+  }
+
+  ec.DESC("large vector, written through a cursor");
+  {
+    SparseVector a(2 * N), b(2 * N);
+    SparseVector::Cursor cursor(a);
+
+    // Append every even index, then go back over the vector writing odd
+    // indices and clearing every fourth index, mostly moving forwards.
+    for (int i = 0; i < N; i++)
+      cursor.setElem(2 * i, i + 1);
+
+    SparseVector::Cursor cursor2(a);
+    for (int i = 0; i < N; i += 2)
+    {
+      cursor2.setElem(2 * i + 1, -i - 1);
+      cursor2.setElem(2 * i, 0);
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+      b.setElem(2 * i, (i % 2 == 0 ? 0 : i + 1));
+      b.setElem(2 * i + 1, (i % 2 == 0 ? -i - 1 : 0));
+    }
+
+    pass = (a.getNumNonzeros() == N) && (a == b) &&
+           (a.getElem(0) == 0) && (a.getElem(1) == -1) && (a.getElem(2) == 2);
+    ec.result(pass);
+  }
+
+  ec.DESC("large vector, built in bulk from unsorted entries");
+  {
+    // Every index below N appears three times, in scrambled order, with
+    // values that sum to the index modulo 5 (so a fifth of them are zero).
+    vector<SparseEntry> entries(3 * N);
+    for (int i = 0; i < 3 * N; i++)
+    {
+      int index = (int) ((long long) (i % N) * 7919 % N);
+      entries[i].index = index;
+      entries[i].value = (i < N ? index % 5 + 10 : (i < 2 * N ? -6 : -4));
+    }
+
+    SparseVector a(N, &entries[0], 3 * N), b(N);
+    for (int i = 0; i < N; i++)
+      b.setElem(i, i % 5);
+
+    pass = (a == b) && (a.getNumNonzeros() == N - N / 5) &&
+           (a.getElem(7) == 2) && (a.getElem(10) == 0);
+
+    SparseVector empty(N, &entries[0], 0);
+    pass = pass && (empty == SparseVector(N));
+    ec.result(pass);
+  }
+
+  ec.DESC("large vectors, add and subtract with interleaved indices");
+  {
+    SparseVector a(3 * N), b(3 * N), c(3 * N);
+
+    // a has the multiples of 3, b the multiples of 3 plus 1, and both
+    // have every multiple of 9 (which cancel out in c).
+    for (int i = 0; i < N; i++)
+    {
+      a.setElem(3 * i, 2 * i + 1);
+      b.setElem(3 * i + 1, 5);
+      if (i % 3 == 0)
+        b.setElem(3 * i, 2 * i + 1);
+    }
+
+    c = a + b;
+    pass = (c.getNumNonzeros() == 2 * N) &&
+           (c.getElem(0) == 2) && (c.getElem(1) == 5) &&
+           (c.getElem(3) == 3) && (c.getElem(3 * (N - 1)) == 2 * N - 1);
+
+    c = a - b;
+    pass = pass && (c.getNumNonzeros() == 2 * N - (N + 2) / 3) &&
+           (c.getElem(0) == 0) && (c.getElem(9) == 0) &&
+           (c.getElem(3) == 3) && (c.getElem(1) == -5);
+
+    c -= a;
+    c += b;
+    pass = pass && (c == SparseVector(3 * N)) && (c.getNumNonzeros() == 0);
+    ec.result(pass);
+  }
+
+  ec.DESC("large vectors, add and subtract a vector to itself");
+  {
+    SparseVector a(2 * N);
+
+    for (int i = 0; i < N; i++)
+      a.setElem(2 * i + 1, i - N / 2);
+
+    a += a;
+    pass = (a.getNumNonzeros() == N - 1) && (a.getElem(1) == -N) &&
+           (a.getElem(2 * N - 1) == N - 2) && (a.getElem(N + 1) == 0);
+
+    a -= a;
+    pass = pass && (a.getNumNonzeros() == 0) && (a == SparseVector(2 * N));
+    ec.result(pass);
+  }
+
+  ec.DESC("sum of many vectors at once");
+  {
+    // a few elements each (summed through a heap), and then many (summed
+    // in an array)
+    pass = true;
+    for (int fill = 1; fill <= 1000; fill *= 1000) {
+      vector<SparseVector> vecs(100, SparseVector(N));
+      SparseVector total(N);
+
+      for (int v = 0; v < 100; v++) {
+        for (int k = 0; k < fill; k++)
+          vecs[v].setElem((v * 7919 + k * 104729) % N, (v % 2 ? 1 : -1) * (k + 1));
+        total += vecs[v];
+      }
+
+      SparseVector sum = SparseVector::sum(vecs.begin(), vecs.end());
+      pass = pass && (sum == total) && (sum.getSize() == N);
+    }
+
+    vector<SparseVector> none;
+    pass = pass && (SparseVector::sum(none.begin(), none.end()).getSize() == 0);
+    ec.result(pass);
+  }
+}
+
+
+/**
+ * Tests of the vector products:  dot products, axpy and element-wise
+ * multiplication.
+ **/
+void products(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Vector products ---");
+
+  ec.DESC("dot products, sparse and dense");
+  {
+    SparseVector a(10), b(10);
+    int dense[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+    a.setElem(1, 3);
+    a.setElem(4, -2);
+    a.setElem(9, 5);
+
+    b.setElem(0, 7);
+    b.setElem(4, 6);
+    b.setElem(9, 2);
+
+    pass = (a.dot(b) == -2) && (b.dot(a) == -2) &&
+           (a.dot(dense) == 6 - 10 + 50) &&
+           (a.dot(SparseVector(10)) == 0);
+    ec.result(pass);
+  }
+
+  ec.DESC("dot product does not overflow");
+  {
+    SparseVector a(4);
+
+    a.setElem(0, 2000000000);
+    a.setElem(3, 2000000000);
+
+    pass = (a.dot(a) == 8000000000000000000LL);
+    ec.result(pass);
+  }
+
+  ec.DESC("dot product, one vector much sparser than the other");
+  {
+    const int N = 100000;
+    SparseVector a(N), b(N);
+
+    for (int i = 0; i < N; i += 2)
+      a.setElem(i, 1);
+    b.setElem(0, 3);
+    b.setElem(5, 100);
+    b.setElem(N - 2, 4);
+
+    pass = (a.dot(b) == 7) && (b.dot(a) == 7);
+    ec.result(pass);
+  }
+
+  ec.DESC("axpy");
+  {
+    SparseVector a(10), b(10);
+
+    a.setElem(2, 6);
+    a.setElem(5, 1);
+
+    b.setElem(2, 2);
+    b.setElem(7, -1);
+
+    a.axpy(-3, b);
+
+    pass = (a.getElem(2) == 0) && (a.getElem(5) == 1) &&
+           (a.getElem(7) == 3) && (a.getNumNonzeros() == 2);
+
+    a.axpy(0, b);
+    pass = pass && (a.getNumNonzeros() == 2);
+    ec.result(pass);
+  }
+
+  ec.DESC("element-wise multiply");
+  {
+    SparseVector a(10), b(10);
+
+    a.setElem(1, 4);
+    a.setElem(3, -2);
+    a.setElem(8, 5);
+
+    b.setElem(3, 6);
+    b.setElem(8, 2);
+    b.setElem(9, 7);
+
+    a.multiplyElems(b);
+
+    pass = (a.getElem(1) == 0) && (a.getElem(3) == -12) &&
+           (a.getElem(8) == 10) && (a.getElem(9) == 0) &&
+           (a.getNumNonzeros() == 2);
+    ec.result(pass);
+  }
+
+  // The intersections compare blocks of four indices at a time, and finish
+  // one element at a time; these check the two fit together for every
+  // combination of lengths up to three blocks.
+  ec.DESC("products, lengths that are not multiples of four");
+  {
+    const int Stride = 1009;      // keeps the vectors sparse
+    pass = true;
+    for (int n = 0; n <= 13; n++)
+      for (int m = 0; m <= 13; m++)
+      {
+        // a has every 3rd index and b every 2nd, so they meet at every 6th;
+        // b's values cancel a's at every other meeting.
+        long long da[40] = { 0 }, db[40] = { 0 };
+        SparseVector a(40 * Stride), b(40 * Stride);
+        for (int k = 0; k < n; k++)
+        {
+          da[3 * k] = k + 1;
+          a.setElem(3 * k * Stride, k + 1);
+        }
+        for (int k = 0; k < m; k++)
+        {
+          db[2 * k] = (k % 6 == 0 ? -da[2 * k] : k + 2);
+          if (db[2 * k] == 0)
+            db[2 * k] = k + 2;
+          b.setElem(2 * k * Stride, (int) db[2 * k]);
+        }
+
+        long long dot = 0;
+        int products = 0, sums = 0;
+        for (int x = 0; x < 40; x++)
+        {
+          dot += da[x] * db[x];
+          products += (da[x] * db[x] != 0);
+          sums += (da[x] + db[x] != 0);
+        }
+
+        SparseVector sum = a + b, prod(a);
+        prod.multiplyElems(b);
+        pass = pass && (a.dot(b) == dot) && (b.dot(a) == dot) &&
+               (prod.getNumNonzeros() == products) &&
+               (sum.getNumNonzeros() == sums);
+        for (int x = 0; x < 40; x++)
+          pass = pass && (prod.getElem(x * Stride) == da[x] * db[x]) &&
+                 (sum.getElem(x * Stride) == da[x] + db[x]);
+      }
+    ec.result(pass);
+  }
+
+  ec.DESC("products, matches only in the last partial block");
+  {
+    pass = true;
+    for (int n = 1; n <= 15; n++)
+      for (int m = 1; m <= n; m++)
+      {
+        // a has the even indices below 2n, and b the odd ones below 2m - 2
+        // and then a's last index, which is the only match.
+        SparseVector a(1 << 20), b(1 << 20);
+        for (int k = 0; k < n; k++)
+          a.setElem(2 * k * 1000, k + 1);
+        for (int k = 0; k < m - 1; k++)
+          b.setElem((2 * k + 1) * 1000, 5);
+        b.setElem(2 * (n - 1) * 1000, -n);
+
+        SparseVector sum = a + b, prod(b);
+        prod.multiplyElems(a);
+        pass = pass && (a.dot(b) == -n * n) && (b.dot(a) == -n * n) &&
+               (prod.getNumNonzeros() == 1) &&
+               (prod.getElem(2 * (n - 1) * 1000) == -n * n) &&
+               (sum.getNumNonzeros() == n - 1 + m - 1) &&
+               (sum.getElem(2 * (n - 1) * 1000) == 0);
+      }
+    ec.result(pass);
+  }
+}
+
+
+/**
+ * Tests of the bitmap and dense representations, which vectors switch to
+ * as they fill up, and back from as they empty.  The values must not
+ * depend on how they are stored.
+ **/
+void representations(ErrorContext &ec)
+{
+  bool pass;
+  const int N = 6400;
+
+  ec.DESC("--- Bitmap and dense representations ---");
+
+  ec.DESC("vectors switch representation as they fill and empty");
+  {
+    SparseVector a(N), b(N), empty(N);
+
+    for (int i = 0; i < N; i += 16)
+      a.setElem(i, 1);
+    for (int i = 0; i < N; i += 2)
+      b.setElem(i, 2);
+
+    pass = (a.getRepresentation() == SparseVector::BitmapRep) &&
+           (a.getNumNonzeros() == N / 16);
+
+    a += b;
+    pass = pass && (a.getRepresentation() == SparseVector::DenseRep) &&
+           (a.getNumNonzeros() == N / 2);
+    for (int i = 0; i < N; i++) {
+      int expected = (i % 16 == 0 ? 3 : (i % 2 == 0 ? 2 : 0));
+      if (a.getElem(i) != expected)
+        pass = false;
+    }
+
+    a -= b;
+    pass = pass && (a.getRepresentation() == SparseVector::BitmapRep) &&
+           (a.getNumNonzeros() == N / 16);
+    for (int i = 0; i < N; i++) {
+      if (a.getElem(i) != (i % 16 == 0 ? 1 : 0))
+        pass = false;
+    }
+
+    a -= a;
+    pass = pass && (a.getRepresentation() == SparseVector::SparseRep) &&
+           (a.getNumNonzeros() == 0) && (a == empty);
+    ec.result(pass);
+  }
+
+  ec.DESC("vectors filled in any order take the same representation");
+  {
+    // every 100th, 8th and 4 in 5 elements:  sparse, bitmap and dense
+    const int Steps[3] = { 100, 8, 1 };
+    const SparseVector::Representation Reps[3] = {
+      SparseVector::SparseRep, SparseVector::BitmapRep, SparseVector::DenseRep
+    };
+
+    pass = true;
+    for (int r = 0; r < 3; r++)
+    {
+      SparseVector up(N), down(N), cursor(N), scattered(N);
+      SparseVector::Cursor c(cursor);
+      for (int i = 0; i < N; i += Steps[r])
+      {
+        if (r == 2 && i % 5 == 4)
+          continue;
+        up.setElem(i, 1);
+        down.setElem(N - Steps[r] - i, 1);
+        c.setElem(i, 1);
+      }
+      for (int k = 0; k < N; k++)
+      {
+        int i = (int) ((k * 2654435761LL) % N);   // each index once
+        if (i % Steps[r] == 0 && !(r == 2 && i % 5 == 4))
+          scattered.setElem(i, 1);
+      }
+
+      pass = pass && (up.getRepresentation() == Reps[r]) &&
+             (down.getRepresentation() == Reps[r]) &&
+             (cursor.getRepresentation() == Reps[r]) &&
+             (scattered.getRepresentation() == Reps[r]) &&
+             (up == cursor) && (up == scattered);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("dense vectors go back to bitmaps as they are emptied");
+  {
+    SparseVector a(N);
+    for (int i = 0; i < N; i++)
+      a.setElem(i, 1);
+    pass = (a.getRepresentation() == SparseVector::DenseRep);
+
+    for (int i = 0; i < N; i++)
+      if (i % 8 != 0)
+        a.setElem(i, 0);
+    pass = pass && (a.getRepresentation() == SparseVector::BitmapRep) &&
+           (a.getNumNonzeros() == N / 8);
+    ec.result(pass);
+  }
+
+  ec.DESC("arithmetic and products across representations");
+  {
+    SparseVector s(N), bm(N), d(N), empty(N);
+
+    for (int i = 0; i < N; i += 100)
+      s.setElem(i, i / 100 + 1);
+    for (int i = 0; i < N; i += 10)
+      bm.setElem(i, 3);
+    for (int i = 0; i < N; i++)
+      d.setElem(i, (i % 3 == 0 ? 0 : 5));
+
+    pass = (s.getRepresentation() == SparseVector::SparseRep) &&
+           (bm.getRepresentation() == SparseVector::BitmapRep) &&
+           (d.getRepresentation() == SparseVector::DenseRep);
+
+    const SparseVector *vecs[3] = { &s, &bm, &d };
+    for (int x = 0; x < 3; x++) {
+      for (int y = 0; y < 3; y++) {
+        const SparseVector &u = *vecs[x], &v = *vecs[y];
+        SparseVector sum = u + v, diff = u - v, prod(u);
+        prod.multiplyElems(v);
+
+        long long dot = 0;
+        for (int i = 0; i < N; i++) {
+          int ui = u.getElem(i), vi = v.getElem(i);
+          dot += (long long) ui * vi;
+          if (sum.getElem(i) != ui + vi || diff.getElem(i) != ui - vi ||
+              prod.getElem(i) != ui * vi)
+            pass = false;
+        }
+        pass = pass && (u.dot(v) == dot) && (diff == empty) == (x == y);
+      }
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("equal vectors held in different representations");
+  {
+    SparseVector a(N), b(N);
+
+    // b is filled to 1/8 and emptied to 1/40, which leaves it a bitmap,
+    // while a is only ever filled to 1/40.
+    for (int i = 0; i < N; i += 40)
+      a.setElem(i, 7);
+    for (int i = 0; i < N; i += 8)
+      b.setElem(i, (i % 40 == 0 ? 7 : 1));
+    for (int i = 0; i < N; i += 8)
+      if (i % 40 != 0)
+        b.setElem(i, 0);
+
+    pass = (a.getRepresentation() == SparseVector::SparseRep) &&
+           (b.getRepresentation() == SparseVector::BitmapRep) &&
+           (a == b) && (b == a);
+
+    b.setElem(40, 6);
+    pass = pass && (a != b) && (b != a);
+    ec.result(pass);
+  }
+
+  ec.DESC("setElem and cursors on bitmap and dense vectors");
+  {
+    SparseVector a(N), b(N);
+
+    for (int i = 0; i < N; i += 8)
+      a.setElem(i, 1);
+    for (int i = 0; i < N; i++)
+      b.setElem(i, 1);
+
+    // scattered changes, some of them pending until they are merged
+    for (int i = 1; i < N; i += 37) {
+      a.setElem(i, 2);
+      b.setElem(i, 0);
+    }
+    SparseVector::Cursor ca(a), cb(b);
+    for (int i = 3; i < N; i += 50) {
+      ca.setElem(i, 4);
+      cb.setElem(i, 0);
+    }
+
+    pass = true;
+    for (int i = 0; i < N; i++) {
+      int ea = (i % 50 == 3 ? 4 : (i % 37 == 1 ? 2 : (i % 8 == 0 ? 1 : 0)));
+      int eb = (i % 50 == 3 || i % 37 == 1 ? 0 : 1);
+      if (a.getElem(i) != ea || b.getElem(i) != eb)
+        pass = false;
+    }
+    ec.result(pass);
+  }
+}
+
+
+/**
+ * Tests of moving and swapping vectors, and of arithmetic on temporaries,
+ * which reuses the temporaries' storage.
+ **/
+void moves(ErrorContext &ec)
+{
+  bool pass;
+
+  ec.DESC("--- Moves and swaps ---");
+
+  ec.DESC("move constructor and move assignment");
+  {
+    SparseVector a(10);
+
+    a.setElem(2, 5);
+    a.setElem(7, -1);
+    SparseVector copy(a);
+
+    SparseVector b(std::move(a));
+    pass = (b == copy) && (a.getSize() == 0) && (a.getNumNonzeros() == 0);
+
+    SparseVector c(3);
+    c = std::move(b);
+    pass = pass && (c == copy) && (c.getNumNonzeros() == 2);
+
+    // a moved-from vector can be assigned to again
+    a = copy;
+    pass = pass && (a == copy);
+    ec.result(pass);
+  }
+
+  ec.DESC("swap");
+  {
+    SparseVector a(10), b(20);
+
+    a.setElem(3, 4);
+    b.setElem(15, 6);
+    b.setElem(16, 7);
+
+    swap(a, b);
+    pass = (a.getSize() == 20) && (a.getElem(15) == 6) &&
+           (a.getNumNonzeros() == 2) && (b.getSize() == 10) &&
+           (b.getElem(3) == 4) && (b.getNumNonzeros() == 1);
+
+    a.swap(a);
+    pass = pass && (a.getSize() == 20) && (a.getNumNonzeros() == 2);
+    ec.result(pass);
+  }
+
+  ec.DESC("chained arithmetic on temporaries");
+  {
+    SparseVector a(10), b(10), c(10);
+
+    a.setElem(0, 1);
+    a.setElem(5, 2);
+    b.setElem(5, 3);
+    b.setElem(9, 4);
+    c.setElem(0, 1);
+    c.setElem(9, 8);
+
+    SparseVector r = a + b - c + a;
+
+    pass = (r.getElem(0) == 1) && (r.getElem(5) == 7) &&
+           (r.getElem(9) == -4) && (r.getNumNonzeros() == 3) &&
+           (a.getElem(5) == 2) && (a.getNumNonzeros() == 2) &&
+           (b.getNumNonzeros() == 2) && (c.getNumNonzeros() == 2);
+    ec.result(pass);
+  }
+}
+
+/**
+ * Tests of frozen vectors, which store their indices compressed.
+ **/
+void frozen(ErrorContext &ec)
+{
+  bool pass;
+  const int N = 2000000000;
+
+  ec.DESC("--- Frozen vectors ---");
+
+  ec.DESC("frozen vectors keep their elements");
+  {
+    // gaps that take one to four bytes each, and several blocks' worth
+    SparseVector a(N);
+    int far[5] = { 0, 1, 300, 70000, 20000000 };
+    for (int i = 0; i < 5; i++)
+      a.setElem(far[i], i + 1);
+    for (int i = 0; i < 1000; i++)
+      a.setElem(30000000 + 3 * i, -i - 1);
+    a.setElem(N - 1, 9);
+
+    SparseVector f(a);
+    f.freeze();
+
+    pass = (f.getRepresentation() == SparseVector::FrozenRep) &&
+           (f.getNumNonzeros() == 1006) && (f == a) && (a == f) &&
+           (f.getStorageSize() < a.getStorageSize()) &&
+           (f.getElem(N - 1) == 9) && (f.getElem(N - 2) == 0) &&
+           (f.getElem(30000001) == 0);
+    for (int i = 0; i < 5; i++)
+      pass = pass && (f.getElem(far[i]) == i + 1) && (f.getElem(far[i] + 2) == 0);
+    for (int i = 0; i < 1000; i++)
+      pass = pass && (f.getElem(30000000 + 3 * i) == -i - 1);
+    ec.result(pass);
+  }
+
+  ec.DESC("arithmetic with frozen vectors");
+  {
+    SparseVector a(N), b(N);
+
+    for (int i = 0; i < 500; i++) {
+      a.setElem(7 * i, i + 1);
+      b.setElem(5 * i, 2);
+    }
+    SparseVector f(a);
+    f.freeze();
+
+    SparseVector prod(f), expectedProd(a);
+    prod.multiplyElems(b);
+    expectedProd.multiplyElems(b);
+
+    pass = (f + b == a + b) && (b - f == b - a) &&
+           (f.dot(b) == a.dot(b)) && (prod == expectedProd);
+
+    SparseVector g(f);
+    g.axpy(3, b);
+    SparseVector expected(a);
+    expected.axpy(3, b);
+    pass = pass && (g == expected) &&
+           (g.getRepresentation() != SparseVector::FrozenRep);
+    ec.result(pass);
+  }
+
+  ec.DESC("writing to a frozen vector thaws it");
+  {
+    SparseVector a(100);
+
+    a.setElem(10, 1);
+    a.setElem(20, 2);
+    a.freeze();
+    a.setElem(15, 3);
+    a.setElem(10, 0);
+
+    pass = (a.getRepresentation() == SparseVector::SparseRep) &&
+           (a.getElem(15) == 3) && (a.getElem(20) == 2) &&
+           (a.getElem(10) == 0) && (a.getNumNonzeros() == 2);
+    ec.result(pass);
+  }
+}
+
+
+void wideVectors(ErrorContext &ec)
+{
+  bool pass;
+  typedef BasicSparseVector<long long, int> WideVector;
+  typedef BasicSparseVector<int, float> FloatVector;
+  typedef BasicSparseVector<long long, double> WideDoubleVector;
+  const long long N = 10000000000000LL;   // 10^13 elements
+
+  ec.DESC("--- 64-bit indices and floating-point values ---");
+
+  ec.DESC("indices past 2^31, and frozen gaps past 2^32");
+  {
+    WideVector a(N), b(N);
+    long long far[4] = { 5, 3000000000LL, 9000000000000LL, N - 1 };
+    for (int i = 0; i < 4; i++) {
+      a.setElem(far[i], i + 1);
+      b.setElem(far[i], 10);
+    }
+    b.setElem(far[1] + 1, 7);
+
+    WideVector f(a);
+    f.freeze();
+
+    pass = (a.getSize() == N) && (a.getNumNonzeros() == 4) &&
+           (a.getElem(far[2]) == 3) && (a.getElem(far[2] - 1) == 0) &&
+           (f == a) && (f.getElem(N - 1) == 4) &&
+           (a.dot(b) == 100) && ((a + b).getElem(far[1] + 1) == 7) &&
+           ((f - a).getNumNonzeros() == 0) &&
+           (a.getRepresentation() == WideVector::SparseRep);
+    ec.result(pass);
+  }
+
+  ec.DESC("float values in every representation");
+  {
+    const int Size = 1000;
+    FloatVector a(Size), b(Size), dense(Size);
+    for (int i = 0; i < Size; i += 20) {
+      a.setElem(i, 0.5f);
+      b.setElem(i, 1.5f);
+    }
+    for (int i = 0; i < Size; i++)
+      dense.setElem(i, 0.25f);
+
+    // (the representation is chosen when the vectors are merged)
+    FloatVector sum = a + b, twice = dense + dense;
+    FloatVector c(a);
+    c.axpy(2.0f, twice);
+    FloatVector prod(sum);
+    prod.multiplyElems(b);
+
+    pass = (sum.getRepresentation() == FloatVector::BitmapRep) &&
+           (twice.getRepresentation() == FloatVector::DenseRep) &&
+           (a.dot(b) == 37.5) && (sum.dot(b) == 150.0) &&
+           (twice.dot(twice) == 250.0) &&
+           (c.getElem(0) == 1.5f) && (c.getElem(1) == 1.0f) &&
+           (prod.getElem(20) == 3.0f) && (prod.getNumNonzeros() == 50) &&
+           ((sum - sum).getNumNonzeros() == 0) && (b - a - a == a);
+    ec.result(pass);
+  }
+
+  ec.DESC("building and summing 64-bit vectors of doubles");
+  {
+    vector<BasicSparseEntry<long long, double> > entries;
+    for (long long i = 0; i < 1000; i++) {
+      BasicSparseEntry<long long, double> e = { i * 4000000000LL, 0.5 };
+      entries.push_back(e);
+      entries.push_back(e);
+    }
+    WideDoubleVector a(N, &entries[0], (long) entries.size());
+    vector<WideDoubleVector> parts(3, a);
+    WideDoubleVector total = WideDoubleVector::sum(parts.begin(), parts.end());
+
+    pass = (a.getNumNonzeros() == 1000) &&
+           (a.getElem(999 * 4000000000LL) == 1.0) &&
+           (total.getElem(4000000000LL) == 3.0) &&
+           (total.dot(a) == 3000.0);
+    ec.result(pass);
+  }
+}
+
+
+/**
+ * Sums of long sparse vectors are merged in ranges of indices, one range
+ * per core.  These tests only split the merges if SparseVector.cc is built
+ * with small chunks, for example:
+ *
+ *   -DSPARSEVECTOR_ENTRIES_PER_CHUNK=16 -DSPARSEVECTOR_THREADS=4
+ *
+ * but the results must be the same either way.
+ **/
+void splitMerges(ErrorContext &ec)
+{
+  bool pass;
+  const int R = 5000;             // element x of a test is at index x * 512
+  const int N = R * 512;
+
+  ec.DESC("--- Merges split into ranges ---");
+
+  ec.DESC("sums and differences match element-by-element sums");
+  {
+    unsigned int seed = 12345;
+    pass = true;
+    for (int trial = 0; trial < 10; trial++)
+    {
+      // small values, so that many of the common elements cancel
+      vector<int> da(R, 0), db(R, 0);
+      SparseVector a(N), b(N);
+      for (int x = 0; x < R; x++)
+      {
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 16) % 16;
+        if (r < 6)
+          da[x] = r - 3 + (r >= 3);   // -3..-1, 1..3
+        else if (r < 12)
+          db[x] = r - 9 + (r >= 9);
+        else if (r < 15)
+        {
+          da[x] = r - 11;             // 1..3, with b the same or its negation
+          db[x] = (trial % 2 ? -da[x] : da[x]);
+        }
+        if (da[x] != 0)
+          a.setElem(x * 512, da[x]);
+        if (db[x] != 0)
+          b.setElem(x * 512, db[x]);
+      }
+
+      SparseVector sum = a + b, diff = a - b, c(a);
+      c.axpy(3, b);
+      int sums = 0, diffs = 0, axpys = 0;
+      for (int x = 0; x < R; x++)
+      {
+        sums += (da[x] + db[x] != 0);
+        diffs += (da[x] - db[x] != 0);
+        axpys += (da[x] + 3 * db[x] != 0);
+        pass = pass && (sum.getElem(x * 512) == da[x] + db[x]) &&
+               (diff.getElem(x * 512) == da[x] - db[x]) &&
+               (c.getElem(x * 512) == da[x] + 3 * db[x]);
+      }
+      pass = pass && (sum.getNumNonzeros() == sums) &&
+             (diff.getNumNonzeros() == diffs) &&
+             (c.getNumNonzeros() == axpys);
+    }
+    ec.result(pass);
+  }
+
+  ec.DESC("sums that cancel at every range boundary");
+  {
+    // a and b have the same indices, so every range starts at an index of
+    // both, and b cancels a everywhere except every 50th element.
+    SparseVector a(N), b(N);
+    for (int x = 0; x < R; x++)
+    {
+      a.setElem(x * 512, x % 9 + 1);
+      b.setElem(x * 512, -(x % 9 + 1) + (x % 50 == 7));
+    }
+
+    SparseVector sum = a + b;
+    pass = (sum.getNumNonzeros() == R / 50);
+    for (int x = 7; x < R; x += 50)
+      pass = pass && (sum.getElem(x * 512) == 1);
+
+    a += b;
+    pass = pass && (a == sum);
+    ec.result(pass);
+  }
+
+  ec.DESC("sums that cancel completely");
+  {
+    SparseVector a(N), b(N);
+    for (int x = 0; x < R; x++)
+    {
+      a.setElem(x * 512 + x % 3, x + 1);
+      b.setElem(x * 512 + x % 3, -x - 1);
+    }
+
+    SparseVector c(a);
+    c.axpy(-1, c);
+    pass = ((a + b).getNumNonzeros() == 0) && (c.getNumNonzeros() == 0) &&
+           ((a - a).getNumNonzeros() == 0) && (a + b == SparseVector(N));
+    ec.result(pass);
+  }
+
+  ec.DESC("sums where a range has elements of only one vector");
+  {
+    // a is in the first half of the indices and b in the second, apart
+    // from one element each at the far ends.
+    SparseVector a(N), b(N);
+    for (int x = 0; x < R / 2; x++)
+      a.setElem(x * 512, x + 1);
+    for (int x = R / 2; x < R; x++)
+      b.setElem(x * 512, -x);
+    a.setElem(N - 1, 7);
+    b.setElem(0, 5);
+
+    SparseVector sum = a + b, diff = b - a;
+    pass = (sum.getNumNonzeros() == R + 1) &&
+           (diff.getNumNonzeros() == R + 1) &&
+           (sum.getElem(0) == 6) && (diff.getElem(0) == 4) &&
+           (sum.getElem(N - 1) == 7) && (diff.getElem(N - 1) == -7);
+    for (int x = 1; x < R; x++)
+    {
+      int expected = (x < R / 2 ? x + 1 : -x);
+      pass = pass && (sum.getElem(x * 512) == expected) &&
+             (diff.getElem(x * 512) == (x < R / 2 ? -expected : expected));
+    }
+    ec.result(pass);
+  }
+}
+
 
 
 #endif // CS11_LAB4_PARTB
@@ -1526,5 +2441,12 @@ int main()
   equality(ec);         // Checks for == / != operators
   basicMathCAO(ec, NumIters);  // Basic math with the Compound Assignment Operators
   basicMathSAO(ec, NumIters);  // Basic math with the Simple Arithmetic Operators
+  largeVectors(ec);     // Lookups and arithmetic on many nonzero elements
+  products(ec);         // Dot products, axpy and element-wise multiply
+  representations(ec);  // Bitmap and dense storage of fuller vectors
+  moves(ec);            // Moves, swaps and arithmetic on temporaries
+  frozen(ec);           // Compressed, read-only vectors
+  wideVectors(ec);      // 64-bit indices and floating-point values
+  splitMerges(ec);      // Sums merged in ranges across cores
 #endif
 }